@@ -0,0 +1,99 @@
+#pragma once
+
+#ifndef _ATLAS_FILE_H_
+#define _ATLAS_FILE_H_
+
+#include <cstdint>
+#include <cstddef>
+
+namespace bmf
+{
+	// Layout of the files written by BitmapFontCache::save(), in the byte order of the machine:
+	// the header, a FontRecord per font, a PoolRecord per pool, then for every pool its slot tree
+	// in preorder, the indices of its free slots in list order and its glyphs. Page images
+	// follow, each at an offset aligned on ALIGNMENT so that they can be mapped.
+	namespace atlasFile
+	{
+		const char MAGIC[4] = { 'B', 'M', 'F', 'A' };
+		const uint32_t VERSION = 1;
+		const size_t ALIGNMENT = 64 * 1024;	// allocation granularity of Windows mappings
+
+		struct Header
+		{
+			char		magic[4];
+			uint32_t	version;
+			int32_t		freetypeVersion[3];	// major, minor, patch
+			int32_t		pageWidth;
+			int32_t		pageHeight;
+			uint32_t	fontCount;
+			uint32_t	poolCount;
+			float		gamma;
+		};
+
+		// Glyphs are only valid for the same font file rendered with the same options
+		struct FontRecord
+		{
+			uint64_t	hash;
+			int32_t		loadFlags;
+			uint8_t		hinting;
+			uint8_t		renderMode;
+			uint8_t		embolden;
+			uint8_t		padding;
+		};
+
+		struct PoolRecord
+		{
+			uint8_t		format;
+			uint8_t		layout;
+			uint8_t		padding[2];
+			int32_t		paddingX;
+			int32_t		paddingY;
+			uint32_t	slotCount;
+			uint32_t	freeSlotCount;
+			uint32_t	glyphCount;
+			uint64_t	dataOffset;
+			uint64_t	dataSize;
+		};
+
+		struct SlotRecord
+		{
+			int32_t		rect[4];	// left, top, width, height
+			uint8_t		state;
+			uint8_t		byWidth;	// for divided slots, direction of the division
+			uint8_t		padding[2];
+		};
+
+		struct GlyphRecord
+		{
+			int32_t		fontIndex;
+			int32_t		unicodeChar;
+			int32_t		pixelSize;
+			int32_t		spread;
+			int32_t		loadFlags;
+			float		strokeWidth;
+			uint8_t		byGlyphIndex;
+			uint8_t		mode;
+			uint8_t		lcdFilter;
+			uint8_t		subpixelOrder;
+			uint8_t		hinting;
+			uint8_t		renderMode;
+			uint8_t		embolden;
+			uint8_t		padding;
+			uint32_t	slot;	// preorder index in the slot tree of the pool
+			int32_t		rect[4];
+			int32_t		left;
+			int32_t		top;
+		};
+
+		// FNV-1a, to detect modified font files
+		inline uint64_t hash(const unsigned char* _data, size_t _size)
+		{
+			uint64_t value = 14695981039346656037ull;
+			for (size_t i = 0; i < _size; i++)
+				value = (value ^ _data[i]) * 1099511628211ull;
+			return value;
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,366 @@
+#include "stdafx.h"
+#include "AtlasPage.h"
+#include "PageMemory.h"
+
+#include <cstring>
+#include <algorithm>
+#include <cassert>
+
+namespace bmf
+{
+	AtlasPage::AtlasPage(PageFormat _format, int _width, int _height, bool _largePages) : m_format(_format), m_width(_width), m_height(_height),
+		m_largePages(_largePages), m_dirty(_width, _height, getPitch(_format, _width)), m_unpublished(_width, _height, getPitch(_format, _width))
+	{
+		// Already zero filled
+		m_data = static_cast<unsigned char*>(allocatePageMemory(getSize(), m_largePages));
+	}
+
+	AtlasPage::~AtlasPage()
+	{
+		releaseBuffer(m_data);
+		releaseBuffer(m_front);
+	}
+
+	void AtlasPage::releaseBuffer(unsigned char*& _buffer)
+	{
+		if (_buffer && _buffer == m_mapping)
+		{
+			unmapFileMemory(m_mapping, getSize());
+			m_mapping = nullptr;
+		}
+		else if (_buffer && _buffer == m_external)
+		{
+			m_external = nullptr;
+		}
+		else
+		{
+			freePageMemory(_buffer, getSize());
+		}
+		_buffer = nullptr;
+	}
+
+	bool AtlasPage::mapFile(const char* _filename, size_t _offset, PageLayout _layout)
+	{
+		const int tileSize = getTileSize(_layout);
+		if (_layout != PageLayout::Linear && (m_format == PageFormat::Mono1 || m_width % tileSize != 0 || m_height % tileSize != 0))
+			return false;
+
+		unsigned char* data = static_cast<unsigned char*>(mapFileMemory(_filename, _offset, getSize()));
+		if (!data)
+			return false;
+
+		releaseBuffer(m_data);
+		m_data = m_mapping = data;
+		if (m_front)
+			std::memcpy(m_front, m_data, getSize());
+
+		m_layout = _layout;
+		m_writtenTop = 0;
+		m_writtenBottom = m_height;
+		m_dirty.setTileSize(tileSize);
+		m_unpublished.setTileSize(tileSize);
+		m_unpublished.clear();
+		m_dirty.clear();
+		m_dirty.add(Rect(0, 0, m_width, m_height));
+		return true;
+	}
+
+	void AtlasPage::attachMemory(unsigned char* _data)
+	{
+		assert(!m_front);
+		std::memcpy(_data, m_data, getSize());
+		releaseBuffer(m_data);
+		m_data = m_external = _data;
+	}
+
+	void AtlasPage::setDoubleBuffered(bool _doubleBuffered)
+	{
+		if (_doubleBuffered == isDoubleBuffered())
+			return;
+
+		if (_doubleBuffered)
+		{
+			m_front = static_cast<unsigned char*>(allocatePageMemory(getSize(), m_largePages));
+			std::memcpy(m_front, m_data, getSize());
+			return;
+		}
+
+		// The back buffer becomes the only one, with what was not published yet
+		releaseBuffer(m_front);
+		for (const Rect& region : m_unpublished.take())
+			m_dirty.add(region);
+	}
+
+	void AtlasPage::markDirty(const Rect& _rect)
+	{
+		addWrittenRows(_rect);
+		if (m_front)
+			m_unpublished.add(_rect);
+		else
+			m_dirty.add(_rect);
+	}
+
+	void AtlasPage::addWrittenRows(const Rect& _rect)
+	{
+		if (_rect.height() == 0)
+			return;
+		if (m_writtenTop == m_writtenBottom)
+		{
+			m_writtenTop = _rect.top();
+			m_writtenBottom = _rect.bottom();
+			return;
+		}
+		m_writtenTop = std::min(m_writtenTop, _rect.top());
+		m_writtenBottom = std::max(m_writtenBottom, _rect.bottom());
+	}
+
+	void AtlasPage::publish()
+	{
+		if (!m_front)
+			return;
+
+		std::swap(m_front, m_data);
+		for (const Rect& region : m_unpublished.take())
+		{
+			copyRegion(m_front, m_data, region);
+			m_dirty.add(region);
+		}
+	}
+
+	void AtlasPage::copyRegion(const unsigned char* _src, unsigned char* _dst, const Rect& _rect) const
+	{
+		for (const Span& span : getSpans(_rect))
+			std::memcpy(_dst + span.offset, _src + span.offset, span.size);
+	}
+
+	int AtlasPage::getTileSize(PageLayout _layout)
+	{
+		switch (_layout)
+		{
+		case PageLayout::Tiled8:
+			return 8;
+		case PageLayout::Tiled16:
+			return 16;
+		default:
+			return 1;
+		}
+	}
+
+	// Morton order inside a tile: bits of x on even positions, bits of y on odd ones, so that
+	// every 2x2, 4x4 and 8x8 block is contiguous
+	struct MortonTable
+	{
+		MortonTable()
+		{
+			for (unsigned int v = 0; v < 16; v++)
+			{
+				x[v] = 0;
+				for (unsigned int bit = 0; bit < 4; bit++)
+					x[v] |= ((v >> bit) & 1) << (bit * 2);
+				y[v] = x[v] << 1;
+			}
+		}
+
+		unsigned int x[16];
+		unsigned int y[16];
+	};
+	static const MortonTable s_morton;
+
+	bool AtlasPage::setLayout(PageLayout _layout)
+	{
+		const int tileSize = getTileSize(_layout);
+		if (_layout != PageLayout::Linear && (m_format == PageFormat::Mono1 || m_width % tileSize != 0 || m_height % tileSize != 0))
+			return false;
+		if (_layout == m_layout)
+			return true;
+
+		// Full width rows of tiles use the same bytes in every layout, so only the written rows,
+		// aligned to the tiles of both layouts, are reordered, through a row major copy
+		const int alignment = std::max(tileSize, getTileSize());
+		const int top = m_writtenTop / alignment * alignment;
+		const int bottom = std::min(m_height, (m_writtenBottom + alignment - 1) / alignment * alignment);
+		const Rect rows(0, top, m_width, bottom - top);
+		const PageLayout previous = m_layout;
+		if (bottom > top)
+		{
+			std::vector<unsigned char> linear(static_cast<size_t>(getPitch()) * rows.height());
+			for (unsigned char* buffer : { m_data, m_front })
+			{
+				if (!buffer)
+					continue;
+				m_layout = previous;
+				transferRegion(buffer, rows, linear.data(), getPitch(), false);
+				m_layout = _layout;
+				transferRegion(buffer, rows, linear.data(), getPitch(), true);
+			}
+		}
+		m_layout = _layout;
+
+		for (DirtyRegions* regions : { &m_dirty, &m_unpublished })
+		{
+			std::vector<Rect> taken = regions->take();
+			regions->setTileSize(tileSize);
+			for (const Rect& region : taken)
+				regions->add(region);
+		}
+		if (bottom > top)
+			m_dirty.add(rows);
+		return true;
+	}
+
+	size_t AtlasPage::getOffset(int _x, int _y) const
+	{
+		assert(m_format != PageFormat::Mono1);
+		const int bpp = getBytesPerPixel();
+		if (m_layout == PageLayout::Linear)
+			return static_cast<size_t>(_y) * getPitch() + _x * bpp;
+
+		const int tileSize = getTileSize();
+		const size_t tile = static_cast<size_t>(_y / tileSize) * (m_width / tileSize) + _x / tileSize;
+		return (tile * tileSize * tileSize + (s_morton.x[_x % tileSize] | s_morton.y[_y % tileSize])) * bpp;
+	}
+
+	// Copies the pixels of the rect between tiles and a row major bitmap, tile by tile.
+	// Pixels go by horizontal pairs, which are contiguous in Morton order.
+	template <int BPP, int TILE, bool TO_TILES>
+	static void transferTiles(unsigned char* _tiles, int _pageWidth, const Rect& _rect, unsigned char* _linear, int _pitch)
+	{
+		const int tilesPerRow = _pageWidth / TILE;
+		const int tileBytes = TILE * TILE * BPP;
+		for (int tileY = _rect.top() / TILE; tileY * TILE < _rect.bottom(); tileY++)
+		{
+			const int y0 = std::max(_rect.top(), tileY * TILE), y1 = std::min(_rect.bottom(), (tileY + 1) * TILE);
+			for (int tileX = _rect.left() / TILE; tileX * TILE < _rect.right(); tileX++)
+			{
+				const int x0 = std::max(_rect.left(), tileX * TILE) - tileX * TILE, x1 = std::min(_rect.right(), (tileX + 1) * TILE) - tileX * TILE;
+				unsigned char* tile = _tiles + static_cast<size_t>(tileY * tilesPerRow + tileX) * tileBytes;
+				for (int y = y0; y < y1; y++)
+				{
+					unsigned char* tileRow = tile + s_morton.y[y & (TILE - 1)] * BPP;
+					unsigned char* row = _linear + (y - _rect.top()) * _pitch + (tileX * TILE - _rect.left()) * BPP;
+					int x = x0;
+					if (x & 1)
+					{
+						TO_TILES ? std::memcpy(tileRow + s_morton.x[x] * BPP, row + x * BPP, BPP) : std::memcpy(row + x * BPP, tileRow + s_morton.x[x] * BPP, BPP);
+						x++;
+					}
+					for (; x + 1 < x1; x += 2)
+						TO_TILES ? std::memcpy(tileRow + s_morton.x[x] * BPP, row + x * BPP, 2 * BPP) : std::memcpy(row + x * BPP, tileRow + s_morton.x[x] * BPP, 2 * BPP);
+					if (x < x1)
+						TO_TILES ? std::memcpy(tileRow + s_morton.x[x] * BPP, row + x * BPP, BPP) : std::memcpy(row + x * BPP, tileRow + s_morton.x[x] * BPP, BPP);
+				}
+			}
+		}
+	}
+
+	template <int BPP, bool TO_TILES>
+	static void transferTiles(unsigned char* _tiles, int _pageWidth, int _tileSize, const Rect& _rect, unsigned char* _linear, int _pitch)
+	{
+		if (_tileSize == 8)
+			transferTiles<BPP, 8, TO_TILES>(_tiles, _pageWidth, _rect, _linear, _pitch);
+		else
+			transferTiles<BPP, 16, TO_TILES>(_tiles, _pageWidth, _rect, _linear, _pitch);
+	}
+
+	template <bool TO_TILES>
+	static void transferTiles(unsigned char* _tiles, int _pageWidth, int _tileSize, int _bpp, const Rect& _rect, unsigned char* _linear, int _pitch)
+	{
+		switch (_bpp)
+		{
+		case 1:
+			transferTiles<1, TO_TILES>(_tiles, _pageWidth, _tileSize, _rect, _linear, _pitch);
+			break;
+		case 3:
+			transferTiles<3, TO_TILES>(_tiles, _pageWidth, _tileSize, _rect, _linear, _pitch);
+			break;
+		default:
+			transferTiles<4, TO_TILES>(_tiles, _pageWidth, _tileSize, _rect, _linear, _pitch);
+			break;
+		}
+	}
+
+	void AtlasPage::transferRegion(unsigned char* _buffer, const Rect& _rect, unsigned char* _linear, int _pitch, bool _toBuffer) const
+	{
+		assert(m_format != PageFormat::Mono1);
+		if (m_layout != PageLayout::Linear)
+		{
+			if (_toBuffer)
+				transferTiles<true>(_buffer, m_width, getTileSize(), getBytesPerPixel(), _rect, _linear, _pitch);
+			else
+				transferTiles<false>(_buffer, m_width, getTileSize(), getBytesPerPixel(), _rect, _linear, _pitch);
+			return;
+		}
+
+		const size_t rowBytes = _rect.width() * getBytesPerPixel();
+		for (unsigned int y = 0; y < _rect.height(); y++)
+		{
+			unsigned char* pixels = _buffer + getOffset(_rect.left(), _rect.top() + y);
+			if (_toBuffer)
+				std::memcpy(pixels, _linear + y * _pitch, rowBytes);
+			else
+				std::memcpy(_linear + y * _pitch, pixels, rowBytes);
+		}
+	}
+
+	void AtlasPage::writeRegion(const Rect& _rect, const unsigned char* _src, int _srcPitch)
+	{
+		addWrittenRows(_rect);
+		transferRegion(m_data, _rect, const_cast<unsigned char*>(_src), _srcPitch, true);
+	}
+
+	void AtlasPage::readRegion(const Rect& _rect, unsigned char* _dst, int _dstPitch) const
+	{
+		transferRegion(const_cast<unsigned char*>(getFrontData()), _rect, _dst, _dstPitch, false);
+	}
+
+	std::vector<AtlasPage::Span> AtlasPage::getSpans(const Rect& _rect) const
+	{
+		std::vector<Span> spans;
+		const int tileSize = getTileSize();
+		const int top = _rect.top() / tileSize, bottom = (_rect.bottom() + tileSize - 1) / tileSize;
+		const int left = _rect.left() / tileSize, right = (_rect.right() + tileSize - 1) / tileSize;
+
+		// Rows of tiles, or rows of pixels with tiles of 1 pixel
+		size_t first, last;
+		if (m_format == PageFormat::Mono1)
+		{
+			first = _rect.left() / 8;
+			last = (_rect.right() + 7) / 8;
+		}
+		else
+		{
+			first = static_cast<size_t>(left) * tileSize * tileSize * getBytesPerPixel();
+			last = static_cast<size_t>(right) * tileSize * tileSize * getBytesPerPixel();
+		}
+		const size_t rowBytes = static_cast<size_t>(getPitch()) * tileSize;
+		for (int row = top; row < bottom; row++)
+		{
+			const size_t offset = row * rowBytes + first;
+			if (!spans.empty() && spans.back().offset + spans.back().size == offset)
+				spans.back().size += last - first;
+			else
+				spans.push_back({ offset, last - first });
+		}
+		return spans;
+	}
+
+	int AtlasPage::getPitch(PageFormat _format, int _width)
+	{
+		return _format == PageFormat::Mono1 ? (_width + 7) / 8 : _width * getBytesPerPixel(_format);
+	}
+
+	int AtlasPage::getBytesPerPixel(PageFormat _format)
+	{
+		switch (_format)
+		{
+		case PageFormat::Rgb8:
+			return 3;
+		case PageFormat::Bgra8:
+			return 4;
+		case PageFormat::Mono1:
+			return 0;
+		default:
+			return 1;
+		}
+	}
+}
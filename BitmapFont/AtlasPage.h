@@ -0,0 +1,130 @@
+#pragma once
+
+#ifndef _ATLAS_PAGE_H_
+#define _ATLAS_PAGE_H_
+
+#include <vector>
+#include "DirtyRegions.h"
+
+namespace bmf
+{
+	enum class PageFormat
+	{
+		Gray8,	// coverage or distance field
+		Rgb8,	// multi-channel distance field or LCD subpixels
+		Bgra8,	// premultiplied color glyphs
+		Mono1	// 1 bit per pixel, most significant bit first, for pixel fonts
+	};
+
+	// Storage order of the pixels of a page
+	enum class PageLayout
+	{
+		Linear,	// row major
+		Tiled8,	// 8x8 tiles in row major order, pixels in Morton order inside a tile
+		Tiled16	// 16x16 tiles, same order
+	};
+
+	// Pixels of a pool. Tiled pages keep the pixels of small glyphs in a few cache lines,
+	// they are accessed through writeRegion() and readRegion() only.
+	// Double buffered pages are written in a back buffer while the front buffer, published by the
+	// last call to publish(), is read by the uploader. publish() must not overlap a read of the front.
+	class AtlasPage
+	{
+	public:
+		// The buffers are mapped lazily, see allocatePageMemory()
+		AtlasPage(PageFormat _format, int _width, int _height, bool _largePages = false);
+		~AtlasPage();
+
+		// 0 for Mono1, which packs 8 pixels per byte
+		static int getBytesPerPixel(PageFormat _format);
+		static int getPitch(PageFormat _format, int _width);
+
+		PageFormat getFormat() const { return m_format; }
+		int getWidth() const { return m_width; }
+		int getHeight() const { return m_height; }
+		int getBytesPerPixel() const { return getBytesPerPixel(m_format); }
+		int getPitch() const { return getPitch(m_format, m_width); }
+		size_t getSize() const { return static_cast<size_t>(getPitch()) * m_height; }	// of a buffer
+
+		// Only pages with whole bytes per pixel, and sizes multiple of the tiles, can be tiled.
+		// The content is kept: the rows written so far (see markDirty() and writeRegion()) are
+		// reordered through a copy of their size and become dirty, the rows below them are still
+		// zero in every layout and aren't touched, so an empty page only changes its layout.
+		// Returns false if not supported.
+		bool setLayout(PageLayout _layout);
+		PageLayout getLayout() const { return m_layout; }
+		int getTileSize() const { return getTileSize(m_layout); }	// 1 when linear
+		static int getTileSize(PageLayout _layout);
+
+		// Byte offset of a pixel in the buffers, not for Mono1
+		size_t getOffset(int _x, int _y) const;
+
+		// Copies between the back buffer and a row major bitmap, whatever the layout.
+		// Reads are from the front buffer, for the uploader. Not for Mono1.
+		void writeRegion(const Rect& _rect, const unsigned char* _src, int _srcPitch);
+		void readRegion(const Rect& _rect, unsigned char* _dst, int _dstPitch) const;
+
+		// Contiguous ranges of the buffers holding the region: rows of pixels or rows of tiles
+		struct Span
+		{
+			size_t offset;
+			size_t size;
+		};
+		std::vector<Span> getSpans(const Rect& _rect) const;
+
+		// Replaces the content by a copy on write view of a file region stored with the given
+		// layout, see mapFileMemory(). The whole page becomes dirty.
+		bool mapFile(const char* _filename, size_t _offset, PageLayout _layout);
+
+		// Moves the content to memory owned by the caller, such as a shared memory segment, which
+		// must outlive the page. Single buffered pages only.
+		void attachMemory(unsigned char* _data);
+
+		// Buffer written by the cache, the back buffer when double buffered
+		unsigned char* getData() { return m_data; }
+		const unsigned char* getData() const { return m_data; }
+
+		// Buffer to upload, same as getData() unless double buffered
+		const unsigned char* getFrontData() const { return m_front ? m_front : m_data; }
+
+		void setDoubleBuffered(bool _doubleBuffered);
+		bool isDoubleBuffered() const { return m_front != nullptr; }
+
+		// Swaps the buffers then replays the regions written since the previous publish into
+		// the new back buffer, so that only those are copied. They become dirty regions.
+		void publish();
+
+		// Regions of the front buffer modified since the last call to takeDirtyRegions(), see DirtyRegions.
+		// Regions written to a back buffer are only dirty once published. Pixels written through
+		// getData() must be marked dirty, for setLayout() to keep them.
+		void markDirty(const Rect& _rect);
+		std::vector<Rect> takeDirtyRegions() { return m_dirty.take(); }
+		DirtyRegions& getDirtyRegions() { return m_dirty; }
+		const DirtyRegions& getDirtyRegions() const { return m_dirty; }
+
+	private:
+		AtlasPage(const AtlasPage&) = delete;
+		AtlasPage& operator=(const AtlasPage&) = delete;
+
+		void copyRegion(const unsigned char* _src, unsigned char* _dst, const Rect& _rect) const;
+		void releaseBuffer(unsigned char*& _buffer);
+		void transferRegion(unsigned char* _buffer, const Rect& _rect, unsigned char* _linear, int _pitch, bool _toBuffer) const;
+		void addWrittenRows(const Rect& _rect);
+
+		PageFormat		m_format;
+		PageLayout		m_layout = PageLayout::Linear;
+		int				m_width;
+		int				m_height;
+		bool			m_largePages;
+		unsigned char*	m_data = nullptr;
+		unsigned char*	m_front = nullptr;
+		unsigned char*	m_mapping = nullptr;	// m_data or m_front when mapped from a file
+		unsigned char*	m_external = nullptr;	// m_data when attached to memory of the caller
+		DirtyRegions	m_dirty;
+		DirtyRegions	m_unpublished;	// written to the back buffer since the last publish
+		int				m_writtenTop = 0;		// rows which may not be zero, in both buffers
+		int				m_writtenBottom = 0;
+	};
+}
+
+#endif
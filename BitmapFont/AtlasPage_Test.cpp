@@ -0,0 +1,223 @@
+#include "stdafx.h"
+#include "AtlasPage.h"
+#include "catch.hpp"
+
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+
+namespace bmf
+{
+	TEST_CASE("Double buffered pages publish consistent snapshots", "[AtlasPage]")
+	{
+		auto fill = [](AtlasPage& _page, const Rect& _rect, unsigned char _value)
+		{
+			const int bpp = _page.getBytesPerPixel();
+			for (int y = _rect.top(); y < _rect.bottom(); y++)
+				std::memset(_page.getData() + y * _page.getPitch() + _rect.left() * bpp, _value, _rect.width() * bpp);
+			_page.markDirty(_rect);
+		};
+		auto bothEqual = [](const AtlasPage& _page)
+		{
+			return std::memcmp(_page.getData(), _page.getFrontData(), _page.getPitch() * _page.getHeight()) == 0;
+		};
+
+		for (PageFormat format : { PageFormat::Gray8, PageFormat::Rgb8, PageFormat::Bgra8 })
+		{
+			AtlasPage page(format, 64, 64);
+			REQUIRE(page.getFrontData() == page.getData());
+			page.setDoubleBuffered(true);
+			REQUIRE(page.isDoubleBuffered());
+			REQUIRE(page.getFrontData() != page.getData());
+
+			// Writes stay in the back buffer until published
+			fill(page, Rect(4, 4, 8, 8), 0x80);
+			REQUIRE(page.getFrontData()[4 * page.getPitch() + 4 * page.getBytesPerPixel()] == 0);
+			REQUIRE(page.takeDirtyRegions().empty());
+
+			page.publish();
+			REQUIRE(page.getFrontData()[4 * page.getPitch() + 4 * page.getBytesPerPixel()] == 0x80);
+			REQUIRE(bothEqual(page));
+			std::vector<Rect> regions = page.takeDirtyRegions();
+			REQUIRE(regions.size() == 1);
+			REQUIRE(regions[0].contains(Rect(4, 4, 8, 8)));
+
+			// The new back buffer received the regions of the previous publish
+			fill(page, Rect(30, 40, 10, 3), 0xff);
+			page.publish();
+			REQUIRE(bothEqual(page));
+			page.publish();
+			REQUIRE(bothEqual(page));
+
+			// Back to a single buffer, unpublished writes become dirty
+			fill(page, Rect(50, 50, 4, 4), 0x10);
+			page.setDoubleBuffered(false);
+			REQUIRE(page.getFrontData() == page.getData());
+			REQUIRE(!page.takeDirtyRegions().empty());
+		}
+
+		SECTION("Monochrome pages replay whole bytes")
+		{
+			AtlasPage page(PageFormat::Mono1, 64, 16);
+			page.setDoubleBuffered(true);
+			page.getData()[2 * page.getPitch() + 1] = 0x3c;
+			page.markDirty(Rect(10, 2, 4, 1));
+			page.publish();
+			REQUIRE(page.getFrontData()[2 * page.getPitch() + 1] == 0x3c);
+			REQUIRE(bothEqual(page));
+		}
+	}
+
+	TEST_CASE("Tiled pages store the same pixels", "[AtlasPage]")
+	{
+		SECTION("Regions round trip through every layout")
+		{
+			for (PageFormat format : { PageFormat::Gray8, PageFormat::Rgb8, PageFormat::Bgra8 })
+			{
+				AtlasPage linear(format, 64, 64), tiled8(format, 64, 64), tiled16(format, 64, 64);
+				REQUIRE(tiled8.setLayout(PageLayout::Tiled8));
+				REQUIRE(tiled16.setLayout(PageLayout::Tiled16));
+				REQUIRE(tiled16.getTileSize() == 16);
+
+				srand(7);
+				for (int n = 0; n < 50; n++)
+				{
+					Rect rect(rand() % 50, rand() % 50, 1 + rand() % 14, 1 + rand() % 14);
+					const int pitch = rect.width() * linear.getBytesPerPixel();
+					std::vector<unsigned char> pixels(pitch * rect.height());
+					for (unsigned char& value : pixels)
+						value = static_cast<unsigned char>(rand());
+					for (AtlasPage* page : { &linear, &tiled8, &tiled16 })
+						page->writeRegion(rect, pixels.data(), pitch);
+				}
+
+				const int pitch = linear.getPitch();
+				std::vector<unsigned char> expected(pitch * 64), actual(pitch * 64);
+				linear.readRegion(Rect(0, 0, 64, 64), expected.data(), pitch);
+				REQUIRE(std::memcmp(expected.data(), linear.getData(), expected.size()) == 0);
+				for (AtlasPage* page : { &tiled8, &tiled16 })
+				{
+					page->readRegion(Rect(0, 0, 64, 64), actual.data(), pitch);
+					REQUIRE(actual == expected);
+					REQUIRE(std::memcmp(page->getData(), linear.getData(), expected.size()) != 0);
+				}
+
+				// Switching layouts keeps the content
+				REQUIRE(tiled8.setLayout(PageLayout::Tiled16));
+				REQUIRE(std::memcmp(tiled8.getData(), tiled16.getData(), expected.size()) == 0);
+				REQUIRE(tiled8.setLayout(PageLayout::Linear));
+				REQUIRE(std::memcmp(tiled8.getData(), linear.getData(), expected.size()) == 0);
+			}
+		}
+
+		SECTION("Pixels of a tile are contiguous in Morton order")
+		{
+			AtlasPage page(PageFormat::Gray8, 64, 64);
+			REQUIRE(page.setLayout(PageLayout::Tiled8));
+			REQUIRE(page.getOffset(0, 0) == 0);
+			REQUIRE(page.getOffset(1, 0) == 1);
+			REQUIRE(page.getOffset(0, 1) == 2);
+			REQUIRE(page.getOffset(1, 1) == 3);
+			REQUIRE(page.getOffset(2, 0) == 4);
+			REQUIRE(page.getOffset(7, 7) == 63);
+			REQUIRE(page.getOffset(8, 0) == 64);
+			REQUIRE(page.getOffset(0, 8) == 64 * 8);
+
+			// Monochrome pages and sizes which aren't multiple of the tiles stay linear
+			AtlasPage mono(PageFormat::Mono1, 64, 64), odd(PageFormat::Gray8, 60, 64);
+			REQUIRE(!mono.setLayout(PageLayout::Tiled8));
+			REQUIRE(!odd.setLayout(PageLayout::Tiled16));
+			REQUIRE(odd.getLayout() == PageLayout::Linear);
+		}
+
+		SECTION("Dirty regions are uploaded as rows of tiles")
+		{
+			AtlasPage page(PageFormat::Gray8, 128, 128);
+			REQUIRE(page.setLayout(PageLayout::Tiled16));
+			page.takeDirtyRegions();
+
+			page.markDirty(Rect(20, 20, 10, 30));
+			std::vector<Rect> regions = page.takeDirtyRegions();
+			REQUIRE(regions.size() == 1);
+			REQUIRE(regions[0].left() == 16);
+			REQUIRE(regions[0].top() == 16);
+			REQUIRE(regions[0].right() == 32);
+			REQUIRE(regions[0].bottom() == 64);
+
+			// One span per row of tiles, a full width region is a single span
+			std::vector<AtlasPage::Span> spans = page.getSpans(regions[0]);
+			REQUIRE(spans.size() == 3);
+			for (const AtlasPage::Span& span : spans)
+				REQUIRE(span.size == 256);
+			spans = page.getSpans(Rect(0, 16, 128, 48));
+			REQUIRE(spans.size() == 1);
+			REQUIRE(spans[0].size == 128 * 48);
+		}
+
+		SECTION("Switching layouts only reorders the written rows")
+		{
+			AtlasPage page(PageFormat::Gray8, 64, 64), linear(PageFormat::Gray8, 64, 64);
+			REQUIRE(page.setLayout(PageLayout::Tiled16));
+			REQUIRE(page.takeDirtyRegions().empty());
+
+			std::vector<unsigned char> pixels(10 * 4);
+			for (size_t i = 0; i < pixels.size(); i++)
+				pixels[i] = static_cast<unsigned char>(i + 1);
+			const Rect rect(20, 5, 10, 4);
+			page.writeRegion(rect, pixels.data(), 10);
+			linear.writeRegion(rect, pixels.data(), 10);
+
+			// Rows of 16x16 tiles, whatever the tiles of the new layout
+			page.takeDirtyRegions();
+			REQUIRE(page.setLayout(PageLayout::Tiled8));
+			std::vector<Rect> regions = page.takeDirtyRegions();
+			REQUIRE(regions.size() == 1);
+			REQUIRE(regions[0].top() == 0);
+			REQUIRE(regions[0].bottom() == 16);
+			REQUIRE(regions[0].width() == 64);
+
+			REQUIRE(page.setLayout(PageLayout::Linear));
+			REQUIRE(std::memcmp(page.getData(), linear.getData(), page.getSize()) == 0);
+		}
+	}
+
+	TEST_CASE("Tiled page blit and extract throughput", "[.][benchmark]")
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+		const int width = 1024;
+
+		for (unsigned int size : { 8u, 16u, 32u })
+		{
+			std::vector<unsigned char> glyph(size * size, 0x80);
+			std::vector<Rect> rects;
+			srand(1);
+			for (int n = 0; n < 100000; n++)
+				rects.push_back(Rect(rand() % (width - size), rand() % (width - size), size, size));
+			const double megabytes = rects.size() * size * size / (1024.0 * 1024.0);
+
+			for (PageLayout layout : { PageLayout::Linear, PageLayout::Tiled8, PageLayout::Tiled16 })
+			{
+				AtlasPage page(PageFormat::Gray8, width, width);
+				page.setLayout(layout);
+
+				auto start = Clock::now();
+				for (const Rect& rect : rects)
+					page.writeRegion(rect, glyph.data(), size);
+				double blitSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+				start = Clock::now();
+				for (const Rect& rect : rects)
+					page.readRegion(rect, glyph.data(), size);
+				double readSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+				size_t spans = 0;
+				for (size_t n = 0; n < 1000; n++)
+					spans += page.getSpans(rects[n]).size();
+
+				static const char* names[] = { "linear", "tiled 8x8", "tiled 16x16" };
+				WARN(size << "x" << size << " glyphs, " << names[static_cast<int>(layout)] << ": blit " << megabytes / blitSeconds << " MB/s, extract "
+					<< megabytes / readSeconds << " MB/s, " << spans / 1000.0 << " spans per glyph");
+			}
+		}
+	}
+}
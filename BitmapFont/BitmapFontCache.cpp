@@ -1,8 +1,14 @@
 #include "stdafx.h"
 #include "BitmapFontCache.h"
+#include "SignedDistanceField.h"
 
 #include <algorithm>
 #include <cassert>
+#include <set>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <cstring>
 
 #include <ft2build.h>
 #include <freetype/freetype.h>
@@ -11,42 +17,94 @@
 
 const int WIDTH = 1024;
 const int HEIGHT = 1024;
+const size_t EVICTION_WINDOW = 64;	// least recently used glyphs considered for eviction
 
 namespace bmf
 {
-	BitmapFontCache::BitmapFontCache(FT_Library _library) : m_library(_library)
+	BitmapFontCache::BitmapFontCache(FT_Library _library, bool _largePages) : m_library(_library), m_largePages(_largePages)
 	{
-		m_image = new unsigned char[WIDTH * HEIGHT * sizeof(char)];
-		std::memset(m_image, 0, WIDTH * HEIGHT * sizeof(char));
+		for (int i = 0; i < POOL_COUNT; i++)
+			addPool(PageFormat::Gray8);
+	}
 
-		m_pools[0].init(Rect(0, 0, WIDTH, HEIGHT), 1, 1);
+	void BitmapFontCache::addPool(PageFormat _format)
+	{
+		m_pools.emplace_back(new Pool());
+		m_pools.back()->init(_format, Rect(0, 0, WIDTH, HEIGHT), 1, 1, m_largePages);
+		m_pools.back()->getPage().setDoubleBuffered(m_doubleBuffered);
+		m_pools.back()->getPage().setLayout(m_pageLayout);
+		if (m_shared && m_shared->isWriter())
+			sharePage(*m_pools.back());
 	}
 
-	int BitmapFontCache::loadFont(const char* _filename)
+	int BitmapFontCache::loadFont(const char* _filename, const RenderOptions& _options)
 	{
+		FontDataPtr fontData = FontRegistry::instance().acquire(_filename);
+		if (!fontData)
+			return -1;
+
 		FT_Face newFace = nullptr;
-		FT_Error error = FT_New_Face(m_library, _filename, 0, &newFace);
+		FT_Error error = FT_New_Memory_Face(m_library, fontData->data(), static_cast<FT_Long>(fontData->size()), 0, &newFace);
 		if (error == 0)
 		{
 			m_faces.push_back(newFace);
+			m_fontData.push_back(fontData);
+			m_charmaps.push_back(CharmapCache(newFace));
+			m_renderOptions.push_back(_options);
+			if (m_workers)
+				m_workers->addFont(fontData);
+			if (m_shared && m_shared->isWriter())
+				shareFonts();
 			return m_faces.size() - 1;
 		}
 		return -1;
 	}
 
 
+	void BitmapFontCache::setRenderOptions(int _fontIndex, const RenderOptions& _options)
+	{
+		m_renderOptions[_fontIndex] = _options;
+		if (m_shared && m_shared->isWriter())
+			shareFonts();
+	}
+
 	BitmapFontCache::~BitmapFontCache()
 	{
+		m_workers.reset();
 		for (FT_Face f : m_faces)
 			FT_Done_Face(f);
-		delete[](m_image);
-		m_image = nullptr;
+		for (FT_Face f : m_lcdFaces)
+		{
+			if (f)
+				FT_Done_Face(f);
+		}
+		if (m_lcdLibrary)
+			FT_Done_FreeType(m_lcdLibrary);
+	}
+
+	FT_Face BitmapFontCache::getRasterFace(const GlyphRequest& _request)
+	{
+		if (_request.mode != GlyphMode::Lcd && _request.mode != GlyphMode::LcdV)
+			return m_faces[_request.fontIndex];
+
+		// Opened lazily on the font data, as the raster workers do
+		if (!m_lcdLibrary && FT_Init_FreeType(&m_lcdLibrary) != 0)
+			m_lcdLibrary = nullptr;
+		if (!m_lcdLibrary)
+			return nullptr;
+		if (m_lcdFaces.size() < m_faces.size())
+			m_lcdFaces.resize(m_faces.size(), nullptr);
+		FT_Face& face = m_lcdFaces[_request.fontIndex];
+		const FontData& fontData = *m_fontData[_request.fontIndex];
+		if (!face && FT_New_Memory_Face(m_lcdLibrary, fontData.data(), static_cast<FT_Long>(fontData.size()), 0, &face) != 0)
+			face = nullptr;
+		return face;
 	}
 
 	BitmapFontCache::Pool::Slot *BitmapFontCache::Pool::findBestSlotForRect(const Rect &_rect)
 	{
 		if (_rect.height() == 0 || _rect.width() == 0)
-			return false;
+			return nullptr;
 
 		Slot *bestSlot = nullptr;
 		for (Slot *slot : m_freeSlots)
@@ -64,14 +122,12 @@ namespace bmf
 		return nullptr;
 	}
 
-	BitmapFontCache::ReturnCode BitmapFontCache::Pool::removeGlyph(int _fontIndex, int _char, int _pixelSize)
+	BitmapFontCache::ReturnCode BitmapFontCache::Pool::removeGlyph(const Key& _key)
 	{
-		Key key(_fontIndex, _char, _pixelSize);
-
-		auto it = m_glyphs.find(key);
+		auto it = m_glyphs.find(_key);
 		if (it != m_glyphs.end())
 		{
-			Slot *slot = it->second;
+			Slot *slot = it->second.slot;
 			slot->setAsFree(m_freeSlots);
 			m_glyphs.erase(it);
 			return OK;
@@ -80,103 +136,1371 @@ namespace bmf
 		return NotFound;
 	}
 
-	bool BitmapFontCache::Pool::findGlyph(int _fontIndex, int _char, int _pixelSize)
+	const BitmapFontCache::Pool::Glyph* BitmapFontCache::Pool::getGlyph(const Key& _key) const
+	{
+		auto it = m_glyphs.find(_key);
+		return it != m_glyphs.end() ? &it->second : nullptr;
+	}
+
+	BitmapFontCache::Pool::Glyph* BitmapFontCache::Pool::getGlyph(const Key& _key)
+	{
+		auto it = m_glyphs.find(_key);
+		return it != m_glyphs.end() ? &it->second : nullptr;
+	}
+
+	unsigned int BitmapFontCache::Pool::getOccupiedSurface() const
 	{
-		Key key(_fontIndex, _char, _pixelSize);
+		unsigned int surface = 0;
+		for (const auto& it : m_glyphs)
+			surface += it.second.slot->getRect().surface();
+		return surface;
+	}
 
-		if (m_glyphs.find(key) != m_glyphs.end())
+	bool BitmapFontCache::Pool::findGlyph(const Key& _key)
+	{
+		if (m_glyphs.find(_key) != m_glyphs.end())
 			return true;
 
 		return false;
 	}
 
 
-	BitmapFontCache::ReturnCode BitmapFontCache::Pool::addGlyph(const BitmapFontCache* _owner, FT_Bitmap &_bitmap, int _fontIndex, int _char, int _pixelSize)
+	void BitmapFontCache::Pool::setGlyphOrigin(const Key& _key, int _left, int _top)
 	{
-		Slot *slot = findBestSlotForRect(Rect(0, 0, _bitmap.width + m_paddingX, _bitmap.rows + m_paddingY));
-		if (!slot)
-			return NotEnoughSpace;
+		auto it = m_glyphs.find(_key);
+		assert(it != m_glyphs.end());
+		it->second.left = _left;
+		it->second.top = _top;
+	}
+
+	GlyphRequest BitmapFontCache::Pool::Key::getRequest() const
+	{
+		GlyphRequest request(fontIndex, unicodeChar, pixelSize, mode);
+		request.byGlyphIndex = byGlyphIndex;
+		request.glyphIndex = byGlyphIndex ? static_cast<unsigned int>(unicodeChar) : 0;
+		request.spread = spread;
+		request.lcdFilter = lcdFilter;
+		request.subpixelOrder = subpixelOrder;
+		request.options = options;
+		request.strokeWidth = strokeWidth;
+		return request;
+	}
+
+	static atlasFile::GlyphRecord makeGlyphRecord(const GlyphRequest& _request)
+	{
+		atlasFile::GlyphRecord record = {};
+		record.fontIndex = _request.fontIndex;
+		record.unicodeChar = _request.unicodeChar;
+		record.pixelSize = _request.pixelSize;
+		record.spread = _request.spread;
+		record.loadFlags = _request.options.loadFlags;
+		record.strokeWidth = _request.strokeWidth;
+		record.byGlyphIndex = _request.byGlyphIndex;
+		record.mode = static_cast<uint8_t>(_request.mode);
+		record.lcdFilter = static_cast<uint8_t>(_request.lcdFilter);
+		record.subpixelOrder = static_cast<uint8_t>(_request.subpixelOrder);
+		record.hinting = static_cast<uint8_t>(_request.options.hinting);
+		record.renderMode = static_cast<uint8_t>(_request.options.renderMode);
+		record.embolden = _request.options.embolden;
+		return record;
+	}
 
-		Key key(_fontIndex, _char, _pixelSize);
-		m_glyphs[key] = slot;
+	static GlyphRequest makeRequest(const atlasFile::GlyphRecord& _record)
+	{
+		GlyphRequest request(_record.fontIndex, _record.unicodeChar, _record.pixelSize, static_cast<GlyphMode>(_record.mode));
+		request.byGlyphIndex = _record.byGlyphIndex != 0;
+		request.glyphIndex = request.byGlyphIndex ? static_cast<unsigned int>(_record.unicodeChar) : 0;
+		request.spread = _record.spread;
+		request.lcdFilter = static_cast<LcdFilter>(_record.lcdFilter);
+		request.subpixelOrder = static_cast<SubpixelOrder>(_record.subpixelOrder);
+		request.options.loadFlags = _record.loadFlags;
+		request.options.hinting = static_cast<Hinting>(_record.hinting);
+		request.options.renderMode = static_cast<GlyphMode>(_record.renderMode);
+		request.options.embolden = _record.embolden != 0;
+		request.strokeWidth = _record.strokeWidth;
+		return request;
+	}
 
-		for (unsigned int i = 0; i < _bitmap.width; i++)
+	void BitmapFontCache::Pool::save(std::vector<atlasFile::SlotRecord>& _slots, std::vector<uint32_t>& _freeSlots, std::vector<atlasFile::GlyphRecord>& _glyphs) const
+	{
+		std::map<const Slot*, uint32_t> indices;
+		std::vector<const Slot*> stack(1, m_rootSlot);
+		while (!stack.empty())
 		{
-			for (unsigned int j = 0; j < _bitmap.rows; j++)
+			const Slot* slot = stack.back();
+			stack.pop_back();
+			indices[slot] = _slots.size();
+
+			const Rect& rect = slot->getRect();
+			atlasFile::SlotRecord record = {};
+			record.rect[0] = rect.left();
+			record.rect[1] = rect.top();
+			record.rect[2] = rect.width();
+			record.rect[3] = rect.height();
+			record.state = static_cast<uint8_t>(slot->getState());
+			if (slot->getState() == Slot::State::Divided)
 			{
-				_owner->m_image[i + slot->getRect().left() + (j + slot->getRect().top()) * WIDTH] = _bitmap.buffer[j * _bitmap.width + i];
+				record.byWidth = slot->getChild(1)->getRect().left() != rect.left();
+				stack.push_back(slot->getChild(1));
+				stack.push_back(slot->getChild(0));
 			}
+			_slots.push_back(record);
+		}
+
+		for (const Slot* slot : m_freeSlots)
+			_freeSlots.push_back(indices[slot]);
+
+		for (const auto& it : m_glyphs)
+		{
+			atlasFile::GlyphRecord record = makeGlyphRecord(it.first.getRequest());
+			record.slot = indices[it.second.slot];
+			record.rect[0] = it.second.rect.left();
+			record.rect[1] = it.second.rect.top();
+			record.rect[2] = it.second.rect.width();
+			record.rect[3] = it.second.rect.height();
+			record.left = it.second.left;
+			record.top = it.second.top;
+			_glyphs.push_back(record);
+		}
+	}
+
+	bool BitmapFontCache::Pool::restoreSlot(Slot* _slot, const std::vector<atlasFile::SlotRecord>& _slots, size_t& _next, std::vector<Slot*>& _nodes)
+	{
+		if (_next >= _slots.size())
+			return false;
+		const atlasFile::SlotRecord& record = _slots[_next++];
+		const Rect& rect = _slot->getRect();
+		if (record.rect[0] != rect.left() || record.rect[1] != rect.top() || record.rect[2] != static_cast<int>(rect.width()) || record.rect[3] != static_cast<int>(rect.height()))
+			return false;
+		_nodes.push_back(_slot);
+
+		switch (record.state)
+		{
+		case Slot::State::Free:
+			return true;
+		case Slot::State::Occupied:
+			_slot->restoreOccupied();
+			return true;
+		case Slot::State::Divided:
+		{
+			// The first child follows its parent, its size gives the division
+			if (_next >= _slots.size())
+				return false;
+			const atlasFile::SlotRecord& first = _slots[_next];
+			int size = record.byWidth ? first.rect[2] : first.rect[3];
+			if (size < 0 || size > (record.byWidth ? record.rect[2] : record.rect[3]))
+				return false;
+			_slot->restoreDivision(record.byWidth != 0, size);
+			return restoreSlot(_slot->getChild(0), _slots, _next, _nodes) && restoreSlot(_slot->getChild(1), _slots, _next, _nodes);
+		}
+		default:
+			return false;
+		}
+	}
+
+	bool BitmapFontCache::Pool::restore(PageFormat _format, int _width, int _height, int _paddingX, int _paddingY, bool _largePages, const std::vector<atlasFile::SlotRecord>& _slots,
+		const std::vector<uint32_t>& _freeSlots, const std::vector<atlasFile::GlyphRecord>& _glyphs)
+	{
+		assert(m_rootSlot == nullptr);
+		m_page.reset(new AtlasPage(_format, _width, _height, _largePages));
+		m_paddingX = _paddingX;
+		m_paddingY = _paddingY;
+		m_rootSlot = new Slot(nullptr, Rect(m_paddingX, m_paddingY, _width - m_paddingX, _height - m_paddingY));
+
+		std::vector<Slot*> nodes;
+		size_t next = 0;
+		if (!restoreSlot(m_rootSlot, _slots, next, nodes) || next != _slots.size())
+			return false;
+
+		// Every slot is listed once, and glyphs lie within their slot
+		std::vector<bool> listed(nodes.size(), false);
+		for (uint32_t index : _freeSlots)
+		{
+			if (index >= nodes.size() || nodes[index]->getState() != Slot::State::Free || listed[index])
+				return false;
+			listed[index] = true;
+			m_freeSlots.push_back(nodes[index]);
 		}
 
+		for (const atlasFile::GlyphRecord& record : _glyphs)
+		{
+			if (record.slot >= nodes.size() || nodes[record.slot]->getState() != Slot::State::Occupied || listed[record.slot])
+				return false;
+			listed[record.slot] = true;
+			const Rect& slotRect = nodes[record.slot]->getRect();
+			if (record.rect[0] != slotRect.left() || record.rect[1] != slotRect.top() || record.rect[2] < 0 || record.rect[3] < 0
+				|| record.rect[2] > static_cast<int>(slotRect.width()) || record.rect[3] > static_cast<int>(slotRect.height()))
+				return false;
+			Key key(makeRequest(record));
+			if (m_glyphs.find(key) != m_glyphs.end())
+				return false;
+			Glyph& glyph = m_glyphs[key];
+			glyph.slot = nodes[record.slot];
+			glyph.rect = Rect(record.rect[0], record.rect[1], record.rect[2], record.rect[3]);
+			glyph.left = record.left;
+			glyph.top = record.top;
+		}
+		return true;
+	}
+
+	Rect BitmapFontCache::Pool::getSlotSize(unsigned int _width, unsigned int _rows, GlyphMode _mode) const
+	{
+		// Distance fields already carry their spread as padding
+		bool padded = !isDistanceField(_mode);
+		return Rect(0, 0, _width + (padded ? m_paddingX : 0), _rows + (padded ? m_paddingY : 0));
+	}
+
+	BitmapFontCache::ReturnCode BitmapFontCache::Pool::allocateGlyph(unsigned int _width, unsigned int _rows, const Key& _key, Rect* _glyphRect, Rect* _slotRect)
+	{
+		// Overwriting a glyph would leak its slot
+		assert(m_glyphs.find(_key) == m_glyphs.end());
+		if (m_glyphs.find(_key) != m_glyphs.end())
+			return AlreadyAdded;
+
+		Slot *slot = findBestSlotForRect(getSlotSize(_width, _rows, _key.getMode()));
+		if (!slot)
+			return NotEnoughSpace;
+
+		Glyph& glyph = m_glyphs[_key];
+		glyph.slot = slot;
+		glyph.rect = Rect(slot->getRect().left(), slot->getRect().top(), _width, _rows);
+
+		if (_glyphRect)
+			*_glyphRect = glyph.rect;
+		if (_slotRect)
+			*_slotRect = slot->getRect();
+
 		return OK;
 	}
 
+	void BitmapFontCache::setDoubleBuffered(bool _doubleBuffered)
+	{
+		if (m_shared)
+			return;
+		m_doubleBuffered = _doubleBuffered;
+		for (auto& pool : m_pools)
+			pool->getPage().setDoubleBuffered(_doubleBuffered);
+	}
+
+	void BitmapFontCache::setPageLayout(PageLayout _layout)
+	{
+		// Readers of shared pages must not see them being reordered
+		const bool shared = m_shared && m_shared->isWriter();
+		if (shared)
+			m_shared->beginWrite();
+		m_pageLayout = _layout;
+		for (auto& pool : m_pools)
+		{
+			pool->getPage().setLayout(_layout);
+			if (shared && pool->getSharedPage() >= 0)
+				m_shared->setPageLayout(pool->getSharedPage(), pool->getPage().getLayout());
+		}
+		if (shared)
+			m_shared->endWrite();
+	}
+
+	void BitmapFontCache::publish()
+	{
+		for (auto& pool : m_pools)
+			pool->getPage().publish();
+	}
+
+	int BitmapFontCache::getImageWidth()
+	{
+		return WIDTH;
+	}
+
+	int BitmapFontCache::getImageHeight()
+	{
+		return HEIGHT;
+	}
+
 	unsigned int  BitmapFontCache::getPoolIndex() const
 	{
 		return 0;
 	}
 
-	BitmapFontCache::ReturnCode BitmapFontCache::addGlyph(int _fontIndex, int _char, int _pixelSize)
+	void BitmapFontCache::prepareRequest(GlyphRequest& _request) const
 	{
-		unsigned int defaultPoolIndex = 0;
+		if (_request.fontIndex >= 0 && _request.fontIndex < static_cast<int>(m_renderOptions.size()))
+		{
+			_request.options = m_renderOptions[_request.fontIndex];
+			if (_request.mode == GlyphMode::Default)
+				_request.mode = _request.options.renderMode != GlyphMode::Default ? _request.options.renderMode : GlyphMode::Bitmap;
+		}
 
-		// Look into pools
-		if (m_pools[defaultPoolIndex].findGlyph(_fontIndex, _char, _pixelSize))
-			return AlreadyAdded;
+		// Other modes have no stroked variant
+		if (_request.mode != GlyphMode::Bitmap && _request.mode != GlyphMode::Sdf)
+			_request.strokeWidth = 0.f;
+
+		if (isDistanceField(_request.mode))
+		{
+			_request.pixelSize = m_sdfReferenceSize;
+			_request.spread = m_sdfSpread;
+		}
+		else if (_request.mode == GlyphMode::Lcd || _request.mode == GlyphMode::LcdV)
+		{
+			_request.lcdFilter = m_lcdFilter;
+			_request.subpixelOrder = m_subpixelOrder;
+		}
+	}
+
+	bool BitmapFontCache::resolveGlyphIndex(GlyphRequest& _request)
+	{
+		if (_request.fontIndex < 0 || _request.fontIndex >= static_cast<int>(m_faces.size()))
+			return false;
+		if (_request.byGlyphIndex)
+			return _request.glyphIndex < static_cast<unsigned int>(m_faces[_request.fontIndex]->num_glyphs);
+
+		_request.glyphIndex = m_charmaps[_request.fontIndex].getGlyphIndex(_request.unicodeChar);
+		return _request.glyphIndex != 0;
+	}
+
+	bool BitmapFontCache::findGlyph(const GlyphRequest& _request)
+	{
+		SharedAtlas::Glyph shared;
+		if (isSharedReader())
+			return m_shared->find(makeGlyphRecord(_request), shared);
+
+		Pool::Key key(_request);
+
+		// Look into pools, glyphs requested again are used
+		for (auto& pool : m_pools)
+		{
+			const Pool::Glyph* glyph = pool->getGlyph(key);
+			if (glyph)
+			{
+				touch(*glyph);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	BitmapFontCache::ReturnCode BitmapFontCache::allocateGlyph(PageFormat _format, unsigned int _width, unsigned int _rows, const GlyphRequest& _request, Pool*& _pool, Rect& _glyphRect, Rect* _slotRect, float _rasterizeMs)
+	{
+		if (isSharedReader())
+			return NotFound;
+
+		// Room is made by evicting glyphs from the pages of the format
+		Pool::Key key(_request);
+		ReturnCode ret = allocateInPools(_format, _width, _rows, key, _pool, _glyphRect, _slotRect);
+		if (ret == NotEnoughSpace && reclaimReleasedGlyphs(_format) > 0)
+			ret = allocateInPools(_format, _width, _rows, key, _pool, _glyphRect, _slotRect);
+		while (ret == NotEnoughSpace && evictGlyph(_format, _width, _rows, key))
+			ret = allocateInPools(_format, _width, _rows, key, _pool, _glyphRect, _slotRect);
+		if (ret == OK)
+		{
+			Pool::Glyph& glyph = *_pool->getGlyph(key);
+			glyph.rasterizeMs = _rasterizeMs;
+			touch(glyph);
+		}
+		return ret;
+	}
+
+	BitmapFontCache::ReturnCode BitmapFontCache::allocateInPools(PageFormat _format, unsigned int _width, unsigned int _rows, const Pool::Key& _key, Pool*& _pool, Rect& _glyphRect, Rect* _slotRect)
+	{
+		unsigned int defaultPoolIndex = getPoolIndex();
+
+		// Add to the pools storing the format
+		bool hasPool = false;
+		for (size_t i = 0; i < m_pools.size(); i++)
+		{
+			Pool& pool = *m_pools[(i + defaultPoolIndex) % m_pools.size()];
+			if (pool.getPage().getFormat() != _format)
+				continue;
+			hasPool = true;
+			ReturnCode ret = pool.allocateGlyph(_width, _rows, _key, &_glyphRect, _slotRect);
+			if (ret == OK)
+				_pool = &pool;
+			if (ret != NotEnoughSpace)
+				return ret;
+		}
+
+		if (hasPool)
+			return NotEnoughSpace;
+
+		addPool(_format);
+		_pool = m_pools.back().get();
+		return m_pools.back()->allocateGlyph(_width, _rows, _key, &_glyphRect, _slotRect);
+	}
+
+	void BitmapFontCache::beginFrame()
+	{
+		assert(!m_inFrame);
+		m_frame++;
+		m_inFrame = true;
+	}
+
+	void BitmapFontCache::endFrame()
+	{
+		assert(m_inFrame);
+		m_inFrame = false;
+	}
+
+	bool BitmapFontCache::evictGlyph(PageFormat _format, unsigned int _width, unsigned int _rows, const Pool::Key& _key)
+	{
+		if (m_evictionPolicy == EvictionPolicy::None)
+			return false;
+
+		struct Candidate
+		{
+			Pool*				pool;
+			const Pool::Key*	key;
+			const Pool::Glyph*	glyph;
+		};
+		std::vector<Candidate> candidates;
+		for (auto& pool : m_pools)
+		{
+			// Nothing is evicted for glyphs which can't fit in an empty page
+			if (pool->getPage().getFormat() != _format || !pool->getSlotSize(_width, _rows, _key.getMode()).isSmallerOrEqualThan(pool->getRootRect()))
+				continue;
+			for (const auto& it : pool->getGlyphs())
+			{
+				if (!isPinned(it.second) && it.second.refCount == 0)
+					candidates.push_back({ pool.get(), &it.first, &it.second });
+			}
+		}
+		if (candidates.empty())
+			return false;
+
+		// The oldest glyph which leaves a large enough slot is enough, otherwise the oldest glyph
+		// is evicted and the next call may merge its slot with the one of the next victim.
+		// GreedyDualSize does the same with the lowest priorities.
+		const size_t window = std::min(candidates.size(), EVICTION_WINDOW);
+		if (m_evictionPolicy == EvictionPolicy::GreedyDualSize)
+		{
+			std::partial_sort(candidates.begin(), candidates.begin() + window, candidates.end(),
+				[](const Candidate& _a, const Candidate& _b) { return _a.glyph->priority == _b.glyph->priority ? _a.glyph->lastUse < _b.glyph->lastUse : _a.glyph->priority < _b.glyph->priority; });
+		}
 		else
 		{
-			for (int i = 1; i < POOL_COUNT; i++)
+			std::partial_sort(candidates.begin(), candidates.begin() + window, candidates.end(),
+				[](const Candidate& _a, const Candidate& _b) { return _a.glyph->lastUse < _b.glyph->lastUse; });
+		}
+		const Candidate* victim = &candidates[0];
+		for (size_t i = 0; i < window; i++)
+		{
+			const Candidate& candidate = candidates[i];
+			if (candidate.pool->getSlotSize(_width, _rows, _key.getMode()).isSmallerOrEqualThan(candidate.glyph->slot->getFreedRect()))
 			{
-				if (m_pools[(i + defaultPoolIndex) % POOL_COUNT].findGlyph(_fontIndex, _char, _pixelSize))
-					return AlreadyAdded;
+				victim = &candidate;
+				break;
 			}
 		}
 
+		// Glyphs used from now on outrank the ones which weren't used since the victim was
+		if (m_evictionPolicy == EvictionPolicy::GreedyDualSize)
+			m_inflation = std::max(m_inflation, victim->glyph->priority);
+		removeGlyph(*victim->pool, *victim->key);
+		m_evictedCount++;
+		return true;
+	}
+
+	BitmapFontCache::ReturnCode BitmapFontCache::insertGlyph(const GlyphBitmap& _bitmap, const GlyphRequest& _request, Rect* _glyphRect, float _rasterizeMs)
+	{
+		Rect rect, slotRect;
+		Pool* pool = nullptr;
+		ReturnCode ret = allocateGlyph(_bitmap.format, _bitmap.width, _bitmap.rows, _request, pool, rect, &slotRect, _rasterizeMs);
+		if (ret != OK)
+			return ret;
+		pool->setGlyphOrigin(Pool::Key(_request), _bitmap.left, _bitmap.top);
+
+		// Distance fields must keep their values
+		const GammaTable* gamma = _request.mode == GlyphMode::Bitmap ? m_gamma.get() : nullptr;
+		blitToSlot(BitmapView(_bitmap), pool->getPage(), slotRect, gamma);
+		pool->getPage().markDirty(slotRect);
+		shareGlyph(*pool, _request);
+
+		if (_glyphRect)
+			*_glyphRect = rect;
+		return OK;
+	}
+
+	BitmapFontCache::ReturnCode BitmapFontCache::addSdfGlyph(const GlyphRequest& _request)
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+		auto start = Clock::now();
+
+		GlyphRequest coverageRequest = _request;
+		coverageRequest.mode = GlyphMode::Bitmap;
+		GlyphBitmap coverage;
+		if (!rasterizeGlyph(m_faces[_request.fontIndex], coverageRequest, coverage, m_outlines.get(), m_strikes.get()))
+			return NotFound;
+
+		// The field is generated directly into the slot of the glyph
+		Rect rect;
+		Pool* pool = nullptr;
+		ReturnCode ret = allocateGlyph(PageFormat::Gray8, coverage.width + 2 * _request.spread, coverage.rows + 2 * _request.spread, _request, pool, rect);
+		if (ret != OK)
+			return ret;
+		pool->setGlyphOrigin(Pool::Key(_request), coverage.left - _request.spread, coverage.top + _request.spread);
+
+		AtlasPage& page = pool->getPage();
+		if (page.getLayout() == PageLayout::Linear)
+		{
+			generateSdf(coverage, _request.spread, page.getData() + rect.left() + rect.top() * page.getPitch(), page.getPitch());
+		}
+		else
+		{
+			std::vector<unsigned char> field(rect.width() * rect.height());
+			generateSdf(coverage, _request.spread, field.data(), rect.width());
+			page.writeRegion(rect, field.data(), rect.width());
+		}
+		page.markDirty(rect);
+		shareGlyph(*pool, _request);
+
+		// Generating the field is part of the cost of the glyph
+		Pool::Glyph& glyph = *pool->getGlyph(Pool::Key(_request));
+		glyph.rasterizeMs = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+		touch(glyph);
+		return OK;
+	}
+
+	BitmapFontCache::ReturnCode BitmapFontCache::addGlyph(int _fontIndex, int _char, int _pixelSize, GlyphMode _mode)
+	{
+		GlyphRequest request(_fontIndex, _char, _pixelSize, _mode);
+		return addGlyph(request);
+	}
+
+	BitmapFontCache::ReturnCode BitmapFontCache::addGlyphByIndex(int _fontIndex, unsigned int _glyphIndex, int _pixelSize, GlyphMode _mode)
+	{
+		GlyphRequest request = GlyphRequest::fromGlyphIndex(_fontIndex, _glyphIndex, _pixelSize, _mode);
+		return addGlyph(request);
+	}
+
+	BitmapFontCache::ReturnCode BitmapFontCache::addStrokedGlyph(int _fontIndex, int _char, int _pixelSize, float _strokeWidth, GlyphMode _mode)
+	{
+		GlyphRequest request(_fontIndex, _char, _pixelSize, _mode);
+		request.strokeWidth = _strokeWidth;
+		return addGlyph(request);
+	}
+
+	BitmapFontCache::ReturnCode BitmapFontCache::addGlyph(GlyphRequest& _request)
+	{
+		prepareRequest(_request);
+		if (findGlyph(_request))
+			return AlreadyAdded;
+		if (isSharedReader())
+			return NotFound;
+
+		if (!resolveGlyphIndex(_request))
+			return NotFound;
+
+		if (_request.mode == GlyphMode::Sdf)
+			return addSdfGlyph(_request);
+
 		// Build bitmap char
-		FT_Set_Pixel_Sizes(m_faces[_fontIndex], 0, _pixelSize);
-		int error = FT_Load_Char(m_faces[_fontIndex], _char, FT_LOAD_RENDER);
-		if (error || m_faces[_fontIndex]->glyph->bitmap.width == 0 || m_faces[_fontIndex]->glyph->bitmap.rows == 0)
+		typedef std::chrono::high_resolution_clock Clock;
+		auto start = Clock::now();
+		GlyphBitmap bitmap;
+		FT_Face face = getRasterFace(_request);
+		if (!face || !rasterizeGlyph(face, _request, bitmap, m_outlines.get(), m_strikes.get()))
 			return NotFound;
 
-		// Add to pools
-		auto ret = m_pools[defaultPoolIndex].addGlyph(this, m_faces[_fontIndex]->glyph->bitmap, _fontIndex, _char, _pixelSize);
-		if (ret == OK)
-			return OK;
-		else if (ret == NotEnoughSpace)
+		return insertGlyph(bitmap, _request, nullptr, std::chrono::duration<float, std::milli>(Clock::now() - start).count());
+	}
+
+	void BitmapFontCache::rasterizeBatch(const std::vector<GlyphRequest>& _requests, std::vector<ReturnCode>* _results, std::vector<RasterWorkerPool::JobPtr>& _jobs, std::vector<size_t>& _jobRequests)
+	{
+		if (_results)
+			_results->assign(_requests.size(), NotFound);
+
+		// Skip glyphs already in the atlas, or requested twice in the batch
+		std::set<Pool::Key> pending;
+		for (size_t i = 0; i < _requests.size(); i++)
 		{
-			for (int i = 1; i < POOL_COUNT; i++)
+			GlyphRequest request = _requests[i];
+			prepareRequest(request);
+			if (findGlyph(request) || !pending.insert(Pool::Key(request)).second)
 			{
-				ret = m_pools[(i + defaultPoolIndex) % POOL_COUNT].addGlyph(this, m_faces[_fontIndex]->glyph->bitmap, _fontIndex, _char, _pixelSize);
-				if (ret == OK)
-					return OK;
+				if (_results)
+					(*_results)[i] = AlreadyAdded;
+				continue;
 			}
+
+			// Glyph indices are resolved here, so that workers only have to load glyphs
+			if (!resolveGlyphIndex(request))
+				continue;
+			_jobs.push_back(std::make_shared<RasterWorkerPool::Job>(request));
+			_jobRequests.push_back(i);
 		}
 
-		return ret;
+		// Rasterize
+		if (m_workers)
+		{
+			m_workers->submit(_jobs);
+			m_workers->wait(_jobs);
+		}
+		for (auto& job : _jobs)
+		{
+			if (!m_workers || job->skipped)
+				rasterizeJob(*job);
+		}
 	}
 
-	BitmapFontCache::ReturnCode BitmapFontCache::removeGlyph(int _fontIndex, int _char, int _pixelSize)
+	void BitmapFontCache::rasterizeJob(RasterWorkerPool::Job& _job)
 	{
-		unsigned int defaultPoolIndex = getPoolIndex();
-		auto ret = m_pools[defaultPoolIndex].removeGlyph(_fontIndex, _char, _pixelSize);
-		if (ret == OK)
-			return OK;
-		else if (ret == NotFound)
+		typedef std::chrono::high_resolution_clock Clock;
+		auto start = Clock::now();
+		FT_Face face = getRasterFace(_job.request);
+		_job.found = face && rasterizeGlyph(face, _job.request, _job.bitmap, m_outlines.get(), m_strikes.get());
+		_job.rasterizeMs = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+		_job.skipped = false;
+	}
+
+	unsigned int BitmapFontCache::packBatch(const std::vector<RasterWorkerPool::JobPtr>& _jobs, const std::vector<size_t>& _jobRequests, std::vector<ReturnCode>* _results, bool _largestFirst)
+	{
+		std::vector<size_t> order(_jobs.size());
+		for (size_t j = 0; j < order.size(); j++)
+			order[j] = j;
+
+		// Placing tall glyphs first leaves fewer unusable slivers in the slot tree
+		if (_largestFirst)
 		{
-			for (int i = 1; i < POOL_COUNT; i++)
+			std::stable_sort(order.begin(), order.end(), [&_jobs](size_t a, size_t b)
 			{
-				ret = m_pools[(i + defaultPoolIndex) % POOL_COUNT].removeGlyph(_fontIndex, _char, _pixelSize);
-				if (ret == OK)
-					return OK;
+				const GlyphBitmap& bitmapA = _jobs[a]->bitmap;
+				const GlyphBitmap& bitmapB = _jobs[b]->bitmap;
+				return bitmapA.rows == bitmapB.rows ? bitmapA.width > bitmapB.width : bitmapA.rows > bitmapB.rows;
+			});
+		}
+
+		unsigned int added = 0;
+		for (size_t j : order)
+		{
+			ReturnCode ret = _jobs[j]->found ? insertGlyph(_jobs[j]->bitmap, _jobs[j]->request, nullptr, _jobs[j]->rasterizeMs) : NotFound;
+			if (ret == OK)
+				added++;
+			if (_results)
+				(*_results)[_jobRequests[j]] = ret;
+		}
+		return added;
+	}
+
+	unsigned int BitmapFontCache::addGlyphs(const std::vector<GlyphRequest>& _requests, std::vector<ReturnCode>* _results)
+	{
+		std::vector<RasterWorkerPool::JobPtr> jobs;
+		std::vector<size_t> jobRequests;
+		rasterizeBatch(_requests, _results, jobs, jobRequests);
+
+		// Pack sequentially, in request order
+		return packBatch(jobs, jobRequests, _results, false);
+	}
+
+	BitmapFontCache::PrewarmStats BitmapFontCache::prewarm(int _fontIndex, const std::vector<CodepointRange>& _ranges, const std::vector<int>& _sizes)
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+		auto start = Clock::now();
+
+		PrewarmStats stats;
+		std::vector<GlyphRequest> requests;
+		for (int size : _sizes)
+		{
+			for (const CodepointRange& range : _ranges)
+			{
+				for (int c = range.first; c <= range.last; c++)
+					requests.push_back(GlyphRequest(_fontIndex, c, size));
 			}
 		}
 
+		std::vector<int> glyphsCount;
+		for (auto& pool : m_pools)
+			glyphsCount.push_back(pool->getGlyphsCount());
+
+		// Use every core for the duration of the warm-up when no workers were configured
+		bool temporaryWorkers = !m_workers && std::thread::hardware_concurrency() > 1;
+		if (temporaryWorkers)
+			setRasterThreadCount(std::thread::hardware_concurrency());
+
+		std::vector<ReturnCode> results;
+		std::vector<RasterWorkerPool::JobPtr> jobs;
+		std::vector<size_t> jobRequests;
+		rasterizeBatch(requests, &results, jobs, jobRequests);
+
+		if (temporaryWorkers)
+			setRasterThreadCount(0);
+
+		auto rasterized = Clock::now();
+		stats.glyphsAdded = packBatch(jobs, jobRequests, &results, true);
+		auto packed = Clock::now();
+
+		for (ReturnCode ret : results)
+		{
+			if (ret == NotFound)
+				stats.glyphsMissing++;
+			else if (ret == NotEnoughSpace)
+				stats.glyphsRejected++;
+		}
+
+		float usedSurface = 0.f;
+		for (size_t i = 0; i < m_pools.size(); i++)
+		{
+			if (m_pools[i]->getGlyphsCount() > (i < glyphsCount.size() ? glyphsCount[i] : 0))
+				stats.pagesFilled++;
+			usedSurface += m_pools[i]->getOccupiedSurface();
+		}
+		stats.occupancy = usedSurface / (static_cast<float>(WIDTH) * HEIGHT * m_pools.size());
+
+		typedef std::chrono::duration<double, std::milli> Milliseconds;
+		stats.rasterizeMs = Milliseconds(rasterized - start).count();
+		stats.packMs = Milliseconds(packed - rasterized).count();
+		stats.totalMs = Milliseconds(packed - start).count();
+		return stats;
+	}
+
+	void BitmapFontCache::setRasterThreadCount(unsigned int _threadCount)
+	{
+		// Let the workers finish the asynchronous jobs, commit() will pick up their results
+		if (m_workers)
+		{
+			std::vector<RasterWorkerPool::JobPtr> jobs;
+			for (auto& it : m_pendingGlyphs)
+				jobs.push_back(m_asyncGlyphs[it.second].job);
+			m_workers->wait(jobs);
+		}
+
+		m_workers.reset();
+		if (_threadCount == 0)
+			return;
+
+		m_workers.reset(new RasterWorkerPool(_threadCount));
+		m_workers->setOutlineCache(m_outlines);
+		m_workers->setStrikeCache(m_strikes);
+		for (const FontDataPtr& fontData : m_fontData)
+			m_workers->addFont(fontData);
+	}
+
+	void BitmapFontCache::setGamma(float _gamma)
+	{
+		if (_gamma == 1.f)
+			m_gamma.reset();
+		else
+			m_gamma.reset(new GammaTable(_gamma));
+		if (m_shared && m_shared->isWriter())
+			shareFonts();
+	}
+
+	void BitmapFontCache::setOutlineCacheBudget(size_t _bytes)
+	{
+		if (_bytes == 0)
+			m_outlines.reset();
+		else if (m_outlines)
+			m_outlines->setBudget(_bytes);
+		else
+			m_outlines = std::make_shared<OutlineCache>(_bytes);
+
+		if (m_workers)
+			m_workers->setOutlineCache(m_outlines);
+	}
+
+	void BitmapFontCache::setStrikeCacheBudget(size_t _bytes)
+	{
+		if (_bytes == 0)
+			m_strikes.reset();
+		else if (m_strikes)
+			m_strikes->setBudget(_bytes);
+		else
+			m_strikes = std::make_shared<StrikeCache>(_bytes);
+
+		if (m_workers)
+			m_workers->setStrikeCache(m_strikes);
+	}
+
+	RasterWorkerPool& BitmapFontCache::getWorkers()
+	{
+		if (!m_workers)
+			setRasterThreadCount(1);
+		return *m_workers;
+	}
+
+	BitmapFontCache::AsyncHandle BitmapFontCache::addGlyphAsync(int _fontIndex, int _char, int _pixelSize, GlyphMode _mode)
+	{
+		GlyphRequest request(_fontIndex, _char, _pixelSize, _mode);
+		prepareRequest(request);
+		Pool::Key key(request);
+
+		// Share the handle of a glyph already on its way
+		auto pending = m_pendingGlyphs.find(key);
+		if (pending != m_pendingGlyphs.end())
+			return pending->second;
+
+		AsyncHandle handle = m_nextAsyncHandle++;
+		AsyncGlyph& glyph = m_asyncGlyphs[handle];
+		if (findGlyph(request))
+		{
+			glyph.status = Resident;
+			glyph.result = AlreadyAdded;
+			m_resolvedHandles.push_back(handle);
+		}
+		else if (!resolveGlyphIndex(request))
+		{
+			glyph.status = Failed;
+			glyph.result = NotFound;
+			m_resolvedHandles.push_back(handle);
+		}
+		else
+		{
+			glyph.job = std::make_shared<RasterWorkerPool::Job>(request);
+			m_pendingGlyphs[key] = handle;
+			getWorkers().submit(glyph.job);
+		}
+		return handle;
+	}
+
+	BitmapFontCache::GlyphStatus BitmapFontCache::getGlyphStatus(AsyncHandle _handle, ReturnCode* _result) const
+	{
+		auto it = m_asyncGlyphs.find(_handle);
+		if (it == m_asyncGlyphs.end())
+			return Unknown;
+
+		const AsyncGlyph& glyph = it->second;
+		if (_result)
+			*_result = glyph.result;
+		if (glyph.status == Pending && glyph.job->done.load(std::memory_order_acquire))
+			return Rasterized;
+		return glyph.status;
+	}
+
+	std::vector<Rect> BitmapFontCache::commit()
+	{
+		// Handles resolved during the previous frame are forgotten
+		for (AsyncHandle handle : m_resolvedHandles)
+			m_asyncGlyphs.erase(handle);
+		m_resolvedHandles.clear();
+
+		std::vector<Rect> dirtyRects;
+		for (auto it = m_pendingGlyphs.begin(); it != m_pendingGlyphs.end();)
+		{
+			AsyncGlyph& glyph = m_asyncGlyphs[it->second];
+			const RasterWorkerPool::JobPtr& job = glyph.job;
+			if (!job->done.load(std::memory_order_acquire))
+			{
+				++it;
+				continue;
+			}
+
+			// The glyph may have been added synchronously since it was requested
+			Rect glyphRect;
+			if (findGlyph(job->request))
+			{
+				glyph.result = AlreadyAdded;
+			}
+			else
+			{
+				if (job->skipped)
+					rasterizeJob(*job);
+				glyph.result = job->found ? insertGlyph(job->bitmap, job->request, &glyphRect, job->rasterizeMs) : NotFound;
+			}
+			glyph.status = glyph.result == OK || glyph.result == AlreadyAdded ? Resident : Failed;
+			if (glyph.result == OK)
+				dirtyRects.push_back(glyphRect);
+			glyph.job.reset();
+
+			m_resolvedHandles.push_back(it->second);
+			it = m_pendingGlyphs.erase(it);
+		}
+		return dirtyRects;
+	}
+
+	BitmapFontCache::ReturnCode BitmapFontCache::setPlaceholderGlyph(int _fontIndex, int _char, int _pixelSize)
+	{
+		ReturnCode ret = addGlyph(_fontIndex, _char, _pixelSize);
+		if (ret == OK || ret == AlreadyAdded)
+			m_placeholder = GlyphRequest(_fontIndex, _char, _pixelSize);
 		return ret;
 	}
 
+	bool BitmapFontCache::getGlyphRect(int _fontIndex, int _char, int _pixelSize, Rect& _rect) const
+	{
+		return getGlyphRect(GlyphRequest(_fontIndex, _char, _pixelSize), _rect);
+	}
+
+	bool BitmapFontCache::getGlyphRect(const GlyphRequest& _request, Rect& _rect, unsigned int* _pageIndex) const
+	{
+		GlyphRequest request = _request;
+		prepareRequest(request);
+		SharedAtlas::Glyph shared;
+		if (isSharedReader())
+		{
+			if (!m_shared->find(makeGlyphRecord(request), shared))
+				return false;
+			_rect = shared.rect;
+			if (_pageIndex)
+				*_pageIndex = shared.page;
+			return true;
+		}
+
+		Pool::Key key(request);
+		for (size_t i = 0; i < m_pools.size(); i++)
+		{
+			const Pool::Glyph* glyph = m_pools[i]->getGlyph(key);
+			if (glyph)
+			{
+				touch(*glyph);
+				_rect = glyph->rect;
+				if (_pageIndex)
+					*_pageIndex = i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool BitmapFontCache::getGlyphOrigin(const GlyphRequest& _request, int& _left, int& _top) const
+	{
+		GlyphRequest request = _request;
+		prepareRequest(request);
+		SharedAtlas::Glyph shared;
+		if (isSharedReader())
+		{
+			if (!m_shared->find(makeGlyphRecord(request), shared))
+				return false;
+			_left = shared.left;
+			_top = shared.top;
+			return true;
+		}
+
+		Pool::Key key(request);
+		for (auto& pool : m_pools)
+		{
+			const Pool::Glyph* glyph = pool->getGlyph(key);
+			if (glyph)
+			{
+				touch(*glyph);
+				_left = glyph->left;
+				_top = glyph->top;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	BitmapFontCache::GlyphHandle BitmapFontCache::retainGlyph(const GlyphRequest& _request, ReturnCode* _result)
+	{
+		GlyphRequest request = _request;
+		ReturnCode result = addGlyph(request);
+		if (_result)
+			*_result = result;
+		if (result != OK && result != AlreadyAdded)
+			return 0;
+
+		Pool::Key key(request);
+		for (auto& pool : m_pools)
+		{
+			Pool::Glyph* glyph = pool->getGlyph(key);
+			if (!glyph)
+				continue;
+			if (!glyph->handle)
+			{
+				glyph->handle = m_nextGlyphHandle++;
+				m_retainedGlyphs.insert(std::make_pair(glyph->handle, RetainedGlyph{ pool.get(), key }));
+			}
+			glyph->refCount++;
+			return glyph->handle;
+		}
+		return 0;	// glyphs of a shared atlas attached as reader aren't reference counted
+	}
+
+	const BitmapFontCache::Pool::Glyph* BitmapFontCache::getGlyph(GlyphHandle _handle, Pool** _pool) const
+	{
+		auto it = m_retainedGlyphs.find(_handle);
+		if (it == m_retainedGlyphs.end())
+			return nullptr;
+		if (_pool)
+			*_pool = it->second.pool;
+		return it->second.pool->getGlyph(it->second.key);
+	}
+
+	BitmapFontCache::Pool::Glyph* BitmapFontCache::getGlyph(GlyphHandle _handle)
+	{
+		auto it = m_retainedGlyphs.find(_handle);
+		return it != m_retainedGlyphs.end() ? it->second.pool->getGlyph(it->second.key) : nullptr;
+	}
+
+	BitmapFontCache::ReturnCode BitmapFontCache::retainGlyph(GlyphHandle _handle)
+	{
+		Pool::Glyph* glyph = getGlyph(_handle);
+		if (!glyph)
+			return NotFound;
+		glyph->refCount++;
+		touch(*glyph);
+		return OK;
+	}
+
+	BitmapFontCache::ReturnCode BitmapFontCache::releaseGlyph(GlyphHandle _handle)
+	{
+		Pool::Glyph* glyph = getGlyph(_handle);
+		if (!glyph)
+			return NotFound;
+		assert(glyph->refCount > 0);
+		if (glyph->refCount > 0)
+			glyph->refCount--;
+		return OK;
+	}
+
+	unsigned int BitmapFontCache::getGlyphRefCount(GlyphHandle _handle) const
+	{
+		const Pool::Glyph* glyph = getGlyph(_handle);
+		return glyph ? glyph->refCount : 0;
+	}
+
+	bool BitmapFontCache::getGlyphRect(GlyphHandle _handle, Rect& _rect, unsigned int* _pageIndex) const
+	{
+		Pool* pool = nullptr;
+		const Pool::Glyph* glyph = getGlyph(_handle, &pool);
+		if (!glyph)
+			return false;
+		touch(*glyph);
+		_rect = glyph->rect;
+		if (_pageIndex)
+		{
+			for (size_t i = 0; i < m_pools.size(); i++)
+			{
+				if (m_pools[i].get() == pool)
+					*_pageIndex = i;
+			}
+		}
+		return true;
+	}
+
+	unsigned int BitmapFontCache::reclaimReleasedGlyphs(PageFormat _format)
+	{
+		struct Released
+		{
+			Pool*		pool;
+			Pool::Key	key;
+			Rect		slot;
+		};
+		std::vector<Released> released;
+		for (const auto& it : m_retainedGlyphs)
+		{
+			const RetainedGlyph& retained = it.second;
+			const Pool::Glyph* glyph = retained.pool->getGlyph(retained.key);
+			if (retained.pool->getPage().getFormat() == _format && glyph->refCount == 0 && !isPinned(*glyph))
+				released.push_back({ retained.pool, retained.key, glyph->slot->getRect() });
+		}
+
+		// Freed in page order, siblings are freed one after the other and merge right away,
+		// which keeps the free lists short
+		std::sort(released.begin(), released.end(), [](const Released& _a, const Released& _b)
+		{
+			return std::make_tuple(_a.pool, _a.slot.top(), _a.slot.left()) < std::make_tuple(_b.pool, _b.slot.top(), _b.slot.left());
+		});
+		for (const Released& glyph : released)
+			removeGlyph(*glyph.pool, glyph.key);
+
+		m_reclaimedCount += released.size();
+		return released.size();
+	}
+
+	bool BitmapFontCache::getGlyphRectOrPlaceholder(int _fontIndex, int _char, int _pixelSize, Rect& _rect) const
+	{
+		return getGlyphRect(_fontIndex, _char, _pixelSize, _rect)
+			|| getGlyphRect(m_placeholder.fontIndex, m_placeholder.unicodeChar, m_placeholder.pixelSize, _rect);
+	}
+
+	BitmapFontCache::ReturnCode BitmapFontCache::removeGlyph(int _fontIndex, int _char, int _pixelSize, GlyphMode _mode)
+	{
+		return removeGlyph(GlyphRequest(_fontIndex, _char, _pixelSize, _mode));
+	}
+
+	BitmapFontCache::ReturnCode BitmapFontCache::removeGlyphByIndex(int _fontIndex, unsigned int _glyphIndex, int _pixelSize, GlyphMode _mode)
+	{
+		return removeGlyph(GlyphRequest::fromGlyphIndex(_fontIndex, _glyphIndex, _pixelSize, _mode));
+	}
+
+	BitmapFontCache::ReturnCode BitmapFontCache::removeGlyph(GlyphRequest _request)
+	{
+		prepareRequest(_request);
+		Pool::Key key(_request);
+		for (auto& pool : m_pools)
+		{
+			if (pool->findGlyph(key))
+			{
+				removeGlyph(*pool, key);
+				return OK;
+			}
+		}
+
+		return NotFound;
+	}
+
+	void BitmapFontCache::removeGlyph(Pool& _pool, const Pool::Key& _key)
+	{
+		// The key may belong to the glyph removed
+		const Pool::Key key = _key;
+		const Pool::Glyph* glyph = _pool.getGlyph(key);
+		if (glyph && glyph->handle)
+			m_retainedGlyphs.erase(glyph->handle);
+		_pool.removeGlyph(key);
+		if (m_shared && _pool.getSharedPage() >= 0)
+			m_shared->remove(makeGlyphRecord(key.getRequest()));
+	}
+
+	static void getFreeTypeVersion(FT_Library _library, int32_t _version[3])
+	{
+		FT_Int major = 0, minor = 0, patch = 0;
+		FT_Library_Version(_library, &major, &minor, &patch);
+		_version[0] = major;
+		_version[1] = minor;
+		_version[2] = patch;
+	}
+
+	static atlasFile::FontRecord makeFontRecord(const FontData& _data, const RenderOptions& _options)
+	{
+		atlasFile::FontRecord record = {};
+		record.hash = _data.hash();
+		record.loadFlags = _options.loadFlags;
+		record.hinting = static_cast<uint8_t>(_options.hinting);
+		record.renderMode = static_cast<uint8_t>(_options.renderMode);
+		record.embolden = _options.embolden;
+		return record;
+	}
+
+	template <typename T>
+	static void writeRecords(std::ofstream& _file, const std::vector<T>& _records)
+	{
+		if (!_records.empty())
+			_file.write(reinterpret_cast<const char*>(_records.data()), _records.size() * sizeof(T));
+	}
+
+	// Counts read from the file are checked against its size before allocating the records
+	template <typename T>
+	static bool readRecords(std::ifstream& _file, std::vector<T>& _records, size_t _count, uint64_t _fileSize)
+	{
+		const std::streamoff position = _file.tellg();
+		if (position < 0 || _count > (_fileSize - static_cast<uint64_t>(position)) / sizeof(T))
+			return false;
+		_records.resize(_count);
+		if (_count)
+			_file.read(reinterpret_cast<char*>(_records.data()), _count * sizeof(T));
+		return _file.good();
+	}
+
+	bool BitmapFontCache::save(const char* _filename) const
+	{
+		std::ofstream file(_filename, std::ios::binary | std::ios::trunc);
+		if (!file)
+			return false;
+
+		atlasFile::Header header = {};
+		std::memcpy(header.magic, atlasFile::MAGIC, sizeof(header.magic));
+		header.version = atlasFile::VERSION;
+		getFreeTypeVersion(m_library, header.freetypeVersion);
+		header.pageWidth = WIDTH;
+		header.pageHeight = HEIGHT;
+		header.fontCount = m_faces.size();
+		header.poolCount = m_pools.size();
+		header.gamma = getGamma();
+
+		std::vector<atlasFile::FontRecord> fonts;
+		for (size_t i = 0; i < m_faces.size(); i++)
+			fonts.push_back(makeFontRecord(*m_fontData[i], m_renderOptions[i]));
+
+		std::vector<atlasFile::PoolRecord> pools(m_pools.size());
+		std::vector<std::vector<atlasFile::SlotRecord>> slots(m_pools.size());
+		std::vector<std::vector<uint32_t>> freeSlots(m_pools.size());
+		std::vector<std::vector<atlasFile::GlyphRecord>> glyphs(m_pools.size());
+		size_t offset = sizeof(header) + fonts.size() * sizeof(atlasFile::FontRecord) + pools.size() * sizeof(atlasFile::PoolRecord);
+		for (size_t i = 0; i < m_pools.size(); i++)
+		{
+			m_pools[i]->save(slots[i], freeSlots[i], glyphs[i]);
+			offset += slots[i].size() * sizeof(atlasFile::SlotRecord) + freeSlots[i].size() * sizeof(uint32_t) + glyphs[i].size() * sizeof(atlasFile::GlyphRecord);
+		}
+
+		// Pages follow the records, at mappable offsets
+		for (size_t i = 0; i < m_pools.size(); i++)
+		{
+			const AtlasPage& page = m_pools[i]->getPage();
+			atlasFile::PoolRecord& record = pools[i];
+			record.format = static_cast<uint8_t>(page.getFormat());
+			record.layout = static_cast<uint8_t>(page.getLayout());
+			record.paddingX = m_pools[i]->getPaddingX();
+			record.paddingY = m_pools[i]->getPaddingY();
+			record.slotCount = slots[i].size();
+			record.freeSlotCount = freeSlots[i].size();
+			record.glyphCount = glyphs[i].size();
+			record.dataOffset = (offset + atlasFile::ALIGNMENT - 1) / atlasFile::ALIGNMENT * atlasFile::ALIGNMENT;
+			record.dataSize = page.getSize();
+			offset = static_cast<size_t>(record.dataOffset + record.dataSize);
+		}
+
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		writeRecords(file, fonts);
+		writeRecords(file, pools);
+		for (size_t i = 0; i < m_pools.size(); i++)
+		{
+			writeRecords(file, slots[i]);
+			writeRecords(file, freeSlots[i]);
+			writeRecords(file, glyphs[i]);
+		}
+		for (size_t i = 0; i < m_pools.size(); i++)
+		{
+			const size_t padding = static_cast<size_t>(pools[i].dataOffset) - static_cast<size_t>(file.tellp());
+			writeRecords(file, std::vector<char>(padding));
+			file.write(reinterpret_cast<const char*>(m_pools[i]->getPage().getData()), pools[i].dataSize);
+		}
+		return file.good();
+	}
+
+	bool BitmapFontCache::load(const char* _filename)
+	{
+		if (!m_pendingGlyphs.empty() || m_shared || !m_retainedGlyphs.empty())
+			return false;
+
+		std::ifstream file(_filename, std::ios::binary | std::ios::ate);
+		const std::streamoff fileSize = file.tellg();
+		atlasFile::Header header;
+		if (fileSize < 0 || !file.seekg(0) || !file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+			return false;
+
+		int32_t freetypeVersion[3];
+		getFreeTypeVersion(m_library, freetypeVersion);
+		if (std::memcmp(header.magic, atlasFile::MAGIC, sizeof(header.magic)) != 0 || header.version != atlasFile::VERSION
+			|| std::memcmp(header.freetypeVersion, freetypeVersion, sizeof(freetypeVersion)) != 0
+			|| header.pageWidth != WIDTH || header.pageHeight != HEIGHT || header.fontCount != m_faces.size() || header.gamma != getGamma())
+			return false;
+
+		std::vector<atlasFile::FontRecord> fonts;
+		if (!readRecords(file, fonts, header.fontCount, fileSize))
+			return false;
+		for (size_t i = 0; i < m_faces.size(); i++)
+		{
+			atlasFile::FontRecord expected = makeFontRecord(*m_fontData[i], m_renderOptions[i]);
+			if (std::memcmp(&fonts[i], &expected, sizeof(expected)) != 0)
+				return false;
+		}
+
+		std::vector<atlasFile::PoolRecord> records;
+		if (header.poolCount == 0 || !readRecords(file, records, header.poolCount, fileSize))
+			return false;
+
+		std::vector<std::unique_ptr<Pool>> pools;
+		for (const atlasFile::PoolRecord& record : records)
+		{
+			std::vector<atlasFile::SlotRecord> slots;
+			std::vector<uint32_t> freeSlots;
+			std::vector<atlasFile::GlyphRecord> glyphs;
+			if (record.format > static_cast<uint8_t>(PageFormat::Mono1) || record.layout > static_cast<uint8_t>(PageLayout::Tiled16)
+				|| record.paddingX < 0 || record.paddingX >= WIDTH || record.paddingY < 0 || record.paddingY >= HEIGHT
+				|| !readRecords(file, slots, record.slotCount, fileSize) || !readRecords(file, freeSlots, record.freeSlotCount, fileSize)
+				|| !readRecords(file, glyphs, record.glyphCount, fileSize))
+				return false;
+			// Pages must lie within the file, a shorter file would fault once mapped
+			if (record.dataOffset > static_cast<uint64_t>(fileSize) || record.dataSize > static_cast<uint64_t>(fileSize) - record.dataOffset)
+				return false;
+			for (const atlasFile::GlyphRecord& glyph : glyphs)
+			{
+				if (glyph.fontIndex < 0 || glyph.fontIndex >= static_cast<int>(m_faces.size()))
+					return false;
+			}
+
+			pools.emplace_back(new Pool());
+			Pool& pool = *pools.back();
+			const PageFormat format = static_cast<PageFormat>(record.format);
+			if (!pool.restore(format, WIDTH, HEIGHT, record.paddingX, record.paddingY, m_largePages, slots, freeSlots, glyphs)
+				|| record.dataSize != pool.getPage().getSize() || record.dataOffset % atlasFile::ALIGNMENT != 0
+				|| !pool.getPage().mapFile(_filename, static_cast<size_t>(record.dataOffset), static_cast<PageLayout>(record.layout)))
+				return false;
+			pool.getPage().setDoubleBuffered(m_doubleBuffered);
+			pool.getPage().setLayout(m_pageLayout);
+		}
+
+		// Restored glyphs have no measured cost, priorities start over from them
+		m_pools.swap(pools);
+		m_inflation = 0.;
+		return true;
+	}
+
+	bool BitmapFontCache::shareAtlas(const char* _name, size_t _pageBytes, unsigned int _glyphCapacity)
+	{
+		if (m_shared)
+			return false;
+		m_shared = SharedAtlas::create(_name, WIDTH, HEIGHT, _pageBytes, _glyphCapacity);
+		if (!m_shared)
+			return false;
+
+		m_doubleBuffered = false;
+		shareFonts();
+		for (auto& pool : m_pools)
+		{
+			sharePage(*pool);
+			for (const auto& it : pool->getGlyphs())
+				shareGlyph(*pool, it.first.getRequest());
+		}
+		return true;
+	}
+
+	bool BitmapFontCache::attachSharedAtlas(const char* _name)
+	{
+		if (m_shared)
+			return false;
+		std::unique_ptr<SharedAtlas> shared = SharedAtlas::open(_name);
+		if (!shared || shared->getPageWidth() != WIDTH || shared->getPageHeight() != HEIGHT)
+			return false;
+
+		// Glyphs are looked up with the keys of this cache, which must match the ones of the writer
+		std::vector<atlasFile::FontRecord> fonts;
+		float gamma = 1.f;
+		if (!shared->getFonts(fonts, gamma) || fonts.size() < m_faces.size() || gamma != getGamma())
+			return false;
+		for (size_t i = 0; i < m_faces.size(); i++)
+		{
+			atlasFile::FontRecord expected = makeFontRecord(*m_fontData[i], m_renderOptions[i]);
+			if (std::memcmp(&fonts[i], &expected, sizeof(expected)) != 0)
+				return false;
+		}
+
+		m_shared = std::move(shared);
+		return true;
+	}
+
+	void BitmapFontCache::sharePage(Pool& _pool)
+	{
+		AtlasPage& page = _pool.getPage();
+		page.setDoubleBuffered(false);
+		unsigned char* data = m_shared->allocatePage(page.getFormat(), page.getLayout(), page.getSize());
+		if (!data)
+			return;
+		page.attachMemory(data);
+		_pool.setSharedPage(m_shared->getPageCount() - 1);
+	}
+
+	void BitmapFontCache::shareGlyph(const Pool& _pool, const GlyphRequest& _request)
+	{
+		if (!m_shared || _pool.getSharedPage() < 0)
+			return;
+
+		// Published once its pixels are written
+		const Pool::Glyph* glyph = _pool.getGlyph(Pool::Key(_request));
+		atlasFile::GlyphRecord record = makeGlyphRecord(_request);
+		record.rect[0] = glyph->rect.left();
+		record.rect[1] = glyph->rect.top();
+		record.rect[2] = glyph->rect.width();
+		record.rect[3] = glyph->rect.height();
+		record.left = glyph->left;
+		record.top = glyph->top;
+		m_shared->insert(record, _pool.getSharedPage());
+	}
+
+	void BitmapFontCache::shareFonts()
+	{
+		// Font hashes are computed once per font file, the table is only rewritten when it
+		// changes so that readers don't retry for nothing
+		std::vector<atlasFile::FontRecord> fonts, sharedFonts;
+		for (size_t i = 0; i < m_faces.size(); i++)
+			fonts.push_back(makeFontRecord(*m_fontData[i], m_renderOptions[i]));
+		float sharedGamma = 1.f;
+		if (m_shared->getFonts(sharedFonts, sharedGamma) && sharedGamma == getGamma() && sharedFonts.size() == fonts.size()
+			&& (fonts.empty() || std::memcmp(sharedFonts.data(), fonts.data(), fonts.size() * sizeof(atlasFile::FontRecord)) == 0))
+			return;
+		m_shared->setFonts(fonts, getGamma());
+	}
+
 	static HWND hwnd = NULL;
 
-	void showGlyph(HDC hdc, unsigned char*_image, const RECT &_rect)
+	void showGlyph(HDC hdc, const unsigned char*_image, const RECT &_rect)
 	{
 		for (int i = _rect.left; i < _rect.right; i++)
 		{
@@ -206,10 +1530,16 @@ namespace bmf
 		::FillRect(hdcBitmap, &rect, hPinkBrush);
 		::DeleteObject(hPinkBrush);
 
+		std::vector<unsigned char> pixels(WIDTH * HEIGHT);
 		for (auto& pool : m_pools)
 		{
+			// Only single channel pages are displayed
+			if (pool->getPage().getFormat() != PageFormat::Gray8)
+				continue;
+			pool->getPage().readRegion(Rect(0, 0, WIDTH, HEIGHT), pixels.data(), WIDTH);
+
 			// Display free slots 
-			const std::list<Pool::Slot *> &freeSlots = pool.getFreeSlots();
+			const std::list<Pool::Slot *> &freeSlots = pool->getFreeSlots();
 			for (auto it = freeSlots.begin(); it != freeSlots.end(); ++it)
 			{
 				const Rect& curGlyph = (*it)->getRect();
@@ -220,15 +1550,15 @@ namespace bmf
 			}
 
 			// Display glyphs
-			const auto& glyphs = pool.getGlyphs();
+			const auto& glyphs = pool->getGlyphs();
 			for (const auto& it : glyphs)
 			{
-				const Rect& curGlyph = it.second->getRect();
-				RECT rectGlyph = { curGlyph.left(), curGlyph.top(), curGlyph.left() + curGlyph.width() - pool.getPaddingX(), curGlyph.top() + curGlyph.height() - pool.getPaddingY() };
+				const Rect& curGlyph = it.second.rect;
+				RECT rectGlyph = { curGlyph.left(), curGlyph.top(), curGlyph.right(), curGlyph.bottom() };
 
 				::FillRect(hdcBitmap, &rectGlyph, static_cast<HBRUSH>(::GetStockObject(BLACK_BRUSH)));
 
-				showGlyph(hdcBitmap, m_image, rectGlyph);
+				showGlyph(hdcBitmap, pixels.data(), rectGlyph);
 			}
 		}
 
@@ -8,7 +8,17 @@
 #include <cassert>
 #include <algorithm>
 #include <vector>
+#include <tuple>
+#include <string>
+#include <memory>
 #include "rect.h"
+#include "GlyphRasterizer.h"
+#include "FontRegistry.h"
+#include "CharmapCache.h"
+#include "AtlasPage.h"
+#include "GlyphBlit.h"
+#include "AtlasFile.h"
+#include "SharedAtlas.h"
 
 typedef struct FT_LibraryRec_  *FT_Library;
 typedef struct FT_FaceRec_  *FT_Face;
@@ -21,12 +31,66 @@ namespace bmf
 	class BitmapFontCache
 	{
 	public:
-		explicit BitmapFontCache(FT_Library _library);
+		// Page buffers are mapped lazily and only cost memory once glyphs are written to them.
+		// Large pages only apply to pages large enough, RGB and BGRA ones (see allocatePageMemory).
+		explicit BitmapFontCache(FT_Library _library, bool _largePages = false);
 		~BitmapFontCache();
 
 		void showImage() const; // for debug
 
-		int loadFont(const char* _filename);
+		// Single byte per pixel image holding the glyphs, row major unless tiled. Front buffer of the first page.
+		const unsigned char* getImage() const { return m_pools[0]->getPage().getFrontData(); }
+		static int getImageWidth();
+		static int getImageHeight();
+
+		// One page per pool. Glyphs go to pages of the format of their bitmap, pages of a new
+		// format are created by the first glyph which needs them.
+		unsigned int getPageCount() const { return m_pools.size(); }
+		const AtlasPage& getPage(unsigned int _index) const { return m_pools[_index]->getPage(); }
+
+		// Regions of the page written since the last call, merged to limit the texture uploads.
+		// Every glyph placed marks its slot, padding included, as it clears the stale pixels around it.
+		std::vector<Rect> takeDirtyRegions(unsigned int _pageIndex) { return m_pools[_pageIndex]->getPage().takeDirtyRegions(); }
+
+		// Glyphs are written to back buffers, and are only visible in the front buffers read by
+		// the uploader once published. See AtlasPage.
+		void setDoubleBuffered(bool _doubleBuffered);
+		bool isDoubleBuffered() const { return m_doubleBuffered; }
+		void publish();
+
+		// Storage of the pages with whole bytes per pixel, existing and created afterwards.
+		// Monochrome pages stay linear.
+		void setPageLayout(PageLayout _layout);
+		PageLayout getPageLayout() const { return m_pageLayout; }
+
+		// Saves the pages, slot trees, glyphs and their origins to a file which load() maps back
+		// without rasterizing anything, see atlasFile for its layout. Pages are mapped copy on write,
+		// glyphs added afterwards don't modify the file.
+		// Loading fails when the fonts, their files, their render options, the gamma or the FreeType
+		// version differ from the ones of the saved cache, or while asynchronous glyphs are pending
+		// or glyphs are retained.
+		// Fonts must be loaded in the same order before calling it. The cache is left unchanged on failure.
+		bool save(const char* _filename) const;
+		bool load(const char* _filename);
+
+		// Shares the pages and glyphs with the other processes of the host through a named shared
+		// memory segment, see SharedAtlas. This cache becomes its writer: the glyphs it adds or
+		// removes are published to the segment, which reserves _pageBytes for the pages. Pages created
+		// once it is full stay private. Shared pages are single buffered, setDoubleBuffered() is ignored.
+		bool shareAtlas(const char* _name, size_t _pageBytes, unsigned int _glyphCapacity);
+
+		// Makes this cache a reader of the segment shared by another process, which must have loaded
+		// the same fonts, in the same order, with the same render options and gamma. Lookups then
+		// return the glyphs of the shared pages (see getSharedAtlas()), and missing glyphs aren't added.
+		bool attachSharedAtlas(const char* _name);
+		const SharedAtlas* getSharedAtlas() const { return m_shared.get(); }
+
+		// Font files are memory mapped once per process through the FontRegistry
+		int loadFont(const char* _filename, const RenderOptions& _options = RenderOptions());
+
+		// Applies to the glyphs of the font requested afterwards, glyphs already added keep their options
+		void setRenderOptions(int _fontIndex, const RenderOptions& _options);
+		const RenderOptions& getRenderOptions(int _fontIndex) const { return m_renderOptions[_fontIndex]; }
 
 		enum ReturnCode
 		{
@@ -36,27 +100,201 @@ namespace bmf
 			OK
 		};
 
-		ReturnCode addGlyph(int _fontIndex, int _char, int _pixelSize);
-		ReturnCode removeGlyph(int _fontIndex, int _char, int _pixelSize);
+		// What happens to a glyph for which no page of its format has room left
+		enum class EvictionPolicy
+		{
+			None,			// rejected with NotEnoughSpace
+			Lru,			// least recently used glyphs are removed until it fits
+			GreedyDualSize	// glyphs cheapest to rasterize again per pixel of slot, aged by recency
+		};
+
+		// Glyphs are used when added, and when looked up by getGlyphRect() or getGlyphOrigin(),
+		// or by addGlyph() when already added. Eviction prefers, among the least recently used
+		// glyphs, the oldest one whose slot, merged with its free neighbours, is large enough.
+		// GreedyDualSize ranks glyphs by the priority given at their last use instead: the
+		// measured rasterization time divided by the slot surface, plus the priority of the last
+		// victim, so that glyphs left unused long enough are evicted however costly they are.
+		void setEvictionPolicy(EvictionPolicy _policy) { m_evictionPolicy = _policy; }
+		EvictionPolicy getEvictionPolicy() const { return m_evictionPolicy; }
+		unsigned int getEvictedCount() const { return m_evictedCount; }
+
+		// Frames delimit the glyphs referenced by the vertex buffers in flight: glyphs added or used
+		// during a frame are pinned, and never evicted, until the given number of frames has begun
+		// since, 3 for triple buffering. Glyphs used outside of frames aren't pinned.
+		void beginFrame();
+		void endFrame();
+		unsigned long long getFrame() const { return m_frame; }
+		void setPinnedFrameCount(unsigned int _frameCount) { m_pinnedFrameCount = _frameCount; }
+		unsigned int getPinnedFrameCount() const { return m_pinnedFrameCount; }
+
+		ReturnCode addGlyph(int _fontIndex, int _char, int _pixelSize, GlyphMode _mode = GlyphMode::Default);
+		ReturnCode removeGlyph(int _fontIndex, int _char, int _pixelSize, GlyphMode _mode = GlyphMode::Default);
+
+		// Glyphs identified by glyph index, for text already shaped. They are distinct
+		// atlas entries from the ones added by codepoint.
+		ReturnCode addGlyphByIndex(int _fontIndex, unsigned int _glyphIndex, int _pixelSize, GlyphMode _mode = GlyphMode::Default);
+		ReturnCode removeGlyphByIndex(int _fontIndex, unsigned int _glyphIndex, int _pixelSize, GlyphMode _mode = GlyphMode::Default);
+
+		// Glyph grown by a border of the given width in pixels with FT_Stroker, to be drawn under the
+		// fill glyph for outlined text. It is a distinct atlas entry placed from the same origin as the
+		// fill glyph. Strokes apply to Bitmap and Sdf glyphs of scalable fonts.
+		ReturnCode addStrokedGlyph(int _fontIndex, int _char, int _pixelSize, float _strokeWidth, GlyphMode _mode = GlyphMode::Default);
+
+		// Distance field glyphs are rendered once at the reference size whatever the requested size,
+		// and grown by the spread on each side, which replaces the pool padding.
+		// Glyphs already added keep the parameters they were rendered with.
+		void setSdfParameters(int _referenceSize, int _spread) { m_sdfReferenceSize = _referenceSize; m_sdfSpread = _spread; }
+		int getSdfReferenceSize() const { return m_sdfReferenceSize; }
+		int getSdfSpread() const { return m_sdfSpread; }
+
+		// Applies to the LCD glyphs added afterwards, glyphs already added keep their parameters.
+		// The filter is a setting of the FT_Library: LCD glyphs are rendered with faces of a library
+		// owned by the cache, so that the filter of the library given to the constructor is kept.
+		void setLcdParameters(LcdFilter _filter, SubpixelOrder _order) { m_lcdFilter = _filter; m_subpixelOrder = _order; }
+		LcdFilter getLcdFilter() const { return m_lcdFilter; }
+		SubpixelOrder getSubpixelOrder() const { return m_subpixelOrder; }
+
+		// Gamma applied to the coverage of bitmap glyphs when they are copied to the atlas, 1 disables it.
+		// Glyphs already added keep the gamma they were copied with.
+		void setGamma(float _gamma);
+		float getGamma() const { return m_gamma ? m_gamma->getGamma() : 1.f; }
+
+		// Cached codepoint to glyph index lookup, 0 for missing glyphs
+		unsigned int getGlyphIndex(int _fontIndex, int _char) { return m_charmaps[_fontIndex].getGlyphIndex(_char); }
+		const std::vector<int>& getMissingCodepoints(int _fontIndex) const { return m_charmaps[_fontIndex].getMissingCodepoints(); }
+
+		// Rasterizes the missing glyphs of the batch concurrently when worker threads are enabled,
+		// only the packing into the atlas is done sequentially. Returns the number of glyphs added.
+		unsigned int addGlyphs(const std::vector<GlyphRequest>& _requests, std::vector<ReturnCode>* _results = nullptr);
+
+		struct CodepointRange
+		{
+			CodepointRange(int _first, int _last) : first(_first), last(_last) {}
+
+			int first;
+			int last;	// inclusive
+		};
+
+		struct PrewarmStats
+		{
+			double			totalMs = 0.0;
+			double			rasterizeMs = 0.0;
+			double			packMs = 0.0;
+			unsigned int	glyphsAdded = 0;
+			unsigned int	glyphsMissing = 0;	// no visible glyph in the font
+			unsigned int	glyphsRejected = 0;	// not enough space left
+			unsigned int	pagesFilled = 0;	// pools which received glyphs
+			float			occupancy = 0.f;	// surface of the pools used by glyphs, in [0, 1]
+		};
+
+		// Adds every codepoint of the ranges at every size, meant to be called at startup.
+		// Rasterization runs in parallel, glyphs are then packed largest first.
+		PrewarmStats prewarm(int _fontIndex, const std::vector<CodepointRange>& _ranges, const std::vector<int>& _sizes);
+
+		// Caches unscaled outlines up to the given memory budget, so that glyphs requested at
+		// several sizes are scaled from the cached outline instead of being reloaded from the font.
+		// Bitmap and Sdf glyphs use it only with no load flags, no hinting and no embolden, as cached
+		// outlines are unhinted; Msdf glyphs of scalable fonts always do. 0 disables the cache.
+		void setOutlineCacheBudget(size_t _bytes);
+		const OutlineCache* getOutlineCache() const { return m_outlines.get(); }
+
+		// Caches the downscaled levels of color strikes (see StrikeCache), 0 disables the cache
+		void setStrikeCacheBudget(size_t _bytes);
+		const StrikeCache* getStrikeCache() const { return m_strikes.get(); }
+
+		// 0 disables the workers: glyphs are then rasterized on the caller's thread
+		void setRasterThreadCount(unsigned int _threadCount);
+		unsigned int getRasterThreadCount() const { return m_workers ? m_workers->getThreadCount() : 0; }
+
+		// Asynchronous insertion: the glyph is rasterized in the background and placed into the
+		// atlas by the first commit() following its rasterization. The handle status stays
+		// queryable until the next commit.
+		typedef unsigned int AsyncHandle;
+		enum GlyphStatus
+		{
+			Unknown,
+			Pending,	// being rasterized
+			Rasterized,	// waiting for commit()
+			Resident,
+			Failed
+		};
+
+		AsyncHandle addGlyphAsync(int _fontIndex, int _char, int _pixelSize, GlyphMode _mode = GlyphMode::Default);
+		GlyphStatus getGlyphStatus(AsyncHandle _handle, ReturnCode* _result = nullptr) const;
+		unsigned int getPendingGlyphsCount() const { return m_pendingGlyphs.size(); }
+
+		// To be called at frame boundaries, never blocks on rasterization.
+		// Returns the regions of the image modified by the glyphs placed.
+		std::vector<Rect> commit();
+
+		// Glyph returned by getGlyphRectOrPlaceholder() while the requested one isn't resident
+		ReturnCode setPlaceholderGlyph(int _fontIndex, int _char, int _pixelSize);
+
+		// Rect of the glyph in the image, padding excluded
+		bool getGlyphRect(int _fontIndex, int _char, int _pixelSize, Rect& _rect) const;
+		bool getGlyphRect(const GlyphRequest& _request, Rect& _rect, unsigned int* _pageIndex = nullptr) const;
+		bool getGlyphRectOrPlaceholder(int _fontIndex, int _char, int _pixelSize, Rect& _rect) const;
+
+		// Reference counted glyphs, for users sharing glyphs without knowing when they can be
+		// removed. Retained glyphs are never evicted. Released to 0, a glyph stays resident and
+		// can be retained again, until a glyph needs room in a full page of its format: then all
+		// the released glyphs of the format are reclaimed at once, whatever the eviction policy,
+		// before any other glyph is evicted. The handle is invalid once its glyph is removed.
+		typedef unsigned int GlyphHandle;	// 0 is invalid
+
+		// Adds the glyph if needed
+		GlyphHandle retainGlyph(const GlyphRequest& _request, ReturnCode* _result = nullptr);
+		ReturnCode retainGlyph(GlyphHandle _handle);
+		ReturnCode releaseGlyph(GlyphHandle _handle);
+		unsigned int getGlyphRefCount(GlyphHandle _handle) const;
+		bool getGlyphRect(GlyphHandle _handle, Rect& _rect, unsigned int* _pageIndex = nullptr) const;
+		unsigned int getReclaimedCount() const { return m_reclaimedCount; }
+
+		// Top left corner of the glyph bitmap from the pen position on the baseline, y up, as
+		// bitmap_left and bitmap_top of FreeType. Distance fields are at their reference size.
+		bool getGlyphOrigin(const GlyphRequest& _request, int& _left, int& _top) const;
 
 		unsigned int  getFreeSlotsCount() const
 		{
 			unsigned int count = 0;
 			for (auto& pool : m_pools)
-				count += pool.getFreeSlotsCount();
+				count += pool->getFreeSlotsCount();
 			return count;
 		}
 		unsigned int  getGlyphsCount() const
 		{
 			unsigned int count = 0;
 			for (auto& pool : m_pools)
-				count += pool.getGlyphsCount();
+				count += pool->getGlyphsCount();
 			return count;
 		}
 		unsigned int  getFontCount() const { return m_faces.size(); }
 
 	private:
+		class Pool;
+
 		unsigned int  getPoolIndex() const;
+		void addPool(PageFormat _format);
+		bool isSharedReader() const { return m_shared && !m_shared->isWriter(); }
+		void sharePage(Pool& _pool);
+		void shareGlyph(const Pool& _pool, const GlyphRequest& _request);
+		void shareFonts();
+		void prepareRequest(GlyphRequest& _request) const;
+		bool resolveGlyphIndex(GlyphRequest& _request);
+		bool findGlyph(const GlyphRequest& _request);
+		ReturnCode addGlyph(GlyphRequest& _request);
+		ReturnCode removeGlyph(GlyphRequest _request);
+		ReturnCode addSdfGlyph(const GlyphRequest& _request);
+		// _rasterizeMs, the time taken to rasterize the glyph, is its cost for GreedyDualSize
+		ReturnCode allocateGlyph(PageFormat _format, unsigned int _width, unsigned int _rows, const GlyphRequest& _request, Pool*& _pool, Rect& _glyphRect, Rect* _slotRect = nullptr, float _rasterizeMs = 0.f);
+		ReturnCode insertGlyph(const GlyphBitmap& _bitmap, const GlyphRequest& _request, Rect* _glyphRect = nullptr, float _rasterizeMs = 0.f);
+		RasterWorkerPool& getWorkers();
+		// Face rasterizing the request, nullptr if it can't be created
+		FT_Face getRasterFace(const GlyphRequest& _request);
+		// On the calling thread, for caches without workers or jobs skipped by a worker
+		void rasterizeJob(RasterWorkerPool::Job& _job);
+		void rasterizeBatch(const std::vector<GlyphRequest>& _requests, std::vector<ReturnCode>* _results, std::vector<RasterWorkerPool::JobPtr>& _jobs, std::vector<size_t>& _jobRequests);
+		unsigned int packBatch(const std::vector<RasterWorkerPool::JobPtr>& _jobs, const std::vector<size_t>& _jobRequests, std::vector<ReturnCode>* _results, bool _largestFirst);
 
 		class Pool
 		{
@@ -64,16 +302,29 @@ namespace bmf
 			class Key
 			{
 			public:
-				Key(int _fontIndex, int _unicodeChar, int _pixelSize) : fontIndex(_fontIndex), unicodeChar(_unicodeChar), pixelSize(_pixelSize){}
+				explicit Key(const GlyphRequest& _request) : fontIndex(_request.fontIndex), unicodeChar(_request.unicodeChar), pixelSize(_request.pixelSize),
+					byGlyphIndex(_request.byGlyphIndex), mode(_request.mode), spread(_request.spread), lcdFilter(_request.lcdFilter), subpixelOrder(_request.subpixelOrder),
+					options(_request.options), strokeWidth(_request.strokeWidth) {}
 				bool Key::operator <(const Key& b) const
 				{
-					return fontIndex == b.fontIndex ? (unicodeChar == b.unicodeChar ? (pixelSize < b.pixelSize) : unicodeChar < b.unicodeChar) : fontIndex < b.fontIndex;
+					return std::tie(fontIndex, unicodeChar, pixelSize, byGlyphIndex, mode, spread, lcdFilter, subpixelOrder, options, strokeWidth)
+						< std::tie(b.fontIndex, b.unicodeChar, b.pixelSize, b.byGlyphIndex, b.mode, b.spread, b.lcdFilter, b.subpixelOrder, b.options, b.strokeWidth);
 				}
 
+				GlyphMode getMode() const { return mode; }
+				GlyphRequest getRequest() const;
+
 			private:
 				int fontIndex;
 				int unicodeChar;
 				int pixelSize;
+				bool byGlyphIndex;
+				GlyphMode mode;
+				int spread;
+				LcdFilter lcdFilter;
+				SubpixelOrder subpixelOrder;
+				RenderOptions options;
+				float strokeWidth;
 			};
 
 			class Slot
@@ -151,6 +402,26 @@ namespace bmf
 
 				const Rect& getRect() const { return m_rect; }
 
+				// Free slot left by freeing this one, once merged with its free neighbours by setAsFree()
+				const Rect& getFreedRect() const
+				{
+					const Slot* slot = this;
+					while (slot->m_owner)
+					{
+						const Slot* sibling = slot->m_owner->m_slot1 == slot ? slot->m_owner->m_slot2 : slot->m_owner->m_slot1;
+						if (sibling->m_state != State::Free)
+							break;
+						slot = slot->m_owner;
+					}
+					return slot->m_rect;
+				}
+				const Slot* getChild(int _index) const { return _index == 0 ? m_slot1 : m_slot2; }
+				Slot* getChild(int _index) { return _index == 0 ? m_slot1 : m_slot2; }
+
+				// Rebuilds a saved tree, see Pool::restore()
+				void restoreDivision(bool _byWidth, int _size) { _byWidth ? divideByWidth(_size) : divideByHeight(_size); }
+				void restoreOccupied() { assert(m_state == State::Free); m_state = State::Occupied; }
+
 				enum State
 				{
 					Free,
@@ -196,8 +467,9 @@ namespace bmf
 				State m_state = State::Free;
 			};
 
-			void init(const Rect &_initRect, int _paddingX, int _paddingY)
+			void init(PageFormat _format, const Rect &_initRect, int _paddingX, int _paddingY, bool _largePages)
 			{
+				m_page.reset(new AtlasPage(_format, _initRect.width(), _initRect.height(), _largePages));
 				m_paddingX = _paddingX;
 				m_paddingY = _paddingY;
 				Rect initRect(_initRect.left() + m_paddingX, _initRect.top() + m_paddingY, _initRect.width() - m_paddingX, _initRect.height() - m_paddingY);
@@ -212,33 +484,130 @@ namespace bmf
 					delete m_rootSlot;
 			}
 
+			AtlasPage& getPage() { return *m_page; }
+			const AtlasPage& getPage() const { return *m_page; }
 			const std::list<Slot*> &getFreeSlots() const { return m_freeSlots; }
 			int  getFreeSlotsCount() const { return m_freeSlots.size(); }
 
-			const std::map<Key, Slot *>& getGlyphs() const { return m_glyphs; }
+			struct Glyph
+			{
+				Slot*	slot;
+				Rect	rect;	// bitmap area in the image, padding excluded
+				int		left = 0;	// origin, see getGlyphOrigin()
+				int		top = 0;
+				mutable unsigned long long	lastUse = 0;	// see touch()
+				mutable unsigned long long	frame = 0;	// of the last use during a frame, 0 if none
+				mutable double	priority = 0.;	// for GreedyDualSize, see touch()
+				float			rasterizeMs = 0.f;	// 0 for glyphs loaded from a file
+				unsigned int	refCount = 0;
+				GlyphHandle		handle = 0;	// once retained
+			};
+
+			const std::map<Key, Glyph>& getGlyphs() const { return m_glyphs; }
 			int  getGlyphsCount() const { return m_glyphs.size(); }
+			unsigned int getOccupiedSurface() const;
 
 			Slot *findBestSlotForRect(const Rect &_glyph);
+			// Slot needed by a glyph bitmap, padding included
+			Rect getSlotSize(unsigned int _width, unsigned int _rows, GlyphMode _mode) const;
+			const Rect& getRootRect() const { return m_rootSlot->getRect(); }
+
+			// Index of the page in the SharedAtlas, -1 when private
+			int  getSharedPage() const { return m_sharedPage; }
+			void setSharedPage(int _index) { m_sharedPage = _index; }
 
 			int  getPaddingX() const { return m_paddingX; }
 			int  getPaddingY() const { return m_paddingY; }
 
-			bool findGlyph(int _fontIndex, int _char, int _pixelSize);
-			ReturnCode addGlyph(const BitmapFontCache* _owner, FT_Bitmap& _bitmap, int _fontIndex, int _char, int _pixelSize);
-			ReturnCode removeGlyph(int _fontIndex, int _char, int _pixelSize);
+			bool findGlyph(const Key& _key);
+			const Glyph* getGlyph(const Key& _key) const;
+			Glyph* getGlyph(const Key& _key);
+			ReturnCode allocateGlyph(unsigned int _width, unsigned int _rows, const Key& _key, Rect* _glyphRect = nullptr, Rect* _slotRect = nullptr);
+			ReturnCode removeGlyph(const Key& _key);
+			void setGlyphOrigin(const Key& _key, int _left, int _top);
+
+			// Slot tree in preorder, free slots as indices in that order and glyphs
+			void save(std::vector<atlasFile::SlotRecord>& _slots, std::vector<uint32_t>& _freeSlots, std::vector<atlasFile::GlyphRecord>& _glyphs) const;
+			// Replaces init(), the page is left blank. Returns false for inconsistent records.
+			bool restore(PageFormat _format, int _width, int _height, int _paddingX, int _paddingY, bool _largePages, const std::vector<atlasFile::SlotRecord>& _slots,
+				const std::vector<uint32_t>& _freeSlots, const std::vector<atlasFile::GlyphRecord>& _glyphs);
 
 		private:
+			bool restoreSlot(Slot* _slot, const std::vector<atlasFile::SlotRecord>& _slots, size_t& _next, std::vector<Slot*>& _nodes);
+
+			std::unique_ptr<AtlasPage>	m_page;
 			Slot*					m_rootSlot = nullptr;
 			std::list<Slot*>		m_freeSlots;
-			std::map<Key, Slot *>	m_glyphs;
+			std::map<Key, Glyph>	m_glyphs;
 			int						m_paddingX = 2;
 			int						m_paddingY = 2;
+			int						m_sharedPage = -1;
 		};
 
-		Pool					m_pools[POOL_COUNT];
+		void removeGlyph(Pool& _pool, const Pool::Key& _key);
+		ReturnCode allocateInPools(PageFormat _format, unsigned int _width, unsigned int _rows, const Pool::Key& _key, Pool*& _pool, Rect& _glyphRect, Rect* _slotRect);
+		bool evictGlyph(PageFormat _format, unsigned int _width, unsigned int _rows, const Pool::Key& _key);
+		unsigned int reclaimReleasedGlyphs(PageFormat _format);
+		const Pool::Glyph* getGlyph(GlyphHandle _handle, Pool** _pool = nullptr) const;
+		Pool::Glyph* getGlyph(GlyphHandle _handle);
+		void touch(const Pool::Glyph& _glyph) const
+		{
+			_glyph.lastUse = ++m_useClock;
+			_glyph.priority = m_inflation + _glyph.rasterizeMs / std::max(_glyph.slot->getRect().surface(), 1u);
+			if (m_inFrame)
+				_glyph.frame = m_frame;
+		}
+		bool isPinned(const Pool::Glyph& _glyph) const { return _glyph.frame != 0 && _glyph.frame + m_pinnedFrameCount > m_frame; }
+
+		std::vector<std::unique_ptr<Pool>>	m_pools;
 		std::vector<FT_Face>	m_faces;
-		unsigned char*			m_image = nullptr;
+		std::vector<FontDataPtr> m_fontData;
+		std::vector<CharmapCache> m_charmaps;
+		std::vector<RenderOptions> m_renderOptions;
 		FT_Library			    m_library = nullptr;
+		FT_Library				m_lcdLibrary = nullptr;	// see setLcdParameters()
+		std::vector<FT_Face>	m_lcdFaces;
+		std::unique_ptr<RasterWorkerPool> m_workers;
+		std::shared_ptr<OutlineCache> m_outlines;
+		std::shared_ptr<StrikeCache> m_strikes = std::make_shared<StrikeCache>(8 * 1024 * 1024);
+		std::unique_ptr<GammaTable> m_gamma;
+		std::unique_ptr<SharedAtlas> m_shared;
+
+		struct AsyncGlyph
+		{
+			RasterWorkerPool::JobPtr	job;
+			GlyphStatus					status = Pending;
+			ReturnCode					result = NotFound;
+		};
+		std::map<AsyncHandle, AsyncGlyph>	m_asyncGlyphs;
+		std::map<Pool::Key, AsyncHandle>	m_pendingGlyphs;
+		std::vector<AsyncHandle>			m_resolvedHandles;	// released by the next commit
+		AsyncHandle							m_nextAsyncHandle = 1;
+		GlyphRequest						m_placeholder = GlyphRequest(-1, 0, 0);
+
+		struct RetainedGlyph
+		{
+			Pool*		pool;
+			Pool::Key	key;
+		};
+		std::map<GlyphHandle, RetainedGlyph>	m_retainedGlyphs;
+		GlyphHandle								m_nextGlyphHandle = 1;
+		unsigned int							m_reclaimedCount = 0;
+
+		int						m_sdfReferenceSize = 32;
+		int						m_sdfSpread = 4;
+		LcdFilter				m_lcdFilter = LcdFilter::Default;
+		SubpixelOrder			m_subpixelOrder = SubpixelOrder::Rgb;
+		bool					m_doubleBuffered = false;
+		bool					m_largePages = false;
+		PageLayout				m_pageLayout = PageLayout::Linear;
+		EvictionPolicy			m_evictionPolicy = EvictionPolicy::None;
+		unsigned int			m_evictedCount = 0;
+		mutable unsigned long long m_useClock = 0;
+		double					m_inflation = 0.;	// priority of the last glyph evicted by GreedyDualSize
+		unsigned long long		m_frame = 0;
+		unsigned int			m_pinnedFrameCount = 3;
+		bool					m_inFrame = false;
 	};
 }
 
@@ -3,9 +3,20 @@
 
 #include "catch.hpp"
 #include <vector>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <cmath>
+#include <random>
+#include <set>
+#include <string>
 
 #include <ft2build.h>
 #include <freetype/freetype.h>
+#include <freetype/ftlcdfil.h>
 
 #define DISPLAY_RESULT bitmapCache.showImage();
 
@@ -118,6 +129,1076 @@ namespace bmf
 			REQUIRE(bitmapCache.getFreeSlotsCount() == POOL_COUNT);
 		}
 
+		SECTION("Batches rasterized by the workers are packed like sequential ones")
+		{
+			BitmapFontCache serialCache(library);
+			BitmapFontCache parallelCache(library);
+			parallelCache.setRasterThreadCount(4);
+			REQUIRE(parallelCache.getRasterThreadCount() == 4);
+			for (BitmapFontCache* cache : { &serialCache, &parallelCache })
+			{
+				cache->loadFont("C:/windows/fonts/arial.ttf");
+				cache->loadFont("C:/windows/fonts/verdana.ttf");
+			}
+
+			std::vector<GlyphRequest> requests;
+			for (int n = 0; n < 255; n++)
+				requests.push_back(GlyphRequest(n % 2, n, 12 + n % 30));
+			requests.push_back(GlyphRequest(0, 'a', 18));
+			requests.push_back(GlyphRequest(0, 'a', 18));
+
+			std::vector<BitmapFontCache::ReturnCode> serialResults, parallelResults;
+			unsigned int serialAdded = serialCache.addGlyphs(requests, &serialResults);
+			unsigned int parallelAdded = parallelCache.addGlyphs(requests, &parallelResults);
+
+			REQUIRE(serialAdded > 0);
+			REQUIRE(serialAdded == parallelAdded);
+			REQUIRE(serialResults == parallelResults);
+			REQUIRE(parallelResults.back() == BitmapFontCache::AlreadyAdded);
+			REQUIRE(parallelCache.getGlyphsCount() == serialCache.getGlyphsCount());
+			REQUIRE(parallelCache.getFreeSlotsCount() == serialCache.getFreeSlotsCount());
+			REQUIRE(parallelCache.addGlyph(0, 'a', 18) == BitmapFontCache::AlreadyAdded);
+
+			// Fonts loaded after the workers started are visible to them
+			parallelCache.loadFont("C:/windows/fonts/times.ttf");
+			REQUIRE(parallelCache.addGlyphs({ GlyphRequest(2, 'a', 18) }) == 1);
+		}
+
+		SECTION("Asynchronous glyphs land in the atlas on commit")
+		{
+			BitmapFontCache bitmapCache(library);
+			bitmapCache.loadFont("C:/windows/fonts/arial.ttf");
+			REQUIRE(bitmapCache.setPlaceholderGlyph(0, '?', 18) == BitmapFontCache::OK);
+
+			Rect placeholderRect, rect;
+			REQUIRE(bitmapCache.getGlyphRect(0, '?', 18, placeholderRect));
+			REQUIRE(!bitmapCache.getGlyphRect(0, 'a', 18, rect));
+
+			BitmapFontCache::AsyncHandle handle = bitmapCache.addGlyphAsync(0, 'a', 18);
+			REQUIRE(bitmapCache.addGlyphAsync(0, 'a', 18) == handle);
+			BitmapFontCache::AsyncHandle missingHandle = bitmapCache.addGlyphAsync(0, ' ', 18);
+			BitmapFontCache::AsyncHandle residentHandle = bitmapCache.addGlyphAsync(0, '?', 18);
+			REQUIRE(bitmapCache.getGlyphStatus(residentHandle) == BitmapFontCache::Resident);
+			REQUIRE(bitmapCache.getPendingGlyphsCount() == 2);
+
+			// Until committed, lookups fall back to the placeholder
+			REQUIRE(bitmapCache.getGlyphRectOrPlaceholder(0, 'a', 18, rect));
+			REQUIRE(rect.left() == placeholderRect.left());
+			REQUIRE(rect.top() == placeholderRect.top());
+
+			while (bitmapCache.getGlyphStatus(handle) == BitmapFontCache::Pending || bitmapCache.getGlyphStatus(missingHandle) == BitmapFontCache::Pending)
+				std::this_thread::yield();
+			REQUIRE(bitmapCache.getGlyphStatus(handle) == BitmapFontCache::Rasterized);
+			REQUIRE(bitmapCache.getGlyphsCount() == 1);
+
+			std::vector<Rect> dirtyRects = bitmapCache.commit();
+			REQUIRE(dirtyRects.size() == 1);
+			REQUIRE(bitmapCache.getGlyphsCount() == 2);
+			REQUIRE(bitmapCache.getPendingGlyphsCount() == 0);
+
+			BitmapFontCache::ReturnCode result;
+			REQUIRE(bitmapCache.getGlyphStatus(handle, &result) == BitmapFontCache::Resident);
+			REQUIRE(result == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getGlyphStatus(missingHandle, &result) == BitmapFontCache::Failed);
+			REQUIRE(result == BitmapFontCache::NotFound);
+
+			REQUIRE(bitmapCache.getGlyphRectOrPlaceholder(0, 'a', 18, rect));
+			REQUIRE(rect.left() == dirtyRects[0].left());
+			REQUIRE(rect.top() == dirtyRects[0].top());
+			REQUIRE(rect.width() == dirtyRects[0].width());
+
+			// Handles are forgotten one commit after they were resolved
+			REQUIRE(bitmapCache.commit().empty());
+			REQUIRE(bitmapCache.getGlyphStatus(handle) == BitmapFontCache::Unknown);
+
+			// Glyphs added synchronously while pending are inserted once
+			BitmapFontCache::AsyncHandle syncHandle = bitmapCache.addGlyphAsync(0, 'b', 18);
+			REQUIRE(bitmapCache.addGlyph(0, 'b', 18) == BitmapFontCache::OK);
+			while (bitmapCache.getGlyphStatus(syncHandle) == BitmapFontCache::Pending)
+				std::this_thread::yield();
+			REQUIRE(bitmapCache.commit().empty());
+			REQUIRE(bitmapCache.getGlyphStatus(syncHandle, &result) == BitmapFontCache::Resident);
+			REQUIRE(result == BitmapFontCache::AlreadyAdded);
+			REQUIRE(bitmapCache.getGlyphsCount() == 3);
+			REQUIRE(bitmapCache.removeGlyph(0, 'b', 18) == BitmapFontCache::OK);
+			REQUIRE(!bitmapCache.getGlyphRect(0, 'b', 18, rect));
+			REQUIRE(bitmapCache.getGlyphsCount() == 2);
+		}
+
+		SECTION("Prewarm codepoint ranges at several sizes")
+		{
+			BitmapFontCache bitmapCache(library);
+			bitmapCache.loadFont("C:/windows/fonts/arial.ttf");
+
+			std::vector<BitmapFontCache::CodepointRange> latin1 = { BitmapFontCache::CodepointRange(0x20, 0x7E), BitmapFontCache::CodepointRange(0xA0, 0xFF) };
+			BitmapFontCache::PrewarmStats stats = bitmapCache.prewarm(0, latin1, { 12, 14, 18, 24 });
+
+			REQUIRE(stats.glyphsAdded > 0);
+			REQUIRE(stats.glyphsAdded == bitmapCache.getGlyphsCount());
+			REQUIRE(stats.glyphsAdded + stats.glyphsMissing + stats.glyphsRejected == 4 * (95 + 96));
+			REQUIRE(stats.glyphsRejected == 0);
+			REQUIRE(stats.pagesFilled == 1);
+			REQUIRE(stats.occupancy > 0.f);
+			REQUIRE(stats.occupancy < 1.f);
+			REQUIRE(stats.totalMs >= stats.rasterizeMs);
+			REQUIRE(bitmapCache.getRasterThreadCount() == 0);
+			REQUIRE(bitmapCache.addGlyph(0, 'a', 14) == BitmapFontCache::AlreadyAdded);
+
+			// Already resident glyphs aren't counted again
+			stats = bitmapCache.prewarm(0, latin1, { 12 });
+			REQUIRE(stats.glyphsAdded == 0);
+			REQUIRE(stats.pagesFilled == 0);
+		}
+
+		SECTION("Glyphs can be added by glyph index")
+		{
+			BitmapFontCache bitmapCache(library);
+			bitmapCache.setRasterThreadCount(2);
+			bitmapCache.loadFont("C:/windows/fonts/arial.ttf");
+
+			unsigned int glyphIndex = bitmapCache.getGlyphIndex(0, 'a');
+			REQUIRE(glyphIndex != 0);
+			REQUIRE(bitmapCache.getGlyphIndex(0, 0x10FFFD) == 0);
+			REQUIRE(bitmapCache.getMissingCodepoints(0).size() == 1);
+
+			// Index keys are independent from codepoint keys
+			REQUIRE(bitmapCache.addGlyph(0, 'a', 18) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.addGlyphByIndex(0, glyphIndex, 18) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.addGlyphByIndex(0, glyphIndex, 18) == BitmapFontCache::AlreadyAdded);
+			REQUIRE(bitmapCache.getGlyphsCount() == 2);
+
+			Rect byChar, byIndex;
+			REQUIRE(bitmapCache.getGlyphRect(0, 'a', 18, byChar));
+			REQUIRE(bitmapCache.getGlyphRect(GlyphRequest::fromGlyphIndex(0, glyphIndex, 18), byIndex));
+			REQUIRE(byChar.width() == byIndex.width());
+			REQUIRE(byChar.height() == byIndex.height());
+
+			// Missing codepoints are reported instead of rendering the .notdef glyph
+			REQUIRE(bitmapCache.addGlyph(0, 0x10FFFD, 18) == BitmapFontCache::NotFound);
+			REQUIRE(bitmapCache.addGlyphByIndex(0, 0xFFFFFF, 18) == BitmapFontCache::NotFound);
+
+			std::vector<BitmapFontCache::ReturnCode> results;
+			bitmapCache.addGlyphs({ GlyphRequest::fromGlyphIndex(0, glyphIndex, 24), GlyphRequest(0, 0x10FFFD, 24) }, &results);
+			REQUIRE(results[0] == BitmapFontCache::OK);
+			REQUIRE(results[1] == BitmapFontCache::NotFound);
+
+			REQUIRE(bitmapCache.removeGlyphByIndex(0, glyphIndex, 18) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.removeGlyph(0, 'a', 18) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getGlyphsCount() == 1);
+		}
+
+		SECTION("Distance field glyphs are shared by every size")
+		{
+			BitmapFontCache bitmapCache(library);
+			bitmapCache.loadFont("C:/windows/fonts/arial.ttf");
+			bitmapCache.setSdfParameters(32, 4);
+
+			REQUIRE(bitmapCache.addGlyph(0, 'o', 12, GlyphMode::Sdf) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.addGlyph(0, 'o', 96, GlyphMode::Sdf) == BitmapFontCache::AlreadyAdded);
+			REQUIRE(bitmapCache.addGlyph(0, 'o', 12) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getGlyphsCount() == 2);
+
+			Rect sdfRect, bitmapRect;
+			REQUIRE(bitmapCache.getGlyphRect(GlyphRequest(0, 'o', 24, GlyphMode::Sdf), sdfRect));
+			REQUIRE(bitmapCache.addGlyph(0, 'o', 32) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getGlyphRect(0, 'o', 32, bitmapRect));
+			REQUIRE(sdfRect.width() == bitmapRect.width() + 2 * 4);
+			REQUIRE(sdfRect.height() == bitmapRect.height() + 2 * 4);
+
+			// The spread replaces the padding: the border is as far as possible from the glyph
+			const unsigned char* image = bitmapCache.getImage();
+			const int width = BitmapFontCache::getImageWidth();
+			REQUIRE(image[sdfRect.left() + sdfRect.top() * width] <= 1);
+			REQUIRE(image[sdfRect.right() - 1 + (sdfRect.bottom() - 1) * width] <= 1);
+
+			// The middle of the left stroke of the 'o' is inside, its hole is outside
+			int middleY = sdfRect.top() + sdfRect.height() / 2;
+			unsigned char strokeMax = 0;
+			for (int x = sdfRect.left(); x < sdfRect.left() + static_cast<int>(sdfRect.width()) / 3; x++)
+				strokeMax = std::max(strokeMax, image[x + middleY * width]);
+			REQUIRE(strokeMax > 128);
+			REQUIRE(image[sdfRect.left() + sdfRect.width() / 2 + middleY * width] < 128);
+
+			REQUIRE(bitmapCache.removeGlyph(0, 'o', 18, GlyphMode::Sdf) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getGlyphsCount() == 2);
+
+			// Other parameters make new entries
+			bitmapCache.setSdfParameters(48, 6);
+			REQUIRE(bitmapCache.addGlyph(0, 'o', 12, GlyphMode::Sdf) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getGlyphRect(GlyphRequest(0, 'o', 12, GlyphMode::Sdf), sdfRect));
+			REQUIRE(sdfRect.width() > bitmapRect.width() + 2 * 6);
+		}
+
+		SECTION("LCD glyphs pack their subpixels into RGB pages")
+		{
+			BitmapFontCache bitmapCache(library);
+			bitmapCache.loadFont("C:/windows/fonts/arial.ttf");
+			REQUIRE(bitmapCache.getLcdFilter() == LcdFilter::Default);
+
+			Rect grayRect, lcdRect, lcdVRect;
+			unsigned int lcdPage = 0, lcdVPage = 0;
+			REQUIRE(bitmapCache.addGlyph(0, 'o', 24) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.addGlyph(0, 'o', 24, GlyphMode::Lcd) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.addGlyph(0, 'o', 24, GlyphMode::LcdV) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getGlyphRect(0, 'o', 24, grayRect));
+			REQUIRE(bitmapCache.getGlyphRect(GlyphRequest(0, 'o', 24, GlyphMode::Lcd), lcdRect, &lcdPage));
+			REQUIRE(bitmapCache.getGlyphRect(GlyphRequest(0, 'o', 24, GlyphMode::LcdV), lcdVRect, &lcdVPage));
+			REQUIRE(lcdPage == lcdVPage);
+			const AtlasPage& page = bitmapCache.getPage(lcdPage);
+			REQUIRE(page.getFormat() == PageFormat::Rgb8);
+
+			// One pixel per 3 subpixels, plus the margins of the filter
+			REQUIRE(lcdRect.width() >= grayRect.width());
+			REQUIRE(lcdRect.width() <= grayRect.width() + 3);
+			REQUIRE(lcdRect.height() == grayRect.height());
+			REQUIRE(lcdVRect.width() == grayRect.width());
+			REQUIRE(lcdVRect.height() <= grayRect.height() + 3);
+
+			// Subpixels on the edges of the strokes are partially covered
+			bool channelsDiffer = false;
+			for (int y = lcdRect.top(); y < lcdRect.bottom(); y++)
+			{
+				for (int x = lcdRect.left(); x < lcdRect.right(); x++)
+				{
+					const unsigned char* p = page.getData() + x * 3 + y * page.getPitch();
+					channelsDiffer |= p[0] != p[1] || p[1] != p[2];
+				}
+			}
+			REQUIRE(channelsDiffer);
+
+			// Other subpixel orders make new entries with swapped channels
+			bitmapCache.setLcdParameters(LcdFilter::Default, SubpixelOrder::Bgr);
+			Rect bgrRect;
+			REQUIRE(bitmapCache.addGlyph(0, 'o', 24, GlyphMode::Lcd) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getGlyphRect(GlyphRequest(0, 'o', 24, GlyphMode::Lcd), bgrRect));
+			for (int y = 0; y < static_cast<int>(lcdRect.height()); y++)
+			{
+				for (int x = 0; x < static_cast<int>(lcdRect.width()); x++)
+				{
+					const unsigned char* rgb = page.getData() + (lcdRect.left() + x) * 3 + (lcdRect.top() + y) * page.getPitch();
+					const unsigned char* bgr = page.getData() + (bgrRect.left() + x) * 3 + (bgrRect.top() + y) * page.getPitch();
+					REQUIRE(rgb[0] == bgr[2]);
+					REQUIRE(rgb[2] == bgr[0]);
+				}
+			}
+
+			// The LCD filter of the library of the application is left untouched
+			FT_Face face;
+			REQUIRE(FT_New_Face(library, "C:/windows/fonts/arial.ttf", 0, &face) == 0);
+			REQUIRE(FT_Set_Pixel_Sizes(face, 0, 24) == 0);
+			auto renderLcd = [&face]()
+			{
+				REQUIRE(FT_Load_Char(face, 'e', FT_LOAD_TARGET_LCD) == 0);
+				REQUIRE(FT_Render_Glyph(face->glyph, FT_RENDER_MODE_LCD) == 0);
+				const FT_Bitmap& bitmap = face->glyph->bitmap;
+				std::vector<unsigned char> pixels;
+				for (unsigned int y = 0; y < bitmap.rows; y++)
+					pixels.insert(pixels.end(), bitmap.buffer + y * bitmap.pitch, bitmap.buffer + y * bitmap.pitch + bitmap.width);
+				return pixels;
+			};
+			FT_Library_SetLcdFilter(library, FT_LCD_FILTER_NONE);
+			const std::vector<unsigned char> unfiltered = renderLcd();
+			bitmapCache.setLcdParameters(LcdFilter::Light, SubpixelOrder::Rgb);
+			REQUIRE(bitmapCache.addGlyph(0, 'e', 24, GlyphMode::Lcd) == BitmapFontCache::OK);
+			REQUIRE(renderLcd() == unfiltered);
+			FT_Done_Face(face);
+		}
+
+		SECTION("Color glyphs go to BGRA pages")
+		{
+			BitmapFontCache bitmapCache(library);
+			bitmapCache.loadFont("C:/windows/fonts/arial.ttf");
+			REQUIRE(bitmapCache.getStrikeCache() != nullptr);
+
+			// Glyphs without colors are stored as premultiplied white
+			Rect rect;
+			unsigned int pageIndex = 0;
+			REQUIRE(bitmapCache.addGlyph(0, 'o', 24, GlyphMode::Color) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getGlyphRect(GlyphRequest(0, 'o', 24, GlyphMode::Color), rect, &pageIndex));
+			const AtlasPage& page = bitmapCache.getPage(pageIndex);
+			REQUIRE(page.getFormat() == PageFormat::Bgra8);
+			REQUIRE(page.getPitch() == page.getWidth() * 4);
+
+			unsigned int alphaSum = 0;
+			for (int y = rect.top(); y < rect.bottom(); y++)
+			{
+				for (int x = rect.left(); x < rect.right(); x++)
+				{
+					const unsigned char* p = page.getData() + x * 4 + y * page.getPitch();
+					REQUIRE(p[0] == p[3]);
+					REQUIRE(p[2] == p[3]);
+					alphaSum += p[3];
+				}
+			}
+			REQUIRE(alphaSum > 0);
+		}
+
+		SECTION("Monochrome glyphs are bit packed")
+		{
+			BitmapFontCache bitmapCache(library);
+			bitmapCache.loadFont("C:/windows/fonts/arial.ttf");
+
+			Rect rect;
+			unsigned int pageIndex = 0;
+			REQUIRE(bitmapCache.addGlyph(0, 'g', 16, GlyphMode::Mono) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.addGlyph(0, 'h', 16, GlyphMode::Mono) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getGlyphRect(GlyphRequest(0, 'h', 16, GlyphMode::Mono), rect, &pageIndex));
+			const AtlasPage& page = bitmapCache.getPage(pageIndex);
+			REQUIRE(page.getFormat() == PageFormat::Mono1);
+			REQUIRE(page.getPitch() == page.getWidth() / 8);
+
+			// Same pixels as the FreeType monochrome rendering
+			FT_Face face;
+			REQUIRE(FT_New_Face(library, "C:/windows/fonts/arial.ttf", 0, &face) == 0);
+			FT_Set_Pixel_Sizes(face, 0, 16);
+			REQUIRE(FT_Load_Char(face, 'h', FT_LOAD_RENDER | FT_LOAD_TARGET_MONO) == 0);
+			const FT_Bitmap& bitmap = face->glyph->bitmap;
+			REQUIRE(rect.width() == bitmap.width);
+			REQUIRE(rect.height() == bitmap.rows);
+
+			std::vector<unsigned char> expanded(rect.width() * rect.height());
+			blitBitmap(BitmapView(page, rect), expanded.data(), rect.width(), PageFormat::Gray8);
+			for (unsigned int y = 0; y < bitmap.rows; y++)
+			{
+				for (unsigned int x = 0; x < bitmap.width; x++)
+				{
+					bool set = (bitmap.buffer[y * bitmap.pitch + x / 8] >> (7 - x % 8)) & 1;
+					REQUIRE(expanded[x + y * rect.width()] == (set ? 255 : 0));
+				}
+			}
+			FT_Done_Face(face);
+		}
+
+		SECTION("Gamma brightens bitmap glyphs only")
+		{
+			BitmapFontCache linearCache(library), gammaCache(library);
+			linearCache.loadFont("C:/windows/fonts/arial.ttf");
+			gammaCache.loadFont("C:/windows/fonts/arial.ttf");
+			gammaCache.setGamma(2.2f);
+			REQUIRE(gammaCache.getGamma() == 2.2f);
+
+			auto sum = [](const BitmapFontCache& _cache, const GlyphRequest& _request)
+			{
+				Rect rect;
+				REQUIRE(_cache.getGlyphRect(_request, rect));
+				unsigned int total = 0;
+				for (int y = rect.top(); y < rect.bottom(); y++)
+					for (int x = rect.left(); x < rect.right(); x++)
+						total += _cache.getImage()[x + y * BitmapFontCache::getImageWidth()];
+				return total;
+			};
+
+			for (BitmapFontCache* cache : { &linearCache, &gammaCache })
+			{
+				REQUIRE(cache->addGlyph(0, 'o', 24) == BitmapFontCache::OK);
+				REQUIRE(cache->addGlyph(0, 'o', 24, GlyphMode::Sdf) == BitmapFontCache::OK);
+			}
+			REQUIRE(sum(gammaCache, GlyphRequest(0, 'o', 24)) > sum(linearCache, GlyphRequest(0, 'o', 24)));
+			REQUIRE(sum(gammaCache, GlyphRequest(0, 'o', 24, GlyphMode::Sdf)) == sum(linearCache, GlyphRequest(0, 'o', 24, GlyphMode::Sdf)));
+		}
+
+		SECTION("Render options are part of the glyph key")
+		{
+			RenderOptions unhinted;
+			unhinted.hinting = Hinting::None;
+			BitmapFontCache bitmapCache(library);
+			REQUIRE(bitmapCache.loadFont("C:/windows/fonts/verdana.ttf", unhinted) == 0);
+			REQUIRE(bitmapCache.getRenderOptions(0).hinting == Hinting::None);
+
+			// Same pixels as FreeType without hinting
+			Rect rect;
+			REQUIRE(bitmapCache.addGlyph(0, 'w', 13) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getGlyphRect(0, 'w', 13, rect));
+			FT_Face face;
+			REQUIRE(FT_New_Face(library, "C:/windows/fonts/verdana.ttf", 0, &face) == 0);
+			FT_Set_Pixel_Sizes(face, 0, 13);
+			REQUIRE(FT_Load_Char(face, 'w', FT_LOAD_RENDER | FT_LOAD_NO_HINTING) == 0);
+			const FT_Bitmap& bitmap = face->glyph->bitmap;
+			REQUIRE(rect.width() == bitmap.width);
+			REQUIRE(rect.height() == bitmap.rows);
+			for (unsigned int y = 0; y < bitmap.rows; y++)
+				for (unsigned int x = 0; x < bitmap.width; x++)
+					REQUIRE(bitmapCache.getImage()[rect.left() + x + (rect.top() + y) * BitmapFontCache::getImageWidth()] == bitmap.buffer[y * bitmap.pitch + x]);
+			FT_Done_Face(face);
+
+			// Variants with other options live next to it
+			RenderOptions bold = unhinted;
+			bold.embolden = true;
+			bitmapCache.setRenderOptions(0, bold);
+			REQUIRE(!bitmapCache.getGlyphRect(0, 'w', 13, rect));
+			REQUIRE(bitmapCache.addGlyph(0, 'w', 13) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getGlyphsCount() == 2);
+			Rect boldRect;
+			REQUIRE(bitmapCache.getGlyphRect(0, 'w', 13, boldRect));
+			REQUIRE(boldRect.width() > rect.width());
+			REQUIRE(bitmapCache.addGlyph(0, 'w', 13) == BitmapFontCache::AlreadyAdded);
+
+			// The render mode of the font applies to glyphs requested without a mode
+			RenderOptions mono;
+			mono.renderMode = GlyphMode::Mono;
+			bitmapCache.setRenderOptions(0, mono);
+			unsigned int pageIndex = 0;
+			REQUIRE(bitmapCache.addGlyph(0, 'w', 13) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getGlyphRect(GlyphRequest(0, 'w', 13, GlyphMode::Mono), rect, &pageIndex));
+			REQUIRE(bitmapCache.getPage(pageIndex).getFormat() == PageFormat::Mono1);
+			REQUIRE(bitmapCache.getGlyphsCount() == 3);
+		}
+
+		SECTION("Glyphs placed mark their page dirty")
+		{
+			BitmapFontCache bitmapCache(library);
+			bitmapCache.loadFont("C:/windows/fonts/arial.ttf");
+			REQUIRE(bitmapCache.takeDirtyRegions(0).empty());
+
+			Rect rectA, rectB, rectSdf;
+			REQUIRE(bitmapCache.addGlyph(0, 'A', 20) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.addGlyph(0, 'B', 20) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.addGlyph(0, 'C', 20, GlyphMode::Sdf) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getGlyphRect(0, 'A', 20, rectA));
+			REQUIRE(bitmapCache.getGlyphRect(0, 'B', 20, rectB));
+			REQUIRE(bitmapCache.getGlyphRect(GlyphRequest(0, 'C', 20, GlyphMode::Sdf), rectSdf));
+
+			std::vector<Rect> regions = bitmapCache.takeDirtyRegions(0);
+			REQUIRE(!regions.empty());
+			REQUIRE(regions.size() < 3);
+			for (const Rect& rect : { rectA, rectB, rectSdf })
+			{
+				bool covered = false;
+				for (const Rect& region : regions)
+					covered |= region.contains(rect);
+				REQUIRE(covered);
+			}
+			REQUIRE(bitmapCache.takeDirtyRegions(0).empty());
+		}
+
+		SECTION("Double buffered glyphs are visible once published")
+		{
+			BitmapFontCache bitmapCache(library);
+			bitmapCache.loadFont("C:/windows/fonts/arial.ttf");
+			bitmapCache.setDoubleBuffered(true);
+
+			Rect rect;
+			REQUIRE(bitmapCache.addGlyph(0, 'M', 24) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getGlyphRect(0, 'M', 24, rect));
+			const AtlasPage& page = bitmapCache.getPage(0);
+			auto sum = [&](const unsigned char* _data)
+			{
+				unsigned int total = 0;
+				for (int y = rect.top(); y < rect.bottom(); y++)
+					for (int x = rect.left(); x < rect.right(); x++)
+						total += _data[x + y * page.getPitch()];
+				return total;
+			};
+			REQUIRE(sum(bitmapCache.getImage()) == 0);
+			REQUIRE(bitmapCache.takeDirtyRegions(0).empty());
+
+			bitmapCache.publish();
+			REQUIRE(sum(bitmapCache.getImage()) > 0);
+			REQUIRE(sum(page.getData()) == sum(page.getFrontData()));
+			REQUIRE(!bitmapCache.takeDirtyRegions(0).empty());
+
+			// Pages created afterwards are double buffered too
+			REQUIRE(bitmapCache.addGlyph(0, 'M', 24, GlyphMode::Lcd) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getPage(bitmapCache.getPageCount() - 1).isDoubleBuffered());
+		}
+
+		SECTION("Tiled pages hold the same glyphs as linear ones")
+		{
+			BitmapFontCache linearCache(library), tiledCache(library);
+			tiledCache.setPageLayout(PageLayout::Tiled16);
+			for (BitmapFontCache* cache : { &linearCache, &tiledCache })
+			{
+				cache->loadFont("C:/windows/fonts/times.ttf");
+				for (int c = 'a'; c <= 'z'; c++)
+				{
+					REQUIRE(cache->addGlyph(0, c, 20) == BitmapFontCache::OK);
+					REQUIRE(cache->addGlyph(0, c, 20, GlyphMode::Sdf) == BitmapFontCache::OK);
+				}
+				REQUIRE(cache->addGlyph(0, 'q', 20, GlyphMode::Lcd) == BitmapFontCache::OK);
+			}
+			REQUIRE(tiledCache.getPage(0).getLayout() == PageLayout::Tiled16);
+			REQUIRE(tiledCache.getPage(tiledCache.getPageCount() - 1).getLayout() == PageLayout::Tiled16);
+
+			for (unsigned int i = 0; i < linearCache.getPageCount(); i++)
+			{
+				const AtlasPage& linear = linearCache.getPage(i);
+				std::vector<unsigned char> pixels(linear.getPitch() * linear.getHeight());
+				tiledCache.getPage(i).readRegion(Rect(0, 0, linear.getWidth(), linear.getHeight()), pixels.data(), linear.getPitch());
+				REQUIRE(std::memcmp(pixels.data(), linear.getData(), pixels.size()) == 0);
+			}
+		}
+
+		SECTION("Stroked glyphs are placed from the fill glyph origin")
+		{
+			BitmapFontCache bitmapCache(library);
+			bitmapCache.loadFont("C:/windows/fonts/arial.ttf");
+			REQUIRE(bitmapCache.addGlyph(0, 'O', 32) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.addStrokedGlyph(0, 'O', 32, 2.f) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.addStrokedGlyph(0, 'O', 32, 2.f) == BitmapFontCache::AlreadyAdded);
+			REQUIRE(bitmapCache.addStrokedGlyph(0, 'O', 32, 3.f) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getGlyphsCount() == 3);
+
+			GlyphRequest fill(0, 'O', 32), stroke(0, 'O', 32);
+			stroke.strokeWidth = 2.f;
+			Rect fillRect, strokeRect;
+			int fillLeft, fillTop, strokeLeft, strokeTop;
+			REQUIRE(bitmapCache.getGlyphRect(fill, fillRect));
+			REQUIRE(bitmapCache.getGlyphRect(stroke, strokeRect));
+			REQUIRE(bitmapCache.getGlyphOrigin(fill, fillLeft, fillTop));
+			REQUIRE(bitmapCache.getGlyphOrigin(stroke, strokeLeft, strokeTop));
+
+			FT_Face face;
+			REQUIRE(FT_New_Face(library, "C:/windows/fonts/arial.ttf", 0, &face) == 0);
+			FT_Set_Pixel_Sizes(face, 0, 32);
+			REQUIRE(FT_Load_Char(face, 'O', FT_LOAD_RENDER) == 0);
+			REQUIRE(fillLeft == face->glyph->bitmap_left);
+			REQUIRE(fillTop == face->glyph->bitmap_top);
+			FT_Done_Face(face);
+
+			// The border grows the glyph by the stroke width on every side
+			REQUIRE(std::abs(static_cast<int>(strokeRect.width() - fillRect.width()) - 4) <= 1);
+			REQUIRE(std::abs(static_cast<int>(strokeRect.height() - fillRect.height()) - 4) <= 1);
+			REQUIRE(std::abs(strokeLeft - (fillLeft - 2)) <= 1);
+			REQUIRE(std::abs(strokeTop - (fillTop + 2)) <= 1);
+
+			// The stroke covers the inside of the glyph too, so it can be drawn under the fill
+			const unsigned char* image = bitmapCache.getImage();
+			const int width = BitmapFontCache::getImageWidth();
+			for (int y = 0; y < static_cast<int>(fillRect.height()); y++)
+			{
+				for (int x = 0; x < static_cast<int>(fillRect.width()); x++)
+				{
+					if (image[fillRect.left() + x + (fillRect.top() + y) * width] == 255)
+					{
+						int sx = x + fillLeft - strokeLeft, sy = y + strokeTop - fillTop;
+						REQUIRE(image[strokeRect.left() + sx + (strokeRect.top() + sy) * width] == 255);
+					}
+				}
+			}
+		}
+
+		SECTION("Least recently used glyphs are evicted when the pages are full")
+		{
+			BitmapFontCache bitmapCache(library);
+			const int fontCount = 10;
+			for (int i = 0; i < fontCount; i++)
+				bitmapCache.loadFont("C:/windows/fonts/arial.ttf");
+
+			// The oldest glyph is small, then the page is filled with capitals wider than an 'o',
+			// and with 'o' until one is rejected
+			REQUIRE(bitmapCache.addGlyph(0, 'a', 12) == BitmapFontCache::OK);
+			int rejectedFont = -1;
+			for (int font = 0; font < fontCount && rejectedFont < 0; font++)
+			{
+				for (const char* c = "ABCDEGHKMNOQRSUVWXYZo"; *c && rejectedFont < 0; c++)
+				{
+					if (bitmapCache.addGlyph(font, *c, 150) == BitmapFontCache::NotEnoughSpace && *c == 'o')
+						rejectedFont = font;
+				}
+			}
+			REQUIRE(rejectedFont > 0);
+			REQUIRE(bitmapCache.getEvictedCount() == 0);
+
+			bitmapCache.setEvictionPolicy(BitmapFontCache::EvictionPolicy::Lru);
+			const unsigned int glyphsCount = bitmapCache.getGlyphsCount();
+			Rect rect;
+			REQUIRE(bitmapCache.getGlyphRect(0, 'A', 150, rect));
+
+			// A single capital is evicted: the small glyph is older, but freeing it isn't enough,
+			// and the capital looked up is more recent
+			REQUIRE(bitmapCache.addGlyph(rejectedFont, 'o', 150) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getEvictedCount() == 1);
+			REQUIRE(bitmapCache.getGlyphsCount() == glyphsCount);
+			REQUIRE(bitmapCache.getGlyphRect(0, 'a', 12, rect));
+			REQUIRE(bitmapCache.getGlyphRect(0, 'A', 150, rect));
+			REQUIRE(!bitmapCache.getGlyphRect(0, 'B', 150, rect));
+
+			// Further glyphs keep evicting the oldest ones
+			for (const char* c = "bcdefghijk"; *c; c++)
+				REQUIRE(bitmapCache.addGlyph(0, *c, 150) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getGlyphRect(rejectedFont, 'o', 150, rect));
+			REQUIRE(bitmapCache.getEvictedCount() >= 10);
+			REQUIRE(bitmapCache.getGlyphsCount() == glyphsCount + 10 - (bitmapCache.getEvictedCount() - 1));
+
+			// Nothing is evicted for a glyph larger than a page
+			const unsigned int evictedCount = bitmapCache.getEvictedCount();
+			REQUIRE(bitmapCache.addGlyph(0, 'W', 1500) == BitmapFontCache::NotEnoughSpace);
+			REQUIRE(bitmapCache.getEvictedCount() == evictedCount);
+		}
+
+		SECTION("Glyphs used by the frames in flight aren't evicted")
+		{
+			BitmapFontCache bitmapCache(library);
+			const int fontCount = 4;
+			for (int i = 0; i < fontCount; i++)
+				bitmapCache.loadFont("C:/windows/fonts/arial.ttf");
+
+			const char* chars = "ABCDEGHKMNOQRSUVWXYZo";
+			int rejectedFont = -1;
+			for (int font = 0; font < fontCount && rejectedFont < 0; font++)
+			{
+				for (const char* c = chars; *c && rejectedFont < 0; c++)
+				{
+					if (bitmapCache.addGlyph(font, *c, 300) == BitmapFontCache::NotEnoughSpace && *c == 'o')
+						rejectedFont = font;
+				}
+			}
+			REQUIRE(rejectedFont >= 0);
+			bitmapCache.setEvictionPolicy(BitmapFontCache::EvictionPolicy::Lru);
+			bitmapCache.setPinnedFrameCount(3);
+			auto useAll = [&]()
+			{
+				Rect rect;
+				for (int font = 0; font < fontCount; font++)
+				{
+					for (const char* c = chars; *c; c++)
+					{
+						if (font != 0 || *c != 'A')
+							bitmapCache.getGlyphRect(font, *c, 300, rect);
+					}
+				}
+			};
+
+			// 'A' is the least recently used glyph, but pinned by the first frame
+			Rect rect;
+			bitmapCache.beginFrame();
+			REQUIRE(bitmapCache.getFrame() == 1);
+			REQUIRE(bitmapCache.getGlyphRect(0, 'A', 300, rect));
+			bitmapCache.endFrame();
+			useAll();
+
+			bitmapCache.beginFrame();
+			REQUIRE(bitmapCache.addGlyph(rejectedFont, 'o', 300) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getEvictedCount() == 1);
+			REQUIRE(!bitmapCache.getGlyphRect(0, 'B', 300, rect));
+			bitmapCache.endFrame();
+
+			// Until three frames have begun since
+			bitmapCache.beginFrame();
+			bitmapCache.endFrame();
+			bitmapCache.beginFrame();
+			bitmapCache.endFrame();
+			bitmapCache.beginFrame();
+			REQUIRE(bitmapCache.getFrame() == 5);
+			REQUIRE(bitmapCache.addGlyph(rejectedFont, 'o', 299) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getEvictedCount() == 2);
+			REQUIRE(!bitmapCache.getGlyphRect(0, 'A', 300, rect));
+			bitmapCache.endFrame();
+
+			// Nothing can be evicted when every glyph is in flight
+			bitmapCache.beginFrame();
+			useAll();
+			bitmapCache.getGlyphRect(rejectedFont, 'o', 299, rect);
+			REQUIRE(bitmapCache.addGlyph(rejectedFont, 'o', 298) == BitmapFontCache::NotEnoughSpace);
+			REQUIRE(bitmapCache.getEvictedCount() == 2);
+			bitmapCache.endFrame();
+		}
+
+		SECTION("Released glyphs are reclaimed in bulk when room is needed")
+		{
+			BitmapFontCache bitmapCache(library);
+			const int fontCount = 4;
+			for (int i = 0; i < fontCount; i++)
+				bitmapCache.loadFont("C:/windows/fonts/arial.ttf");
+
+			// Two users share the capitals of the first font, the pages are filled until a glyph is rejected
+			const std::string chars = "ABCDEGHKMNOQRSUVWXYZo";
+			std::vector<BitmapFontCache::GlyphHandle> firstFont, otherFonts;
+			GlyphRequest rejected(-1, 0, 0);
+			for (int font = 0; font < fontCount && rejected.fontIndex < 0; font++)
+			{
+				for (size_t i = 0; i < chars.size() && rejected.fontIndex < 0; i++)
+				{
+					BitmapFontCache::ReturnCode result;
+					BitmapFontCache::GlyphHandle handle = bitmapCache.retainGlyph(GlyphRequest(font, chars[i], 200), &result);
+					if (result == BitmapFontCache::NotEnoughSpace)
+					{
+						REQUIRE(handle == 0);
+						rejected = GlyphRequest(font, chars[i], 200);
+					}
+					else
+					{
+						(font == 0 ? firstFont : otherFonts).push_back(handle);
+					}
+				}
+			}
+
+			// The fonts are the same, releasing the first font frees a slot of the size of the rejected glyph
+			REQUIRE(rejected.fontIndex > 0);
+			const size_t twin = chars.find(static_cast<char>(rejected.unicodeChar));
+			const size_t shared = (twin + 1) % chars.size(), retainedAgain = (twin + 2) % chars.size();
+			REQUIRE(bitmapCache.retainGlyph(GlyphRequest(0, chars[shared], 200)) == firstFont[shared]);
+			REQUIRE(bitmapCache.getGlyphRefCount(firstFont[shared]) == 2);
+
+			// Retained glyphs are never evicted
+			bitmapCache.setEvictionPolicy(BitmapFontCache::EvictionPolicy::Lru);
+			REQUIRE(bitmapCache.addGlyph(rejected.fontIndex, rejected.unicodeChar, rejected.pixelSize) == BitmapFontCache::NotEnoughSpace);
+			REQUIRE(bitmapCache.getEvictedCount() == 0);
+			bitmapCache.setEvictionPolicy(BitmapFontCache::EvictionPolicy::None);
+
+			// Released glyphs stay resident and can be retained again
+			const unsigned int glyphsCount = bitmapCache.getGlyphsCount();
+			for (BitmapFontCache::GlyphHandle handle : firstFont)
+				REQUIRE(bitmapCache.releaseGlyph(handle) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getGlyphRefCount(firstFont[shared]) == 1);
+			REQUIRE(bitmapCache.getGlyphRefCount(firstFont[twin]) == 0);
+			REQUIRE(bitmapCache.getGlyphsCount() == glyphsCount);
+			Rect rect;
+			REQUIRE(bitmapCache.getGlyphRect(firstFont[twin], rect));
+			REQUIRE(bitmapCache.retainGlyph(firstFont[retainedAgain]) == BitmapFontCache::OK);
+
+			// They are all reclaimed by the first glyph which needs room
+			REQUIRE(bitmapCache.addGlyph(rejected.fontIndex, rejected.unicodeChar, rejected.pixelSize) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getReclaimedCount() == firstFont.size() - 2);
+			REQUIRE(bitmapCache.getGlyphsCount() == glyphsCount - (firstFont.size() - 2) + 1);
+			REQUIRE(bitmapCache.getGlyphRect(firstFont[shared], rect));
+			REQUIRE(bitmapCache.getGlyphRect(firstFont[retainedAgain], rect));
+			REQUIRE(!bitmapCache.getGlyphRect(firstFont[twin], rect));
+			REQUIRE(bitmapCache.releaseGlyph(firstFont[twin]) == BitmapFontCache::NotFound);
+			for (BitmapFontCache::GlyphHandle handle : otherFonts)
+				REQUIRE(bitmapCache.getGlyphRefCount(handle) == 1);
+
+			// Until then, glyphs which fit are placed without reclaiming anything
+			REQUIRE(bitmapCache.retainGlyph(GlyphRequest(0, 'B', 100)) != 0);
+			REQUIRE(bitmapCache.getReclaimedCount() == firstFont.size() - 2);
+		}
+
+		SECTION("Greedy dual size evicts the glyphs cheapest to rasterize again per pixel")
+		{
+			for (BitmapFontCache::EvictionPolicy policy : { BitmapFontCache::EvictionPolicy::Lru, BitmapFontCache::EvictionPolicy::GreedyDualSize })
+			{
+				BitmapFontCache bitmapCache(library);
+				const int fontCount = 4;
+				for (int i = 0; i < fontCount; i++)
+					bitmapCache.loadFont("C:/windows/fonts/arial.ttf");
+
+				// Small glyphs first, then large capitals and small glyphs until the page is full
+				for (int c = 'a'; c <= 'z'; c++)
+					REQUIRE(bitmapCache.addGlyph(0, c, 12) == BitmapFontCache::OK);
+				std::vector<GlyphRequest> capitals;
+				for (int size : { 200, 100 })
+				{
+					for (int font = 1; font < 4; font++)
+					{
+						for (int c = 'A'; c <= 'Z'; c++)
+						{
+							if (bitmapCache.addGlyph(font, c, size) == BitmapFontCache::OK)
+								capitals.push_back(GlyphRequest(font, c, size));
+						}
+					}
+				}
+				GlyphRequest rejected(-1, 0, 0);
+				for (int size = 12; size <= 24 && rejected.fontIndex < 0; size++)
+				{
+					for (int c = 0x21; c < 0x17f && rejected.fontIndex < 0; c++)
+					{
+						if (bitmapCache.addGlyph(1, c, size) == BitmapFontCache::NotEnoughSpace)
+							rejected = GlyphRequest(1, c, size);
+					}
+				}
+				REQUIRE(rejected.fontIndex > 0);
+
+				// The capitals are the most recently used
+				Rect rect;
+				for (const GlyphRequest& request : capitals)
+					REQUIRE(bitmapCache.getGlyphRect(request, rect));
+
+				bitmapCache.setEvictionPolicy(policy);
+				REQUIRE(bitmapCache.addGlyph(rejected.fontIndex, rejected.unicodeChar, rejected.pixelSize) == BitmapFontCache::OK);
+				REQUIRE(bitmapCache.getEvictedCount() > 0);
+
+				unsigned int smallGlyphs = 0, largeGlyphs = 0;
+				for (int c = 'a'; c <= 'z'; c++)
+					smallGlyphs += bitmapCache.getGlyphRect(0, c, 12, rect) ? 1 : 0;
+				for (const GlyphRequest& request : capitals)
+					largeGlyphs += bitmapCache.getGlyphRect(request, rect) ? 1 : 0;
+				if (policy == BitmapFontCache::EvictionPolicy::Lru)
+				{
+					REQUIRE(smallGlyphs < 26);
+					REQUIRE(largeGlyphs == capitals.size());
+				}
+				else
+				{
+					REQUIRE(smallGlyphs == 26);
+					REQUIRE(largeGlyphs < capitals.size());
+				}
+			}
+		}
+
+		SECTION("Saved caches are reloaded without rasterizing")
+		{
+			const char* filename = "BitmapFontCache_Test.bmfa";
+			auto sameRect = [](const Rect& _a, const Rect& _b)
+			{
+				return _a.left() == _b.left() && _a.top() == _b.top() && _a.width() == _b.width() && _a.height() == _b.height();
+			};
+			BitmapFontCache savedCache(library);
+			savedCache.setPageLayout(PageLayout::Tiled8);
+			savedCache.loadFont("C:/windows/fonts/arial.ttf");
+			savedCache.loadFont("C:/windows/fonts/verdana.ttf");
+			for (int c = 'a'; c <= 'z'; c++)
+			{
+				REQUIRE(savedCache.addGlyph(0, c, 14) == BitmapFontCache::OK);
+				REQUIRE(savedCache.addGlyph(1, c, 20, GlyphMode::Lcd) == BitmapFontCache::OK);
+			}
+			REQUIRE(savedCache.addGlyphByIndex(0, 36, 30) == BitmapFontCache::OK);
+			REQUIRE(savedCache.addStrokedGlyph(1, 'O', 24, 1.5f) == BitmapFontCache::OK);
+			REQUIRE(savedCache.removeGlyph(0, 'k', 14) == BitmapFontCache::OK);
+			REQUIRE(savedCache.save(filename));
+
+			BitmapFontCache loadedCache(library);
+			loadedCache.setPageLayout(PageLayout::Tiled8);
+			loadedCache.loadFont("C:/windows/fonts/arial.ttf");
+			loadedCache.loadFont("C:/windows/fonts/verdana.ttf");
+			REQUIRE(loadedCache.load(filename));
+			REQUIRE(loadedCache.getPageCount() == savedCache.getPageCount());
+			REQUIRE(loadedCache.getGlyphsCount() == savedCache.getGlyphsCount());
+			REQUIRE(loadedCache.getFreeSlotsCount() == savedCache.getFreeSlotsCount());
+			for (unsigned int i = 0; i < savedCache.getPageCount(); i++)
+			{
+				const AtlasPage& page = savedCache.getPage(i);
+				REQUIRE(loadedCache.getPage(i).getFormat() == page.getFormat());
+				REQUIRE(std::memcmp(loadedCache.getPage(i).getData(), page.getData(), page.getSize()) == 0);
+				REQUIRE(!loadedCache.takeDirtyRegions(i).empty());
+			}
+
+			std::vector<GlyphRequest> requests = { GlyphRequest(0, 'a', 14), GlyphRequest(1, 'z', 20, GlyphMode::Lcd), GlyphRequest::fromGlyphIndex(0, 36, 30) };
+			requests.push_back(GlyphRequest(1, 'O', 24));
+			requests.back().strokeWidth = 1.5f;
+			for (const GlyphRequest& request : requests)
+			{
+				Rect savedRect, loadedRect;
+				int savedLeft, savedTop, loadedLeft, loadedTop;
+				REQUIRE(savedCache.getGlyphRect(request, savedRect));
+				REQUIRE(loadedCache.getGlyphRect(request, loadedRect));
+				REQUIRE(sameRect(loadedRect, savedRect));
+				REQUIRE(savedCache.getGlyphOrigin(request, savedLeft, savedTop));
+				REQUIRE(loadedCache.getGlyphOrigin(request, loadedLeft, loadedTop));
+				REQUIRE(loadedLeft == savedLeft);
+				REQUIRE(loadedTop == savedTop);
+			}
+			Rect rect;
+			REQUIRE(!loadedCache.getGlyphRect(0, 'k', 14, rect));
+
+			// Both caches keep packing glyphs the same way, the file is left untouched
+			for (BitmapFontCache* cache : { &savedCache, &loadedCache })
+			{
+				REQUIRE(cache->addGlyph(0, 'K', 40) == BitmapFontCache::OK);
+				REQUIRE(cache->removeGlyph(1, 'b', 20, GlyphMode::Lcd) == BitmapFontCache::OK);
+			}
+			Rect savedRect, loadedRect;
+			REQUIRE(savedCache.getGlyphRect(0, 'K', 40, savedRect));
+			REQUIRE(loadedCache.getGlyphRect(0, 'K', 40, loadedRect));
+			REQUIRE(sameRect(loadedRect, savedRect));
+			REQUIRE(std::memcmp(loadedCache.getImage(), savedCache.getImage(), savedCache.getPage(0).getSize()) == 0);
+			REQUIRE(loadedCache.getFreeSlotsCount() == savedCache.getFreeSlotsCount());
+
+			// Other fonts, options or gamma invalidate the file
+			BitmapFontCache otherFont(library), otherOptions(library), otherGamma(library), missingFont(library);
+			otherFont.loadFont("C:/windows/fonts/arial.ttf");
+			otherFont.loadFont("C:/windows/fonts/times.ttf");
+			RenderOptions light;
+			light.hinting = Hinting::Light;
+			otherOptions.loadFont("C:/windows/fonts/arial.ttf");
+			otherOptions.loadFont("C:/windows/fonts/verdana.ttf", light);
+			otherGamma.loadFont("C:/windows/fonts/arial.ttf");
+			otherGamma.loadFont("C:/windows/fonts/verdana.ttf");
+			otherGamma.setGamma(1.8f);
+			missingFont.loadFont("C:/windows/fonts/arial.ttf");
+			for (BitmapFontCache* cache : { &otherFont, &otherOptions, &otherGamma, &missingFont })
+			{
+				REQUIRE(!cache->load(filename));
+				REQUIRE(cache->getGlyphsCount() == 0);
+			}
+
+			// Truncated or inconsistent files are rejected before anything is allocated or mapped
+			auto loadModified = [&](const std::function<void(std::vector<unsigned char>&)>& _modify)
+			{
+				std::vector<unsigned char> bytes;
+				std::FILE* original = std::fopen(filename, "rb");
+				REQUIRE(original != nullptr);
+				unsigned char buffer[4096];
+				for (size_t count; (count = std::fread(buffer, 1, sizeof(buffer), original)) > 0;)
+					bytes.insert(bytes.end(), buffer, buffer + count);
+				std::fclose(original);
+				_modify(bytes);
+
+				const char* modifiedName = "BitmapFontCache_Test_Modified.bmfa";
+				std::FILE* modified = std::fopen(modifiedName, "wb");
+				REQUIRE(modified != nullptr);
+				std::fwrite(bytes.data(), 1, bytes.size(), modified);
+				std::fclose(modified);
+
+				BitmapFontCache cache(library);
+				cache.loadFont("C:/windows/fonts/arial.ttf");
+				cache.loadFont("C:/windows/fonts/verdana.ttf");
+				bool loaded = cache.load(modifiedName);
+				REQUIRE(cache.getGlyphsCount() == (loaded ? savedCache.getGlyphsCount() : 0));
+				std::remove(modifiedName);
+				return loaded;
+			};
+			const size_t poolsOffset = sizeof(atlasFile::Header) + 2 * sizeof(atlasFile::FontRecord);
+			auto getPool = [&](std::vector<unsigned char>& _bytes) { return reinterpret_cast<atlasFile::PoolRecord*>(&_bytes[poolsOffset]); };
+			auto getGlyphs = [&](std::vector<unsigned char>& _bytes)
+			{
+				const atlasFile::PoolRecord& pool = *getPool(_bytes);
+				const size_t offset = poolsOffset + savedCache.getPageCount() * sizeof(atlasFile::PoolRecord)
+					+ pool.slotCount * sizeof(atlasFile::SlotRecord) + pool.freeSlotCount * sizeof(uint32_t);
+				return reinterpret_cast<atlasFile::GlyphRecord*>(&_bytes[offset]);
+			};
+			REQUIRE(loadModified([](std::vector<unsigned char>&) {}));
+			REQUIRE(!loadModified([](std::vector<unsigned char>& _bytes) { _bytes.resize(_bytes.size() - 1); }));
+			REQUIRE(!loadModified([](std::vector<unsigned char>& _bytes) { _bytes.resize(sizeof(atlasFile::Header) + 10); }));
+			REQUIRE(!loadModified([&](std::vector<unsigned char>& _bytes) { getPool(_bytes)->slotCount = 0x7fffffff; }));
+			REQUIRE(!loadModified([&](std::vector<unsigned char>& _bytes) { getPool(_bytes)->glyphCount = 0xffffffff; }));
+			REQUIRE(!loadModified([&](std::vector<unsigned char>& _bytes) { getPool(_bytes)->dataOffset += atlasFile::ALIGNMENT * 1024; }));
+			REQUIRE(!loadModified([&](std::vector<unsigned char>& _bytes) { getGlyphs(_bytes)[0].rect[2] += 1000; }));
+			REQUIRE(!loadModified([&](std::vector<unsigned char>& _bytes) { getGlyphs(_bytes)[1].slot = getGlyphs(_bytes)[0].slot; }));
+
+			// So does a file written by another version
+			std::FILE* file = std::fopen(filename, "r+b");
+			REQUIRE(file != nullptr);
+			std::fseek(file, 4, SEEK_SET);
+			unsigned int version = atlasFile::VERSION + 1;
+			std::fwrite(&version, sizeof(version), 1, file);
+			std::fclose(file);
+			BitmapFontCache reloadedCache(library);
+			reloadedCache.loadFont("C:/windows/fonts/arial.ttf");
+			reloadedCache.loadFont("C:/windows/fonts/verdana.ttf");
+			REQUIRE(!reloadedCache.load(filename));
+			REQUIRE(!reloadedCache.load("missing.bmfa"));
+			std::remove(filename);
+		}
+
+		FT_Done_FreeType(library);
+	}
+
+	TEST_CASE("Warm start from a saved atlas", "[.][benchmark]")
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+		FT_Library library;
+		REQUIRE(FT_Init_FreeType(&library) == 0);
+		const char* filename = "BitmapFontCache_Benchmark.bmfa";
+
+		std::vector<BitmapFontCache::CodepointRange> ranges = { BitmapFontCache::CodepointRange(0x20, 0x7e), BitmapFontCache::CodepointRange(0xa0, 0x17f) };
+		std::vector<int> sizes = { 12, 14, 16, 20, 24, 32 };
+
+		// Caches release their faces before the library
+		{
+			auto start = Clock::now();
+			BitmapFontCache coldCache(library);
+			coldCache.loadFont("C:/windows/fonts/arial.ttf");
+			coldCache.prewarm(0, ranges, sizes);
+			double coldMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+			start = Clock::now();
+			REQUIRE(coldCache.save(filename));
+			double saveMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+			start = Clock::now();
+			BitmapFontCache warmCache(library);
+			warmCache.loadFont("C:/windows/fonts/arial.ttf");
+			REQUIRE(warmCache.load(filename));
+			double warmMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+			REQUIRE(warmCache.getGlyphsCount() == coldCache.getGlyphsCount());
+
+			WARN(coldCache.getGlyphsCount() << " glyphs: rasterized in " << coldMs << " ms, saved in " << saveMs << " ms, loaded in " << warmMs << " ms");
+		}
+		std::remove(filename);
+		FT_Done_FreeType(library);
+	}
+
+	TEST_CASE("Parallel warm-up of a CJK glyph set", "[.][benchmark]")
+	{
+		FT_Library library;
+		REQUIRE(FT_Init_FreeType(&library) == 0);
+
+		std::vector<GlyphRequest> requests;
+		for (int n = 0; n < 3000; n++)
+			requests.push_back(GlyphRequest(0, 0x4E00 + n, 16));
+
+		unsigned int threadCounts[] = { 0, 1, 2, 4, std::thread::hardware_concurrency() };
+		for (unsigned int threadCount : threadCounts)
+		{
+			BitmapFontCache bitmapCache(library);
+			bitmapCache.setRasterThreadCount(threadCount);
+			REQUIRE(bitmapCache.loadFont("C:/windows/fonts/msyh.ttc") == 0);
+
+			auto start = std::chrono::high_resolution_clock::now();
+			unsigned int added = bitmapCache.addGlyphs(requests);
+			auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start);
+			WARN(threadCount << " worker(s): " << added << " glyphs in " << elapsed.count() / 1000.0 << " ms");
+		}
+
+		FT_Done_FreeType(library);
+	}
+
+	TEST_CASE("Eviction policies replaying a glyph trace", "[.][benchmark]")
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+		FT_Library library;
+		REQUIRE(FT_Init_FreeType(&library) == 0);
+		const char* fonts[] = { "C:/windows/fonts/arial.ttf", "C:/windows/fonts/times.ttf", "C:/windows/fonts/verdana.ttf" };
+
+		// Small body text and large headings in accented Latin, several times the size of a page
+		std::vector<GlyphRequest> glyphs;
+		for (int font = 0; font < 3; font++)
+		{
+			for (int size : { 12, 16 })
+			{
+				for (int c = 0x21; c < 0x7f; c++)
+					glyphs.push_back(GlyphRequest(font, c, size));
+			}
+			for (int size : { 64, 96 })
+			{
+				for (int c = 0xc0; c < 0x180; c++)
+					glyphs.push_back(GlyphRequest(font, c, size));
+			}
+		}
+
+		// Zipf distributed popularity, the same trace for every policy
+		std::mt19937 random(1);
+		std::shuffle(glyphs.begin(), glyphs.end(), random);
+		std::vector<double> weights;
+		for (size_t rank = 0; rank < glyphs.size(); rank++)
+			weights.push_back(1.0 / std::pow(rank + 1.0, 0.9));
+		std::discrete_distribution<size_t> distribution(weights.begin(), weights.end());
+		std::vector<size_t> trace;
+		for (int n = 0; n < 50000; n++)
+			trace.push_back(distribution(random));
+
+		for (BitmapFontCache::EvictionPolicy policy : { BitmapFontCache::EvictionPolicy::Lru, BitmapFontCache::EvictionPolicy::GreedyDualSize })
+		{
+			BitmapFontCache bitmapCache(library);
+			for (int font = 0; font < 3; font++)
+				REQUIRE(bitmapCache.loadFont(fonts[font]) == font);
+			bitmapCache.setEvictionPolicy(policy);
+
+			std::set<size_t> added;
+			unsigned int misses = 0, rasterizedAgain = 0;
+			double missMs = 0., rasterizedAgainMs = 0.;
+			for (size_t index : trace)
+			{
+				const GlyphRequest& request = glyphs[index];
+				auto start = Clock::now();
+				BitmapFontCache::ReturnCode result = bitmapCache.addGlyph(request.fontIndex, request.unicodeChar, request.pixelSize);
+				double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+				if (result == BitmapFontCache::AlreadyAdded)
+					continue;
+				misses++;
+				missMs += ms;
+				if (!added.insert(index).second)
+				{
+					rasterizedAgain++;
+					rasterizedAgainMs += ms;
+				}
+			}
+
+			WARN((policy == BitmapFontCache::EvictionPolicy::Lru ? "Lru" : "GreedyDualSize") << ": " << trace.size() << " requests of "
+				<< glyphs.size() << " glyphs, miss rate " << 100.0 * misses / trace.size() << " %, " << rasterizedAgain << " glyphs rasterized again in "
+				<< rasterizedAgainMs << " ms, " << missMs << " ms for all the misses, " << bitmapCache.getEvictedCount() << " evictions");
+		}
+
 		FT_Done_FreeType(library);
 	}
 }
@@ -0,0 +1,42 @@
+#include "stdafx.h"
+#include "CharmapCache.h"
+
+#include <ft2build.h>
+#include <freetype/freetype.h>
+
+namespace bmf
+{
+	// Bound by reference to std::fill
+	const unsigned int CharmapCache::UNKNOWN;
+
+	unsigned int CharmapCache::lookup(int _char)
+	{
+		m_lookupsCount++;
+		unsigned int glyphIndex = FT_Get_Char_Index(m_face, _char);
+		if (glyphIndex == 0)
+			m_missingCodepoints.push_back(_char);
+		return glyphIndex;
+	}
+
+	unsigned int CharmapCache::getGlyphIndex(int _char)
+	{
+		// Not a codepoint, no face maps it
+		if (_char < 0 || _char >= PAGE_SIZE * PAGE_COUNT)
+			return 0;
+
+		if (m_pages.empty())
+			m_pages.resize(PAGE_COUNT);
+
+		std::unique_ptr<unsigned int[]>& page = m_pages[_char / PAGE_SIZE];
+		if (!page)
+		{
+			page.reset(new unsigned int[PAGE_SIZE]);
+			std::fill(page.get(), page.get() + PAGE_SIZE, UNKNOWN);
+		}
+
+		unsigned int& glyphIndex = page[_char % PAGE_SIZE];
+		if (glyphIndex == UNKNOWN)
+			glyphIndex = lookup(_char);
+		return glyphIndex;
+	}
+}
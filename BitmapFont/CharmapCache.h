@@ -0,0 +1,42 @@
+#pragma once
+
+#ifndef _CHARMAP_CACHE_H_
+#define _CHARMAP_CACHE_H_
+
+#include <vector>
+#include <memory>
+
+typedef struct FT_FaceRec_  *FT_Face;
+
+namespace bmf
+{
+	// Lazily populated codepoint to glyph index table of a face.
+	// FT_Get_Char_Index walks the cmap on every call, which is measurable for large
+	// format 12 tables; here each codepoint is looked up once, misses included.
+	class CharmapCache
+	{
+	public:
+		explicit CharmapCache(FT_Face _face) : m_face(_face) {}
+
+		// Returns 0 if the face has no glyph for the codepoint. Values outside of the Unicode
+		// range aren't looked up nor recorded as missing.
+		unsigned int getGlyphIndex(int _char);
+
+		const std::vector<int>& getMissingCodepoints() const { return m_missingCodepoints; }
+		unsigned int getLookupsCount() const { return m_lookupsCount; }
+
+	private:
+		static const int PAGE_SIZE = 256;
+		static const int PAGE_COUNT = 0x110000 / PAGE_SIZE;
+		static const unsigned int UNKNOWN = 0xFFFFFFFF;
+
+		unsigned int lookup(int _char);
+
+		FT_Face										m_face;
+		std::vector<std::unique_ptr<unsigned int[]>>	m_pages;
+		std::vector<int>							m_missingCodepoints;
+		unsigned int								m_lookupsCount = 0;	// FreeType lookups
+	};
+}
+
+#endif
@@ -0,0 +1,55 @@
+#include "stdafx.h"
+#include "CharmapCache.h"
+
+#include "catch.hpp"
+
+#include <ft2build.h>
+#include <freetype/freetype.h>
+
+namespace bmf
+{
+	TEST_CASE("Charmap cache works properly", "[CharmapCache]")
+	{
+		FT_Library library;
+		REQUIRE(FT_Init_FreeType(&library) == 0);
+		FT_Face face;
+		REQUIRE(FT_New_Face(library, "C:/windows/fonts/arial.ttf", 0, &face) == 0);
+
+		CharmapCache charmap(face);
+
+		SECTION("Codepoints are looked up once")
+		{
+			unsigned int glyphIndex = charmap.getGlyphIndex('a');
+			REQUIRE(glyphIndex == FT_Get_Char_Index(face, 'a'));
+			REQUIRE(glyphIndex != 0);
+			REQUIRE(charmap.getLookupsCount() == 1);
+
+			REQUIRE(charmap.getGlyphIndex('a') == glyphIndex);
+			REQUIRE(charmap.getLookupsCount() == 1);
+
+			REQUIRE(charmap.getGlyphIndex('b') == FT_Get_Char_Index(face, 'b'));
+			REQUIRE(charmap.getLookupsCount() == 2);
+		}
+
+		SECTION("Missing glyphs are recorded")
+		{
+			REQUIRE(charmap.getGlyphIndex(0x10FFFD) == 0);
+			REQUIRE(charmap.getGlyphIndex(0x10FFFD) == 0);
+			REQUIRE(charmap.getLookupsCount() == 1);
+			REQUIRE(charmap.getMissingCodepoints().size() == 1);
+			REQUIRE(charmap.getMissingCodepoints()[0] == 0x10FFFD);
+
+			// Out of the unicode range, never looked up
+			for (int n = 0; n < 10; n++)
+			{
+				REQUIRE(charmap.getGlyphIndex(-1) == 0);
+				REQUIRE(charmap.getGlyphIndex(0x110000 + n) == 0);
+			}
+			REQUIRE(charmap.getLookupsCount() == 1);
+			REQUIRE(charmap.getMissingCodepoints().size() == 1);
+		}
+
+		FT_Done_Face(face);
+		FT_Done_FreeType(library);
+	}
+}
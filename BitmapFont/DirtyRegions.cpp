@@ -0,0 +1,64 @@
+#include "stdafx.h"
+#include "DirtyRegions.h"
+
+namespace bmf
+{
+	unsigned long long DirtyRegions::getCost(const Rect& _rect) const
+	{
+		const bool fullWidth = static_cast<int>(_rect.width()) == m_pageWidth;
+		unsigned long long rowBytes = (static_cast<unsigned long long>(_rect.width()) * m_bytesPerRow + m_pageWidth - 1) / m_pageWidth;
+		unsigned long long cost = m_model.uploadOverhead + rowBytes * _rect.height();
+		if (!fullWidth)
+			cost += m_model.rowOverhead * ((_rect.height() + m_tileSize - 1) / m_tileSize);
+		return cost;
+	}
+
+	void DirtyRegions::add(const Rect& _rect)
+	{
+		// Clipped to the page, and aligned to the tiles
+		int left = std::max(0, _rect.left()), top = std::max(0, _rect.top());
+		int right = std::min(m_pageWidth, _rect.right()), bottom = std::min(m_pageHeight, _rect.bottom());
+		if (m_tileSize > 1)
+		{
+			left -= left % m_tileSize;
+			top -= top % m_tileSize;
+			right = std::min(m_pageWidth, (right + m_tileSize - 1) / m_tileSize * m_tileSize);
+			bottom = std::min(m_pageHeight, (bottom + m_tileSize - 1) / m_tileSize * m_tileSize);
+		}
+		if (right <= left || bottom <= top)
+			return;
+		Rect rect(left, top, right - left, bottom - top);
+
+		// Merges until no tracked region is worth merging with, a merged rect may reach other regions
+		bool merged = true;
+		while (merged)
+		{
+			merged = false;
+			for (size_t i = 0; i < m_regions.size(); i++)
+			{
+				const Rect& region = m_regions[i];
+				if (region.contains(rect))
+					return;
+
+				Rect box = region.united(rect);
+				Rect span(0, box.top(), m_pageWidth, box.height());
+				const Rect& best = getCost(span) < getCost(box) ? span : box;
+				if (getCost(best) <= getCost(region) + getCost(rect))
+				{
+					rect = best;
+					m_regions.erase(m_regions.begin() + i);
+					merged = true;
+					break;
+				}
+			}
+		}
+		m_regions.push_back(rect);
+	}
+
+	std::vector<Rect> DirtyRegions::take()
+	{
+		std::vector<Rect> regions;
+		regions.swap(m_regions);
+		return regions;
+	}
+}
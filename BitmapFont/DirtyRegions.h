@@ -0,0 +1,55 @@
+#pragma once
+
+#ifndef _DIRTY_REGIONS_H_
+#define _DIRTY_REGIONS_H_
+
+#include <vector>
+#include "Rect.h"
+
+namespace bmf
+{
+	// Regions of a page modified since they were last taken, to upload only those to the GPU.
+	// A rect is merged with a tracked one when uploading the merged area costs less than two
+	// uploads. Merged areas are either the bounding box of both, or the rows they span over the
+	// full page width, which are contiguous in memory and need no repacking.
+	// On tiled pages, regions are aligned to the tiles and every row of tiles is contiguous.
+	class DirtyRegions
+	{
+	public:
+		// Costs in bytes transferred
+		struct CostModel
+		{
+			unsigned int uploadOverhead = 4096;	// fixed cost of an upload call
+			unsigned int rowOverhead = 32;		// repacking of every row, or row of tiles, of a partial width upload
+		};
+
+		DirtyRegions(int _pageWidth, int _pageHeight, int _bytesPerRow) : m_pageWidth(_pageWidth), m_pageHeight(_pageHeight), m_bytesPerRow(_bytesPerRow) {}
+
+		// 1 for row major pages
+		void setTileSize(int _tileSize) { m_tileSize = _tileSize; }
+		int getTileSize() const { return m_tileSize; }
+
+		void setCostModel(const CostModel& _model) { m_model = _model; }
+		const CostModel& getCostModel() const { return m_model; }
+
+		void add(const Rect& _rect);
+		void clear() { m_regions.clear(); }
+		bool empty() const { return m_regions.empty(); }
+		const std::vector<Rect>& getRegions() const { return m_regions; }
+
+		// Returns the regions and clears them
+		std::vector<Rect> take();
+
+		unsigned long long getCost(const Rect& _rect) const;
+
+	private:
+		int					m_pageWidth;
+		int					m_pageHeight;
+		int					m_bytesPerRow;
+		int					m_tileSize = 1;
+		CostModel			m_model;
+		std::vector<Rect>	m_regions;
+	};
+}
+
+#endif
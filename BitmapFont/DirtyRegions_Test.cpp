@@ -0,0 +1,84 @@
+#include "stdafx.h"
+#include "DirtyRegions.h"
+#include "catch.hpp"
+
+namespace bmf
+{
+	TEST_CASE("Dirty regions are merged when it saves uploads", "[DirtyRegions]")
+	{
+		DirtyRegions regions(1024, 1024, 1024);
+
+		SECTION("Nearby rects are merged, distant ones are kept apart")
+		{
+			regions.add(Rect(10, 10, 16, 16));
+			regions.add(Rect(28, 12, 16, 16));
+			REQUIRE(regions.getRegions().size() == 1);
+			REQUIRE(regions.getRegions()[0].contains(Rect(10, 10, 16, 16)));
+			REQUIRE(regions.getRegions()[0].contains(Rect(28, 12, 16, 16)));
+
+			regions.add(Rect(600, 700, 200, 200));
+			REQUIRE(regions.getRegions().size() == 2);
+
+			// Already covered
+			regions.add(Rect(12, 12, 4, 4));
+			REQUIRE(regions.getRegions().size() == 2);
+		}
+
+		SECTION("Rects spanning most of the rows become full width uploads")
+		{
+			regions.add(Rect(0, 100, 500, 20));
+			regions.add(Rect(510, 100, 500, 20));
+			REQUIRE(regions.getRegions().size() == 1);
+			const Rect& region = regions.getRegions()[0];
+			REQUIRE(region.left() == 0);
+			REQUIRE(region.width() == 1024);
+			REQUIRE(region.top() == 100);
+			REQUIRE(region.height() == 20);
+		}
+
+		SECTION("Merging never costs more than separate uploads")
+		{
+			srand(42);
+			std::vector<Rect> added;
+			unsigned long long separateCost = 0;
+			for (int i = 0; i < 200; i++)
+			{
+				Rect rect(rand() % 1000, rand() % 1000, 4 + rand() % 40, 4 + rand() % 40);
+				added.push_back(rect);
+				separateCost += regions.getCost(rect);
+				regions.add(rect);
+			}
+
+			unsigned long long mergedCost = 0;
+			for (const Rect& region : regions.getRegions())
+				mergedCost += regions.getCost(region);
+			REQUIRE(mergedCost <= separateCost);
+			REQUIRE(regions.getRegions().size() < added.size());
+
+			// Every pixel written is covered
+			for (const Rect& rect : added)
+			{
+				Rect clipped(rect.left(), rect.top(), std::min(rect.right(), 1024) - rect.left(), std::min(rect.bottom(), 1024) - rect.top());
+				bool covered = false;
+				for (const Rect& region : regions.getRegions())
+					covered |= region.contains(clipped);
+				REQUIRE(covered);
+			}
+
+			std::vector<Rect> taken = regions.take();
+			REQUIRE(!taken.empty());
+			REQUIRE(regions.empty());
+		}
+
+		SECTION("A cheaper upload call merges less")
+		{
+			DirtyRegions::CostModel model;
+			model.uploadOverhead = 0;
+			model.rowOverhead = 0;
+			regions.setCostModel(model);
+			regions.add(Rect(10, 10, 16, 16));
+			regions.add(Rect(28, 12, 16, 16));
+			REQUIRE(regions.getRegions().size() == 2);
+		}
+	}
+}
@@ -0,0 +1,143 @@
+#include "stdafx.h"
+#include "FontRegistry.h"
+#include "AtlasFile.h"
+
+#include <cstdlib>
+#include <climits>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace bmf
+{
+	static std::string getCanonicalPath(const char* _filename)
+	{
+#ifdef _WIN32
+		char fullPath[MAX_PATH];
+		DWORD length = ::GetFullPathNameA(_filename, MAX_PATH, fullPath, nullptr);
+		if (length == 0 || length >= MAX_PATH)
+			return _filename;
+		// Paths are case insensitive on Windows
+		for (DWORD i = 0; i < length; i++)
+			fullPath[i] = fullPath[i] == '/' ? '\\' : static_cast<char>(::tolower(fullPath[i]));
+		return fullPath;
+#else
+		char fullPath[PATH_MAX];
+		if (::realpath(_filename, fullPath) == nullptr)
+			return _filename;
+		return fullPath;
+#endif
+	}
+
+	uint64_t FontData::hash() const
+	{
+		// Touches every page of the file, shared by the caches saving or sharing atlases of the font
+		std::call_once(m_hashOnce, [this] { m_hash = atlasFile::hash(m_data, m_size); });
+		return m_hash;
+	}
+
+	bool FontData::map(const std::string& _path)
+	{
+		m_path = _path;
+#ifdef _WIN32
+		HANDLE file = ::CreateFileA(_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		m_file = file;
+
+		LARGE_INTEGER size;
+		if (!::GetFileSizeEx(file, &size) || size.QuadPart == 0)
+			return false;
+
+		m_mapping = ::CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (m_mapping == nullptr)
+			return false;
+
+		m_data = static_cast<const unsigned char*>(::MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+		m_size = static_cast<size_t>(size.QuadPart);
+#else
+		int file = ::open(_path.c_str(), O_RDONLY);
+		if (file < 0)
+			return false;
+
+		struct stat info;
+		if (::fstat(file, &info) != 0 || info.st_size == 0)
+		{
+			::close(file);
+			return false;
+		}
+
+		// The mapping stays valid once the descriptor is closed
+		void* data = ::mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, file, 0);
+		::close(file);
+		if (data == MAP_FAILED)
+			return false;
+
+		m_data = static_cast<const unsigned char*>(data);
+		m_size = info.st_size;
+#endif
+		return m_data != nullptr;
+	}
+
+	FontData::~FontData()
+	{
+#ifdef _WIN32
+		if (m_data)
+			::UnmapViewOfFile(m_data);
+		if (m_mapping)
+			::CloseHandle(m_mapping);
+		if (m_file)
+			::CloseHandle(m_file);
+#else
+		if (m_data)
+			::munmap(const_cast<unsigned char*>(m_data), m_size);
+#endif
+	}
+
+	FontRegistry& FontRegistry::instance()
+	{
+		static FontRegistry registry;
+		return registry;
+	}
+
+	FontDataPtr FontRegistry::acquire(const char* _filename)
+	{
+		std::string path = getCanonicalPath(_filename);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::weak_ptr<const FontData>& entry = m_fonts[path];
+		FontDataPtr fontData = entry.lock();
+		if (fontData)
+			return fontData;
+
+		std::shared_ptr<FontData> newFontData(new FontData());
+		if (!newFontData->map(path))
+		{
+			m_fonts.erase(path);
+			return nullptr;
+		}
+
+		entry = newFontData;
+		return newFontData;
+	}
+
+	unsigned int FontRegistry::getMappedFontsCount()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		// Forget the fonts released since the last call
+		for (auto it = m_fonts.begin(); it != m_fonts.end();)
+		{
+			if (it->second.expired())
+				it = m_fonts.erase(it);
+			else
+				++it;
+		}
+		return m_fonts.size();
+	}
+}
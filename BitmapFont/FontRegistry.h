@@ -0,0 +1,65 @@
+#pragma once
+
+#ifndef _FONT_REGISTRY_H_
+#define _FONT_REGISTRY_H_
+
+#include <map>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+namespace bmf
+{
+	// Read-only memory mapping of a font file, unmapped when the last owner releases it
+	class FontData
+	{
+	public:
+		~FontData();
+
+		const unsigned char* data() const { return m_data; }
+		size_t size() const { return m_size; }
+		const std::string& path() const { return m_path; }
+		// atlasFile::hash() of the file, computed by the first call only
+		uint64_t hash() const;
+
+	private:
+		friend class FontRegistry;
+		FontData() {}
+		FontData(const FontData&) = delete;
+		FontData& operator=(const FontData&) = delete;
+
+		bool map(const std::string& _path);
+
+		std::string				m_path;
+		const unsigned char*	m_data = nullptr;
+		size_t					m_size = 0;
+		mutable std::once_flag	m_hashOnce;
+		mutable uint64_t		m_hash = 0;
+#ifdef _WIN32
+		void*					m_file = nullptr;
+		void*					m_mapping = nullptr;
+#endif
+	};
+	typedef std::shared_ptr<const FontData> FontDataPtr;
+
+	// Process-wide registry of mapped font files, so that every cache loading
+	// the same file shares a single mapping
+	class FontRegistry
+	{
+	public:
+		static FontRegistry& instance();
+
+		// Returns nullptr if the file can't be mapped
+		FontDataPtr acquire(const char* _filename);
+		unsigned int getMappedFontsCount();
+
+	private:
+		FontRegistry() {}
+
+		std::mutex								m_mutex;
+		std::map<std::string, std::weak_ptr<const FontData>>	m_fonts;
+	};
+}
+
+#endif
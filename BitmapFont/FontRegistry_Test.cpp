@@ -0,0 +1,72 @@
+#include "stdafx.h"
+#include "FontRegistry.h"
+#include "AtlasFile.h"
+#include "BitmapFontCache.h"
+
+#include "catch.hpp"
+
+#include <ft2build.h>
+#include <freetype/freetype.h>
+
+namespace bmf
+{
+	TEST_CASE("Font registry shares font mappings", "[FontRegistry]")
+	{
+		FontRegistry& registry = FontRegistry::instance();
+		unsigned int initialCount = registry.getMappedFontsCount();
+
+		SECTION("Same path returns the same data")
+		{
+			FontDataPtr arial = registry.acquire("C:/windows/fonts/arial.ttf");
+			REQUIRE(arial != nullptr);
+			REQUIRE(arial->size() > 0);
+			REQUIRE(arial->data() != nullptr);
+			REQUIRE(registry.getMappedFontsCount() == initialCount + 1);
+
+			FontDataPtr arialAgain = registry.acquire("C:/windows/fonts/../fonts/arial.ttf");
+			REQUIRE(arialAgain == arial);
+			REQUIRE(registry.getMappedFontsCount() == initialCount + 1);
+
+			FontDataPtr verdana = registry.acquire("C:/windows/fonts/verdana.ttf");
+			REQUIRE(verdana != arial);
+			REQUIRE(registry.getMappedFontsCount() == initialCount + 2);
+
+			// The hash identifying the file in atlas files is computed once
+			REQUIRE(arial->hash() == atlasFile::hash(arial->data(), arial->size()));
+			REQUIRE(arialAgain->hash() == arial->hash());
+			REQUIRE(verdana->hash() != arial->hash());
+
+			// Released with the last reference
+			arial.reset();
+			REQUIRE(registry.getMappedFontsCount() == initialCount + 2);
+			arialAgain.reset();
+			REQUIRE(registry.getMappedFontsCount() == initialCount + 1);
+		}
+
+		SECTION("Missing files can't be mapped")
+		{
+			REQUIRE(registry.acquire("C:/windows/fonts/does_not_exist.ttf") == nullptr);
+			REQUIRE(registry.getMappedFontsCount() == initialCount);
+		}
+
+		SECTION("Caches loading the same font share its mapping")
+		{
+			FT_Library library;
+			REQUIRE(FT_Init_FreeType(&library) == 0);
+			{
+				BitmapFontCache cacheA(library);
+				BitmapFontCache cacheB(library);
+				cacheB.setRasterThreadCount(2);
+				REQUIRE(cacheA.loadFont("C:/windows/fonts/arial.ttf") == 0);
+				REQUIRE(cacheB.loadFont("C:/windows/fonts/arial.ttf") == 0);
+				REQUIRE(cacheB.loadFont("C:/windows/fonts/does_not_exist.ttf") == -1);
+				REQUIRE(registry.getMappedFontsCount() == initialCount + 1);
+
+				REQUIRE(cacheA.addGlyph(0, 'a', 18) == BitmapFontCache::OK);
+				REQUIRE(cacheB.addGlyphs({ GlyphRequest(0, 'a', 18) }) == 1);
+			}
+			REQUIRE(registry.getMappedFontsCount() == initialCount);
+			FT_Done_FreeType(library);
+		}
+	}
+}
@@ -0,0 +1,277 @@
+#include "stdafx.h"
+#include "GlyphBlit.h"
+#include "GlyphRasterizer.h"
+#include "Rect.h"
+#include "Simd.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+namespace bmf
+{
+	namespace
+	{
+		void expandMonoRow(const unsigned char* _src, unsigned char* _dst, unsigned int _width)
+		{
+			unsigned int x = 0;
+#ifdef BMF_SSE2
+			// 2 source bytes at a time: each byte is broadcast over 8 lanes, and every lane tests its bit
+			const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+			for (; x + 16 <= _width; x += 16)
+			{
+				__m128i bytes = _mm_unpacklo_epi64(_mm_set1_epi8(static_cast<char>(_src[x / 8])), _mm_set1_epi8(static_cast<char>(_src[x / 8 + 1])));
+				__m128i pixels = _mm_cmpeq_epi8(_mm_and_si128(bytes, bits), bits);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(_dst + x), pixels);
+			}
+#endif
+			for (; x < _width; x++)
+				_dst[x] = (_src[x / 8] & (0x80 >> (x % 8))) ? 255 : 0;
+		}
+
+		void expandMonoRowBgra(const unsigned char* _src, unsigned char* _dst, unsigned int _width)
+		{
+			unsigned int x = 0;
+#ifdef BMF_SSE2
+			// A source byte at a time: broadcast over 4 pixels twice, every pixel tests its bit
+			const __m128i highBits = _mm_set_epi32(0x10, 0x20, 0x40, 0x80);
+			const __m128i lowBits = _mm_set_epi32(0x1, 0x2, 0x4, 0x8);
+			for (; x + 8 <= _width; x += 8)
+			{
+				__m128i byte = _mm_set1_epi32(_src[x / 8]);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(_dst + x * 4), _mm_cmpeq_epi32(_mm_and_si128(byte, highBits), highBits));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(_dst + x * 4 + 16), _mm_cmpeq_epi32(_mm_and_si128(byte, lowBits), lowBits));
+			}
+#endif
+			for (; x < _width; x++)
+			{
+				unsigned char value = (_src[x / 8] & (0x80 >> (x % 8))) ? 255 : 0;
+				_dst[x * 4] = _dst[x * 4 + 1] = _dst[x * 4 + 2] = _dst[x * 4 + 3] = value;
+			}
+		}
+
+		BitmapFormat toBitmapFormat(PageFormat _format)
+		{
+			switch (_format)
+			{
+			case PageFormat::Rgb8:
+				return BitmapFormat::Rgb8;
+			case PageFormat::Bgra8:
+				return BitmapFormat::Bgra8;
+			case PageFormat::Mono1:
+				return BitmapFormat::Mono1;
+			default:
+				return BitmapFormat::Gray8;
+			}
+		}
+
+		// Sets up to 8 bits of the byte holding _dstOffset, without crossing into the next byte.
+		// _bits holds them in its most significant bits. Returns the number of bits written.
+		unsigned int writeBits(unsigned char* _dst, unsigned int _dstOffset, unsigned int _bits, unsigned int _count)
+		{
+			unsigned int shift = _dstOffset % 8;
+			unsigned int count = std::min(8 - shift, _count);
+			unsigned char mask = static_cast<unsigned char>((0xFF00 >> count) & 0xFF) >> shift;
+			unsigned char& byte = _dst[_dstOffset / 8];
+			byte = static_cast<unsigned char>((byte & ~mask) | ((_bits >> shift) & mask));
+			return count;
+		}
+	}
+
+	void copyBits(const unsigned char* _src, unsigned int _srcOffset, unsigned char* _dst, unsigned int _dstOffset, unsigned int _count)
+	{
+		while (_count > 0)
+		{
+			// The next 8 bits of the source, which may straddle two bytes
+			const unsigned char* src = _src + _srcOffset / 8;
+			unsigned int shift = _srcOffset % 8;
+			unsigned int bits = (src[0] << shift) & 0xFF;
+			if (shift + std::min(_count, 8u) > 8)
+				bits |= src[1] >> (8 - shift);
+
+			unsigned int written = writeBits(_dst, _dstOffset, bits, _count);
+			_srcOffset += written;
+			_dstOffset += written;
+			_count -= written;
+		}
+	}
+
+	void clearBits(unsigned char* _dst, unsigned int _dstOffset, unsigned int _count)
+	{
+		// Partial first byte, whole bytes, partial last byte
+		unsigned int written = _dstOffset % 8 != 0 && _count > 0 ? writeBits(_dst, _dstOffset, 0, _count) : 0;
+		_dstOffset += written;
+		_count -= written;
+		std::memset(_dst + _dstOffset / 8, 0, _count / 8);
+		_dstOffset += _count / 8 * 8;
+		_count %= 8;
+		if (_count > 0)
+			writeBits(_dst, _dstOffset, 0, _count);
+	}
+
+	BitmapView::BitmapView(const GlyphBitmap& _bitmap)
+		: buffer(_bitmap.buffer.data()), width(_bitmap.width), rows(_bitmap.rows),
+		pitch(AtlasPage::getPitch(_bitmap.format, _bitmap.width)), format(toBitmapFormat(_bitmap.format))
+	{
+	}
+
+	BitmapView::BitmapView(const AtlasPage& _page, const Rect& _rect)
+		: buffer(_page.getData() + _rect.top() * _page.getPitch()), width(_rect.width()), rows(_rect.height()),
+		pitch(_page.getPitch()), format(toBitmapFormat(_page.getFormat()))
+	{
+		assert(_page.getLayout() == PageLayout::Linear);
+		if (format == BitmapFormat::Mono1)
+		{
+			buffer += _rect.left() / 8;
+			bitOffset = _rect.left() % 8;
+		}
+		else
+		{
+			buffer += _rect.left() * _page.getBytesPerPixel();
+		}
+	}
+
+	GammaTable::GammaTable(float _gamma) : m_gamma(_gamma)
+	{
+		for (int i = 0; i < 256; i++)
+			m_values[i] = static_cast<unsigned char>(std::pow(i / 255.f, 1.f / _gamma) * 255.f + 0.5f);
+	}
+
+	void blitBitmap(const BitmapView& _src, unsigned char* _dst, int _dstPitch, PageFormat _dstFormat, const GammaTable* _gamma)
+	{
+		assert(_dstFormat != PageFormat::Mono1);
+		const unsigned int rowBytes = _src.width * AtlasPage::getBytesPerPixel(_dstFormat);
+
+		// Unaligned monochrome rows are realigned first
+		std::vector<unsigned char> alignedRow(_src.format == BitmapFormat::Mono1 && _src.bitOffset != 0 ? (_src.width + 7) / 8 : 0);
+
+		for (unsigned int y = 0; y < _src.rows; y++, _dst += _dstPitch)
+		{
+			const unsigned char* src = _src.getRow(y);
+			switch (_src.format)
+			{
+			case BitmapFormat::Mono1:
+				if (!alignedRow.empty())
+				{
+					copyBits(src, _src.bitOffset, alignedRow.data(), 0, _src.width);
+					src = alignedRow.data();
+				}
+				assert(_dstFormat == PageFormat::Gray8 || _dstFormat == PageFormat::Bgra8);
+				if (_dstFormat == PageFormat::Bgra8)
+					expandMonoRowBgra(src, _dst, _src.width);
+				else
+					expandMonoRow(src, _dst, _src.width);
+				break;
+
+			case BitmapFormat::Gray8:
+				if (_dstFormat == PageFormat::Rgb8)
+				{
+					for (unsigned int x = 0; x < _src.width; x++)
+						_dst[x * 3] = _dst[x * 3 + 1] = _dst[x * 3 + 2] = src[x];
+				}
+				else if (_dstFormat == PageFormat::Bgra8)
+				{
+					// Premultiplied white
+					for (unsigned int x = 0; x < _src.width; x++)
+						_dst[x * 4] = _dst[x * 4 + 1] = _dst[x * 4 + 2] = _dst[x * 4 + 3] = src[x];
+				}
+				else if (_gamma)
+				{
+					const unsigned char* values = _gamma->getValues();
+					for (unsigned int x = 0; x < _src.width; x++)
+						_dst[x] = values[src[x]];
+				}
+				else
+				{
+					std::memcpy(_dst, src, rowBytes);
+				}
+				break;
+
+			case BitmapFormat::Bgra8:
+				assert(_dstFormat == PageFormat::Bgra8);
+				std::memcpy(_dst, src, rowBytes);
+				break;
+
+			case BitmapFormat::Rgb8:
+				assert(_dstFormat == PageFormat::Rgb8);
+				std::memcpy(_dst, src, rowBytes);
+				break;
+
+			case BitmapFormat::Bgr8:
+				assert(_dstFormat == PageFormat::Rgb8);
+				for (unsigned int x = 0; x < _src.width * 3; x += 3)
+				{
+					_dst[x] = src[x + 2];
+					_dst[x + 1] = src[x + 1];
+					_dst[x + 2] = src[x];
+				}
+				break;
+
+			case BitmapFormat::RgbRows:
+			case BitmapFormat::BgrRows:
+			{
+				assert(_dstFormat == PageFormat::Rgb8);
+				// With a negative pitch, the channel rows of a pixel are stored bottom first too
+				const int channelPitch = _src.pitch / 3;
+				const unsigned char* first = _src.pitch >= 0 ? src : src - 2 * channelPitch;
+				const unsigned char* channels[3] = { first, first + channelPitch, first + 2 * channelPitch };
+				if (_src.format == BitmapFormat::BgrRows)
+					std::swap(channels[0], channels[2]);
+				for (unsigned int x = 0; x < _src.width; x++)
+				{
+					_dst[x * 3] = channels[0][x];
+					_dst[x * 3 + 1] = channels[1][x];
+					_dst[x * 3 + 2] = channels[2][x];
+				}
+				break;
+			}
+			}
+		}
+	}
+
+	void blitToSlot(const BitmapView& _src, AtlasPage& _page, const Rect& _slot, const GammaTable* _gamma)
+	{
+		assert(_src.width <= _slot.width() && _src.rows <= _slot.height());
+		const int pitch = _page.getPitch();
+		if (_page.getFormat() == PageFormat::Mono1)
+		{
+			assert(_src.format == BitmapFormat::Mono1);
+			unsigned char* row = _page.getData() + _slot.top() * pitch;
+			for (unsigned int y = 0; y < _slot.height(); y++, row += pitch)
+			{
+				unsigned int copied = y < _src.rows ? _src.width : 0;
+				if (copied > 0)
+					copyBits(_src.getRow(y), _src.bitOffset, row, _slot.left(), copied);
+				clearBits(row, _slot.left() + copied, _slot.width() - copied);
+			}
+			return;
+		}
+
+		const int bpp = _page.getBytesPerPixel();
+		if (_page.getLayout() != PageLayout::Linear)
+		{
+			// Blitted to a row major copy of the slot, cleared gutter included, then stored in the tiles
+			const int slotPitch = _slot.width() * bpp;
+			std::vector<unsigned char> slot(slotPitch * _slot.height(), 0);
+			blitBitmap(_src, slot.data(), slotPitch, _page.getFormat(), _gamma);
+			_page.writeRegion(_slot, slot.data(), slotPitch);
+			return;
+		}
+
+		unsigned char* dst = _page.getData() + _slot.left() * bpp + _slot.top() * pitch;
+
+		blitBitmap(_src, dst, pitch, _page.getFormat(), _gamma);
+
+		// Gutter on the right of the glyph, then below it
+		const unsigned int gutterBytes = (_slot.width() - _src.width) * bpp;
+		if (gutterBytes > 0)
+		{
+			for (unsigned int y = 0; y < _src.rows; y++)
+				std::memset(dst + y * pitch + _src.width * bpp, 0, gutterBytes);
+		}
+		for (unsigned int y = _src.rows; y < _slot.height(); y++)
+			std::memset(dst + y * pitch, 0, _slot.width() * bpp);
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#ifndef _GLYPH_BLIT_H_
+#define _GLYPH_BLIT_H_
+
+#include "AtlasPage.h"
+
+namespace bmf
+{
+	struct GlyphBitmap;
+	class Rect;
+
+	enum class BitmapFormat
+	{
+		Mono1,	// 1 bit per pixel, most significant bit first
+		Gray8,
+		Rgb8,
+		Bgr8,
+		RgbRows,	// 3 rows per pixel, one per channel, as FreeType renders vertical LCD glyphs
+		BgrRows,
+		Bgra8	// premultiplied, as FreeType renders color glyphs
+	};
+
+	// Pixels of a bitmap with the conventions of FT_Bitmap: with a negative pitch, the buffer
+	// starts with the bottom row
+	struct BitmapView
+	{
+		BitmapView(const unsigned char* _buffer, unsigned int _width, unsigned int _rows, int _pitch, BitmapFormat _format)
+			: buffer(_buffer), width(_width), rows(_rows), pitch(_pitch), format(_format) {}
+		explicit BitmapView(const GlyphBitmap& _bitmap);
+		BitmapView(const AtlasPage& _page, const Rect& _rect);	// area of a linear page
+
+		const unsigned char* getRow(unsigned int _row) const
+		{
+			return pitch >= 0 ? buffer + _row * pitch : buffer + (static_cast<int>(rows) - 1 - static_cast<int>(_row)) * -pitch;
+		}
+
+		const unsigned char*	buffer;
+		unsigned int			width;
+		unsigned int			rows;
+		int						pitch;
+		BitmapFormat			format;
+		unsigned int			bitOffset = 0;	// of the first pixel of the rows, for Mono1
+	};
+
+	// Copies _count bits, most significant bit first, between arbitrary bit offsets
+	void copyBits(const unsigned char* _src, unsigned int _srcOffset, unsigned char* _dst, unsigned int _dstOffset, unsigned int _count);
+	void clearBits(unsigned char* _dst, unsigned int _dstOffset, unsigned int _count);
+
+	// Coverage to alpha correction: value = 255 * (coverage / 255) ^ (1 / gamma)
+	class GammaTable
+	{
+	public:
+		explicit GammaTable(float _gamma);
+
+		float getGamma() const { return m_gamma; }
+		const unsigned char* getValues() const { return m_values; }
+
+	private:
+		float			m_gamma;
+		unsigned char	m_values[256];
+	};
+
+	// Copies the bitmap row by row to _dst, converting it to _dstFormat. Supported conversions are
+	// Mono1 and Gray8 to Gray8, Mono1, Gray8 and Bgra8 to Bgra8, and every other format to Rgb8.
+	// Mono1 is expanded to 0 / 255, or to transparent / opaque white. Mono1 destinations are
+	// written by blitToSlot() only. The gamma table only applies to Gray8 to Gray8.
+	void blitBitmap(const BitmapView& _src, unsigned char* _dst, int _dstPitch, PageFormat _dstFormat, const GammaTable* _gamma = nullptr);
+
+	// Copies the bitmap to the top left corner of the slot, and clears the rest of the slot
+	// so that pixels of a glyph previously stored there don't bleed into the padding
+	void blitToSlot(const BitmapView& _src, AtlasPage& _page, const Rect& _slot, const GammaTable* _gamma = nullptr);
+}
+
+#endif
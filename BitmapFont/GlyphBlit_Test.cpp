@@ -0,0 +1,220 @@
+#include "stdafx.h"
+#include "GlyphBlit.h"
+#include "GlyphRasterizer.h"
+#include "Rect.h"
+
+#include "catch.hpp"
+#include <vector>
+#include <chrono>
+#include <cstring>
+
+namespace bmf
+{
+	TEST_CASE("Glyph bitmaps are blitted row by row", "[GlyphBlit]")
+	{
+		// 3x2 gray bitmap stored in rows of 4 bytes
+		const unsigned char gray[] = { 1, 2, 3, 0, 4, 5, 6, 0 };
+
+		SECTION("Positive and negative pitch")
+		{
+			unsigned char dst[3 * 2] = {};
+			blitBitmap(BitmapView(gray, 3, 2, 4, BitmapFormat::Gray8), dst, 3, PageFormat::Gray8);
+			REQUIRE(std::vector<unsigned char>(dst, dst + 6) == std::vector<unsigned char>({ 1, 2, 3, 4, 5, 6 }));
+
+			// The buffer holds the bottom row first
+			blitBitmap(BitmapView(gray, 3, 2, -4, BitmapFormat::Gray8), dst, 3, PageFormat::Gray8);
+			REQUIRE(std::vector<unsigned char>(dst, dst + 6) == std::vector<unsigned char>({ 4, 5, 6, 1, 2, 3 }));
+		}
+
+		SECTION("Monochrome bitmaps are expanded")
+		{
+			// Wide enough for the vectorized path and a scalar tail
+			const unsigned int width = 37;
+			const int pitch = 6;
+			std::vector<unsigned char> mono(pitch * 2);
+			for (size_t i = 0; i < mono.size(); i++)
+				mono[i] = static_cast<unsigned char>(i * 37 + 11);
+
+			std::vector<unsigned char> dst(width * 2);
+			blitBitmap(BitmapView(mono.data(), width, 2, pitch, BitmapFormat::Mono1), dst.data(), width, PageFormat::Gray8);
+			for (unsigned int y = 0; y < 2; y++)
+			{
+				for (unsigned int x = 0; x < width; x++)
+				{
+					bool set = (mono[y * pitch + x / 8] >> (7 - x % 8)) & 1;
+					REQUIRE(dst[x + y * width] == (set ? 255 : 0));
+				}
+			}
+		}
+
+		SECTION("Gamma applies to gray sources")
+		{
+			GammaTable gamma(2.2f);
+			REQUIRE(gamma.getValues()[0] == 0);
+			REQUIRE(gamma.getValues()[255] == 255);
+			REQUIRE(gamma.getValues()[128] > 128);
+
+			unsigned char dst[3 * 2] = {};
+			blitBitmap(BitmapView(gray, 3, 2, 4, BitmapFormat::Gray8), dst, 3, PageFormat::Gray8, &gamma);
+			REQUIRE(dst[4] == gamma.getValues()[5]);
+		}
+
+		SECTION("Subpixels are packed into RGB pixels")
+		{
+			// 2 pixels of subpixels a, b, c then d, e, f
+			const unsigned char horizontal[] = { 1, 2, 3, 4, 5, 6 };
+			unsigned char dst[6] = {};
+			blitBitmap(BitmapView(horizontal, 2, 1, 6, BitmapFormat::Bgr8), dst, 6, PageFormat::Rgb8);
+			REQUIRE(std::vector<unsigned char>(dst, dst + 6) == std::vector<unsigned char>({ 3, 2, 1, 6, 5, 4 }));
+
+			// 2x1 pixels rendered as 3 rows of 2 subpixels, in rows of 4 bytes
+			const unsigned char vertical[] = { 1, 2, 0, 0, 3, 4, 0, 0, 5, 6, 0, 0 };
+			blitBitmap(BitmapView(vertical, 2, 1, 12, BitmapFormat::RgbRows), dst, 6, PageFormat::Rgb8);
+			REQUIRE(std::vector<unsigned char>(dst, dst + 6) == std::vector<unsigned char>({ 1, 3, 5, 2, 4, 6 }));
+			blitBitmap(BitmapView(vertical, 2, 1, -12, BitmapFormat::RgbRows), dst, 6, PageFormat::Rgb8);
+			REQUIRE(std::vector<unsigned char>(dst, dst + 6) == std::vector<unsigned char>({ 5, 3, 1, 6, 4, 2 }));
+			blitBitmap(BitmapView(vertical, 2, 1, 12, BitmapFormat::BgrRows), dst, 6, PageFormat::Rgb8);
+			REQUIRE(std::vector<unsigned char>(dst, dst + 6) == std::vector<unsigned char>({ 5, 3, 1, 6, 4, 2 }));
+
+			// Gray coverage is the same for every subpixel
+			blitBitmap(BitmapView(gray, 2, 1, 4, BitmapFormat::Gray8), dst, 6, PageFormat::Rgb8);
+			REQUIRE(std::vector<unsigned char>(dst, dst + 6) == std::vector<unsigned char>({ 1, 1, 1, 2, 2, 2 }));
+		}
+
+		SECTION("Bits are copied between unaligned offsets")
+		{
+			const unsigned char src[] = { 0xB5, 0x3C, 0xE7, 0x19 };
+			auto bit = [](const unsigned char* _bytes, unsigned int _i) { return (_bytes[_i / 8] >> (7 - _i % 8)) & 1; };
+			for (unsigned int srcOffset : { 0u, 3u, 8u })
+			{
+				for (unsigned int dstOffset : { 0u, 5u, 13u })
+				{
+					for (unsigned int count : { 1u, 7u, 8u, 17u })
+					{
+						unsigned char dst[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+						copyBits(src, srcOffset, dst, dstOffset, count);
+						for (unsigned int i = 0; i < 48; i++)
+						{
+							bool copied = i >= dstOffset && i < dstOffset + count;
+							REQUIRE(bit(dst, i) == (copied ? bit(src, srcOffset + i - dstOffset) : 1));
+						}
+
+						clearBits(dst, dstOffset, count);
+						for (unsigned int i = 0; i < 48; i++)
+							REQUIRE(bit(dst, i) == (i >= dstOffset && i < dstOffset + count ? 0 : 1));
+					}
+				}
+			}
+		}
+
+		SECTION("Monochrome pages are expanded to 8 bits or RGBA")
+		{
+			AtlasPage page(PageFormat::Mono1, 64, 8);
+			REQUIRE(page.getPitch() == 8);
+
+			// 19x3 glyph at an unaligned position, in a slot with a gutter
+			std::memset(page.getData(), 0xFF, page.getPitch() * page.getHeight());
+			std::vector<unsigned char> mono(3 * 3);
+			for (size_t i = 0; i < mono.size(); i++)
+				mono[i] = static_cast<unsigned char>(i * 53 + 7);
+			Rect glyphRect(13, 2, 19, 3);
+			blitToSlot(BitmapView(mono.data(), 19, 3, 3, BitmapFormat::Mono1), page, Rect(13, 2, 21, 4));
+
+			std::vector<unsigned char> gray(19 * 3), rgba(19 * 3 * 4);
+			blitBitmap(BitmapView(page, glyphRect), gray.data(), 19, PageFormat::Gray8);
+			blitBitmap(BitmapView(page, glyphRect), rgba.data(), 19 * 4, PageFormat::Bgra8);
+			for (unsigned int y = 0; y < 3; y++)
+			{
+				for (unsigned int x = 0; x < 19; x++)
+				{
+					unsigned char expected = (mono[y * 3 + x / 8] >> (7 - x % 8)) & 1 ? 255 : 0;
+					REQUIRE(gray[x + y * 19] == expected);
+					REQUIRE(rgba[(x + y * 19) * 4] == expected);
+					REQUIRE(rgba[(x + y * 19) * 4 + 3] == expected);
+				}
+			}
+
+			// Gutter cleared, outside of the slot untouched
+			std::vector<unsigned char> gutter(22 * 5);
+			blitBitmap(BitmapView(page, Rect(12, 2, 22, 5)), gutter.data(), 22, PageFormat::Gray8);
+			REQUIRE(gutter[0] == 255);
+			REQUIRE(gutter[20] == 0);
+			REQUIRE(gutter[21] == 0);
+			REQUIRE(gutter[1 + 3 * 22] == 0);
+			REQUIRE(gutter[1 + 4 * 22] == 255);
+		}
+
+		SECTION("The rest of the slot is cleared")
+		{
+			AtlasPage page(PageFormat::Rgb8, 16, 16);
+			std::memset(page.getData(), 0xFF, page.getPitch() * page.getHeight());
+
+			GlyphBitmap bitmap;
+			bitmap.format = PageFormat::Rgb8;
+			bitmap.width = 2;
+			bitmap.rows = 2;
+			bitmap.buffer.assign(2 * 2 * 3, 7);
+			blitToSlot(BitmapView(bitmap), page, Rect(4, 5, 3, 4));
+
+			auto pixel = [&](int _x, int _y) { return page.getData()[_x * 3 + _y * page.getPitch()]; };
+			REQUIRE(pixel(4, 5) == 7);
+			REQUIRE(pixel(5, 6) == 7);
+			REQUIRE(pixel(6, 5) == 0);	// right gutter
+			REQUIRE(pixel(4, 8) == 0);	// bottom gutter
+			REQUIRE(pixel(7, 5) == 0xFF);	// outside of the slot
+			REQUIRE(pixel(4, 9) == 0xFF);
+		}
+	}
+
+	TEST_CASE("Glyph blit throughput", "[.][benchmark]")
+	{
+		const int width = 1024;
+		AtlasPage page(PageFormat::Gray8, width, width);
+		typedef std::chrono::high_resolution_clock Clock;
+
+		for (unsigned int size : { 16u, 32u, 64u })
+		{
+			GlyphBitmap bitmap;
+			bitmap.width = size;
+			bitmap.rows = size;
+			bitmap.buffer.assign(size * size, 0x80);
+			const unsigned int perRow = width / (size + 1);
+			const unsigned int glyphs = perRow * perRow;
+
+			// Column wise copy, as Pool::addGlyph used to do
+			auto start = Clock::now();
+			for (unsigned int n = 0; n < glyphs; n++)
+			{
+				unsigned char* dst = page.getData() + (n % perRow) * (size + 1) + (n / perRow) * (size + 1) * width;
+				for (unsigned int i = 0; i < size; i++)
+					for (unsigned int j = 0; j < size; j++)
+						dst[i + j * width] = bitmap.buffer[j * size + i];
+			}
+			double columnSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+			start = Clock::now();
+			for (unsigned int n = 0; n < glyphs; n++)
+				blitToSlot(BitmapView(bitmap), page, Rect((n % perRow) * (size + 1), (n / perRow) * (size + 1), size + 1, size + 1));
+			double rowSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+			std::vector<unsigned char> mono((size + 7) / 8 * size, 0x5A);
+			start = Clock::now();
+			for (unsigned int n = 0; n < glyphs; n++)
+			{
+				unsigned char* dst = page.getData() + (n % perRow) * (size + 1) + (n / perRow) * (size + 1) * width;
+				blitBitmap(BitmapView(mono.data(), size, size, (size + 7) / 8, BitmapFormat::Mono1), dst, width, PageFormat::Gray8);
+			}
+			double monoSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+			std::vector<unsigned char> rgba(size * size * 4);
+			start = Clock::now();
+			for (unsigned int n = 0; n < glyphs; n++)
+				blitBitmap(BitmapView(mono.data(), size, size, (size + 7) / 8, BitmapFormat::Mono1), rgba.data(), size * 4, PageFormat::Bgra8);
+			double rgbaSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+			double megaPixels = glyphs * size * size / 1e6;
+			WARN(size << " px glyphs: column wise " << megaPixels / columnSeconds << " MPix/s, row wise " << megaPixels / rowSeconds
+				<< " MPix/s, mono expansion " << megaPixels / monoSeconds << " MPix/s, mono to RGBA " << megaPixels / rgbaSeconds << " MPix/s");
+		}
+	}
+}
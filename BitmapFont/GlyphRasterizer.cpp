@@ -0,0 +1,485 @@
+#include "stdafx.h"
+#include "GlyphRasterizer.h"
+#include "SignedDistanceField.h"
+#include "MultiChannelDistanceField.h"
+#include "GlyphBlit.h"
+
+#include <cassert>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cmath>
+
+#include <ft2build.h>
+#include <freetype/freetype.h>
+#include <freetype/ftlcdfil.h>
+#include <freetype/ftsynth.h>
+#include <freetype/ftstroke.h>
+
+namespace bmf
+{
+	static GlyphOutlinePtr findOrLoadOutline(FT_Face _face, const GlyphRequest& _request, OutlineCache* _outlines)
+	{
+		if (!_outlines)
+			return loadGlyphOutline(_face, _request.glyphIndex);
+
+		GlyphOutlinePtr outline = _outlines->find(_request.fontIndex, _request.glyphIndex);
+		if (!outline)
+		{
+			outline = loadGlyphOutline(_face, _request.glyphIndex);
+			if (outline)
+				_outlines->insert(_request.fontIndex, _request.glyphIndex, outline);
+		}
+		return outline;
+	}
+
+	// Load flags of the render options for the hinting target of the mode
+	static FT_Int32 getLoadFlags(const RenderOptions& _options, FT_Int32 _target)
+	{
+		FT_Int32 flags = _options.loadFlags;
+		switch (_options.hinting)
+		{
+		case Hinting::None:
+			return flags | FT_LOAD_NO_HINTING;
+		case Hinting::Auto:
+			return flags | FT_LOAD_FORCE_AUTOHINT | _target;
+		case Hinting::Light:
+			// Subpixel and monochrome targets keep their own hinting
+			return flags | (_target == FT_LOAD_TARGET_NORMAL ? FT_LOAD_TARGET_LIGHT : _target);
+		default:
+			return flags | _target;
+		}
+	}
+
+	// Loads the glyph of the request with its render options and renders it with the given mode
+	static FT_Error loadGlyph(FT_Face _face, const GlyphRequest& _request, FT_Int32 _target, FT_Render_Mode _renderMode)
+	{
+		FT_Set_Pixel_Sizes(_face, 0, _request.pixelSize);
+		FT_Error error = FT_Load_Glyph(_face, _request.glyphIndex, getLoadFlags(_request.options, _target));
+		if (error)
+			return error;
+		if (_request.options.embolden)
+			FT_GlyphSlot_Embolden(_face->glyph);
+		if (_face->glyph->format != FT_GLYPH_FORMAT_BITMAP)
+			error = FT_Render_Glyph(_face->glyph, _renderMode);
+		return error;
+	}
+
+	static bool copyCoverage(const FT_Bitmap& _source, int _left, int _top, GlyphBitmap& _bitmap)
+	{
+		if (_source.width == 0 || _source.rows == 0)
+			return false;
+
+		// Embedded bitmap strikes may be monochrome
+		BitmapFormat format;
+		if (_source.pixel_mode == FT_PIXEL_MODE_GRAY)
+			format = BitmapFormat::Gray8;
+		else if (_source.pixel_mode == FT_PIXEL_MODE_MONO)
+			format = BitmapFormat::Mono1;
+		else
+			return false;
+
+		_bitmap.width = _source.width;
+		_bitmap.rows = _source.rows;
+		_bitmap.left = _left;
+		_bitmap.top = _top;
+		_bitmap.buffer.resize(_source.width * _source.rows);
+		blitBitmap(BitmapView(_source.buffer, _source.width, _source.rows, _source.pitch, format), _bitmap.buffer.data(), _source.width, PageFormat::Gray8);
+		return true;
+	}
+
+	// Outer border of the outline loaded with the same options as the fill glyph, so that both
+	// bitmaps are placed from the same pen position
+	static bool rasterizeStroke(FT_Face _face, const GlyphRequest& _request, GlyphBitmap& _bitmap)
+	{
+		FT_Set_Pixel_Sizes(_face, 0, _request.pixelSize);
+		if (FT_Load_Glyph(_face, _request.glyphIndex, getLoadFlags(_request.options, FT_LOAD_TARGET_NORMAL)))
+			return false;
+		if (_request.options.embolden)
+			FT_GlyphSlot_Embolden(_face->glyph);
+		if (_face->glyph->format != FT_GLYPH_FORMAT_OUTLINE)
+			return false;
+
+		FT_Glyph glyph = nullptr;
+		if (FT_Get_Glyph(_face->glyph, &glyph))
+			return false;
+
+		FT_Stroker stroker = nullptr;
+		FT_Error error = FT_Stroker_New(_face->glyph->library, &stroker);
+		if (error == 0)
+		{
+			FT_Stroker_Set(stroker, static_cast<FT_Fixed>(_request.strokeWidth * 64.f + 0.5f), FT_STROKER_LINECAP_ROUND, FT_STROKER_LINEJOIN_ROUND, 0);
+			error = FT_Glyph_StrokeBorder(&glyph, stroker, false, true);
+			FT_Stroker_Done(stroker);
+		}
+		if (error == 0)
+			error = FT_Glyph_To_Bitmap(&glyph, FT_RENDER_MODE_NORMAL, nullptr, true);
+
+		bool found = false;
+		if (error == 0)
+		{
+			FT_BitmapGlyph bitmapGlyph = reinterpret_cast<FT_BitmapGlyph>(glyph);
+			found = copyCoverage(bitmapGlyph->bitmap, bitmapGlyph->left, bitmapGlyph->top, _bitmap);
+		}
+		FT_Done_Glyph(glyph);
+		return found;
+	}
+
+	static bool rasterizeCoverage(FT_Face _face, const GlyphRequest& _request, GlyphBitmap& _bitmap, OutlineCache* _outlines)
+	{
+		if (_request.strokeWidth > 0.f && FT_IS_SCALABLE(_face))
+			return rasterizeStroke(_face, _request, _bitmap);
+
+		// Cached outlines are unhinted and can't apply the other options
+		const RenderOptions& options = _request.options;
+		if (_outlines && FT_IS_SCALABLE(_face) && options.loadFlags == 0 && options.hinting == Hinting::None && !options.embolden)
+		{
+			GlyphOutlinePtr outline = findOrLoadOutline(_face, _request, _outlines);
+			if (outline)
+				return rasterizeOutline(_face->glyph->library, *outline, _request.pixelSize, _bitmap);
+		}
+
+		if (loadGlyph(_face, _request, FT_LOAD_TARGET_NORMAL, FT_RENDER_MODE_NORMAL))
+			return false;
+		return copyCoverage(_face->glyph->bitmap, _face->glyph->bitmap_left, _face->glyph->bitmap_top, _bitmap);
+	}
+
+	static bool rasterizeLcd(FT_Face _face, const GlyphRequest& _request, GlyphBitmap& _bitmap)
+	{
+		static const FT_LcdFilter filters[] = { FT_LCD_FILTER_NONE, FT_LCD_FILTER_DEFAULT, FT_LCD_FILTER_LIGHT, FT_LCD_FILTER_LEGACY };
+		FT_Library_SetLcdFilter(_face->glyph->library, filters[static_cast<int>(_request.lcdFilter)]);
+
+		const bool vertical = _request.mode == GlyphMode::LcdV;
+		FT_Error error = loadGlyph(_face, _request, vertical ? FT_LOAD_TARGET_LCD_V : FT_LOAD_TARGET_LCD, vertical ? FT_RENDER_MODE_LCD_V : FT_RENDER_MODE_LCD);
+		const FT_Bitmap& bitmap = _face->glyph->bitmap;
+		if (error || bitmap.width == 0 || bitmap.rows == 0)
+			return false;
+
+		// Subpixels are packed into RGB pixels: 3 columns, or 3 rows, of the FreeType bitmap per pixel
+		const bool bgr = _request.subpixelOrder == SubpixelOrder::Bgr;
+		GlyphBitmap coverage;
+		BitmapView view(bitmap.buffer, bitmap.width / 3, bitmap.rows, bitmap.pitch, bgr ? BitmapFormat::Bgr8 : BitmapFormat::Rgb8);
+		if (bitmap.pixel_mode == FT_PIXEL_MODE_LCD_V)
+		{
+			view = BitmapView(bitmap.buffer, bitmap.width, bitmap.rows / 3, bitmap.pitch * 3, bgr ? BitmapFormat::BgrRows : BitmapFormat::RgbRows);
+		}
+		else if (bitmap.pixel_mode != FT_PIXEL_MODE_LCD)
+		{
+			// Bitmap strikes have the same coverage for every subpixel
+			if (!rasterizeCoverage(_face, _request, coverage, nullptr))
+				return false;
+			view = BitmapView(coverage);
+		}
+
+		_bitmap.format = PageFormat::Rgb8;
+		_bitmap.width = view.width;
+		_bitmap.rows = view.rows;
+		_bitmap.left = _face->glyph->bitmap_left;
+		_bitmap.top = _face->glyph->bitmap_top;
+		_bitmap.buffer.resize(view.width * view.rows * 3);
+		blitBitmap(view, _bitmap.buffer.data(), view.width * 3, PageFormat::Rgb8);
+		return true;
+	}
+
+	static bool copyColorBitmap(const FT_Bitmap& _bitmap, GlyphBitmap& _color)
+	{
+		if (_bitmap.width == 0 || _bitmap.rows == 0)
+			return false;
+
+		_color.format = PageFormat::Bgra8;
+		_color.width = _bitmap.width;
+		_color.rows = _bitmap.rows;
+		_color.buffer.resize(_bitmap.width * _bitmap.rows * 4);
+		if (_bitmap.pixel_mode == FT_PIXEL_MODE_BGRA)
+		{
+			blitBitmap(BitmapView(_bitmap.buffer, _bitmap.width, _bitmap.rows, _bitmap.pitch, BitmapFormat::Bgra8), _color.buffer.data(), _bitmap.width * 4, PageFormat::Bgra8);
+			return true;
+		}
+
+		// Monochrome glyphs of color fonts, or glyphs of regular fonts
+		if (_bitmap.pixel_mode != FT_PIXEL_MODE_GRAY && _bitmap.pixel_mode != FT_PIXEL_MODE_MONO)
+			return false;
+		GlyphBitmap coverage;
+		coverage.width = _bitmap.width;
+		coverage.rows = _bitmap.rows;
+		coverage.buffer.resize(_bitmap.width * _bitmap.rows);
+		BitmapFormat format = _bitmap.pixel_mode == FT_PIXEL_MODE_MONO ? BitmapFormat::Mono1 : BitmapFormat::Gray8;
+		blitBitmap(BitmapView(_bitmap.buffer, _bitmap.width, _bitmap.rows, _bitmap.pitch, format), coverage.buffer.data(), _bitmap.width, PageFormat::Gray8);
+		blitBitmap(BitmapView(coverage), _color.buffer.data(), _bitmap.width * 4, PageFormat::Bgra8);
+		return true;
+	}
+
+	// Level 0 is the strike as stored in the font, every other level halves the previous one
+	static GlyphBitmapPtr getStrikeLevel(FT_Face _face, const GlyphRequest& _request, int _strike, int _level, StrikeCache* _strikes)
+	{
+		if (_strikes)
+		{
+			GlyphBitmapPtr cached = _strikes->find(_request.fontIndex, _request.glyphIndex, _request.options.loadFlags, _strike, _level);
+			if (cached)
+				return cached;
+		}
+
+		std::shared_ptr<GlyphBitmap> bitmap = std::make_shared<GlyphBitmap>();
+		if (_level == 0)
+		{
+			if (FT_Select_Size(_face, _strike) || FT_Load_Glyph(_face, _request.glyphIndex, _request.options.loadFlags | FT_LOAD_COLOR | FT_LOAD_RENDER)
+				|| !copyColorBitmap(_face->glyph->bitmap, *bitmap))
+				return nullptr;
+			bitmap->left = _face->glyph->bitmap_left;
+			bitmap->top = _face->glyph->bitmap_top;
+		}
+		else
+		{
+			GlyphBitmapPtr parent = getStrikeLevel(_face, _request, _strike, _level - 1, _strikes);
+			if (!parent)
+				return nullptr;
+			halveBgra(*parent, *bitmap);
+		}
+
+		if (_strikes)
+			_strikes->insert(_request.fontIndex, _request.glyphIndex, _request.options.loadFlags, _strike, _level, bitmap);
+		return bitmap;
+	}
+
+	static bool rasterizeColor(FT_Face _face, const GlyphRequest& _request, GlyphBitmap& _bitmap, StrikeCache* _strikes)
+	{
+		if (FT_IS_SCALABLE(_face) || !FT_HAS_FIXED_SIZES(_face))
+		{
+			FT_Set_Pixel_Sizes(_face, 0, _request.pixelSize);
+			if (FT_Load_Glyph(_face, _request.glyphIndex, _request.options.loadFlags | FT_LOAD_COLOR | FT_LOAD_RENDER))
+				return false;
+			_bitmap.left = _face->glyph->bitmap_left;
+			_bitmap.top = _face->glyph->bitmap_top;
+			return copyColorBitmap(_face->glyph->bitmap, _bitmap);
+		}
+
+		// Smallest strike at least as large as the requested size, or the largest one
+		int strike = 0;
+		for (int i = 1; i < _face->num_fixed_sizes; i++)
+		{
+			int size = _face->available_sizes[i].y_ppem >> 6;
+			int best = _face->available_sizes[strike].y_ppem >> 6;
+			if (best < _request.pixelSize ? size > best : (size >= _request.pixelSize && size < best))
+				strike = i;
+		}
+		const int strikeSize = std::max(1, static_cast<int>(_face->available_sizes[strike].y_ppem >> 6));
+
+		// Deepest level which is still larger than the requested size
+		int level = 0;
+		while ((strikeSize >> (level + 1)) >= _request.pixelSize)
+			level++;
+
+		GlyphBitmapPtr source = getStrikeLevel(_face, _request, strike, level, _strikes);
+		if (!source)
+			return false;
+
+		const double scale = _request.pixelSize * static_cast<double>(1 << level) / strikeSize;
+		unsigned int width = std::max(1u, static_cast<unsigned int>(source->width * scale + 0.5));
+		unsigned int rows = std::max(1u, static_cast<unsigned int>(source->rows * scale + 0.5));
+		if (width == source->width && rows == source->rows)
+			_bitmap = *source;
+		else
+			resampleBgra(*source, width, rows, _bitmap);
+		_bitmap.left = static_cast<int>(std::floor(source->left * scale));
+		_bitmap.top = static_cast<int>(std::ceil(source->top * scale));
+		return true;
+	}
+
+	static bool rasterizeMono(FT_Face _face, const GlyphRequest& _request, GlyphBitmap& _bitmap)
+	{
+		FT_Error error = loadGlyph(_face, _request, FT_LOAD_TARGET_MONO, FT_RENDER_MODE_MONO);
+		const FT_Bitmap& bitmap = _face->glyph->bitmap;
+		if (error || bitmap.width == 0 || bitmap.rows == 0)
+			return false;
+
+		_bitmap.format = PageFormat::Mono1;
+		_bitmap.width = bitmap.width;
+		_bitmap.rows = bitmap.rows;
+		_bitmap.left = _face->glyph->bitmap_left;
+		_bitmap.top = _face->glyph->bitmap_top;
+		const int pitch = AtlasPage::getPitch(PageFormat::Mono1, bitmap.width);
+		_bitmap.buffer.assign(pitch * bitmap.rows, 0);
+
+		if (bitmap.pixel_mode == FT_PIXEL_MODE_MONO)
+		{
+			BitmapView view(bitmap.buffer, bitmap.width, bitmap.rows, bitmap.pitch, BitmapFormat::Mono1);
+			for (unsigned int y = 0; y < bitmap.rows; y++)
+				std::memcpy(&_bitmap.buffer[y * pitch], view.getRow(y), pitch);
+		}
+		else if (bitmap.pixel_mode == FT_PIXEL_MODE_GRAY)
+		{
+			// Gray bitmap strikes are thresholded
+			BitmapView view(bitmap.buffer, bitmap.width, bitmap.rows, bitmap.pitch, BitmapFormat::Gray8);
+			for (unsigned int y = 0; y < bitmap.rows; y++)
+			{
+				for (unsigned int x = 0; x < bitmap.width; x++)
+				{
+					if (view.getRow(y)[x] >= 128)
+						_bitmap.buffer[y * pitch + x / 8] |= 0x80 >> (x % 8);
+				}
+			}
+		}
+		else
+		{
+			return false;
+		}
+		return true;
+	}
+
+	bool rasterizeGlyph(FT_Face _face, const GlyphRequest& _request, GlyphBitmap& _bitmap, OutlineCache* _outlines, StrikeCache* _strikes)
+	{
+		if (_request.mode == GlyphMode::Bitmap)
+			return rasterizeCoverage(_face, _request, _bitmap, _outlines);
+
+		if (_request.mode == GlyphMode::Mono)
+			return rasterizeMono(_face, _request, _bitmap);
+
+		if (_request.mode == GlyphMode::Color)
+			return rasterizeColor(_face, _request, _bitmap, _strikes);
+
+		// Cached outlines are only rendered in gray
+		if (_request.mode == GlyphMode::Lcd || _request.mode == GlyphMode::LcdV)
+			return rasterizeLcd(_face, _request, _bitmap);
+
+		// Multi-channel fields need the edges, bitmap only fonts fall back to a single channel field
+		if (_request.mode == GlyphMode::Msdf && FT_IS_SCALABLE(_face))
+		{
+			GlyphOutlinePtr outline = findOrLoadOutline(_face, _request, _outlines);
+			return outline && generateMsdf(*outline, _request.pixelSize, _request.spread, _bitmap);
+		}
+
+		GlyphBitmap coverage;
+		if (!rasterizeCoverage(_face, _request, coverage, _outlines))
+			return false;
+		generateSdf(coverage, _request.spread, _bitmap);
+		return true;
+	}
+
+	RasterWorkerPool::RasterWorkerPool(unsigned int _threadCount)
+	{
+		assert(_threadCount > 0);
+		for (unsigned int i = 0; i < _threadCount; i++)
+			m_threads.emplace_back(&RasterWorkerPool::workerMain, this);
+	}
+
+	RasterWorkerPool::~RasterWorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_jobAvailable.notify_all();
+		for (std::thread& thread : m_threads)
+			thread.join();
+	}
+
+	void RasterWorkerPool::addFont(const FontDataPtr& _fontData)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_fonts.push_back(_fontData);
+	}
+
+	void RasterWorkerPool::setOutlineCache(const std::shared_ptr<OutlineCache>& _outlines)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_outlines = _outlines;
+	}
+
+	void RasterWorkerPool::setStrikeCache(const std::shared_ptr<StrikeCache>& _strikes)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_strikes = _strikes;
+	}
+
+	void RasterWorkerPool::submit(const JobPtr& _job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_queue.push_back(_job);
+		}
+		m_jobAvailable.notify_one();
+	}
+
+	void RasterWorkerPool::submit(const std::vector<JobPtr>& _jobs)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_queue.insert(m_queue.end(), _jobs.begin(), _jobs.end());
+		}
+		m_jobAvailable.notify_all();
+	}
+
+	void RasterWorkerPool::wait(const std::vector<JobPtr>& _jobs)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		for (const JobPtr& job : _jobs)
+			m_jobDone.wait(lock, [&job] { return job->done.load(std::memory_order_acquire); });
+	}
+
+	void RasterWorkerPool::workerMain()
+	{
+		// Without a library, jobs are handed back to the calling thread
+		FT_Library library = nullptr;
+		if (FT_Init_FreeType(&library) != 0)
+			library = nullptr;
+
+		// Faces are opened lazily, the first time a job needs them
+		std::vector<FT_Face> faces;
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		for (;;)
+		{
+			m_jobAvailable.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+			if (m_stop)
+			{
+				// Hand the jobs left behind back to their callers, so that wait() returns
+				for (const JobPtr& job : m_queue)
+				{
+					job->skipped = true;
+					job->done.store(true, std::memory_order_release);
+				}
+				m_queue.clear();
+				m_jobDone.notify_all();
+				break;
+			}
+
+			JobPtr job = m_queue.front();
+			m_queue.pop_front();
+
+			int fontIndex = job->request.fontIndex;
+			if (fontIndex >= static_cast<int>(faces.size()))
+				faces.resize(fontIndex + 1, nullptr);
+			const FontDataPtr fontData = m_fonts[fontIndex];
+			const std::shared_ptr<OutlineCache> outlines = m_outlines;
+			const std::shared_ptr<StrikeCache> strikes = m_strikes;
+			lock.unlock();
+
+			if (faces[fontIndex] == nullptr && library)
+				FT_New_Memory_Face(library, fontData->data(), static_cast<FT_Long>(fontData->size()), 0, &faces[fontIndex]);
+
+			if (library)
+			{
+				auto start = std::chrono::high_resolution_clock::now();
+				job->found = faces[fontIndex] != nullptr && rasterizeGlyph(faces[fontIndex], job->request, job->bitmap, outlines.get(), strikes.get());
+				job->rasterizeMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+			}
+			else
+			{
+				job->skipped = true;
+			}
+
+			lock.lock();
+			job->done.store(true, std::memory_order_release);
+			m_jobDone.notify_all();
+		}
+		lock.unlock();
+
+		for (FT_Face face : faces)
+		{
+			if (face)
+				FT_Done_Face(face);
+		}
+		if (library)
+			FT_Done_FreeType(library);
+	}
+}
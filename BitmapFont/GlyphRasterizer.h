@@ -0,0 +1,174 @@
+#pragma once
+
+#ifndef _GLYPH_RASTERIZER_H_
+#define _GLYPH_RASTERIZER_H_
+
+#include <vector>
+#include <tuple>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "FontRegistry.h"
+#include "OutlineCache.h"
+#include "StrikeCache.h"
+#include "AtlasPage.h"
+
+typedef struct FT_LibraryRec_  *FT_Library;
+typedef struct FT_FaceRec_  *FT_Face;
+
+namespace bmf
+{
+	enum class GlyphMode
+	{
+		Bitmap,	// coverage rendered at the requested size
+		Sdf,	// signed distance field rendered once at the reference size, for every size
+		Msdf,	// multi-channel distance field from the outline, same parameters as Sdf, stored in RGB pages
+		Lcd,	// horizontal subpixel coverage, stored in RGB pages
+		LcdV,	// vertical subpixel coverage, stored in RGB pages
+		Color,	// color glyphs (emoji) stored in BGRA pages, other glyphs as white coverage
+		Mono,	// monochrome hinted and rendered, stored in 1 bit pages
+		Default	// render mode of the font, see RenderOptions
+	};
+
+	inline bool isDistanceField(GlyphMode _mode) { return _mode == GlyphMode::Sdf || _mode == GlyphMode::Msdf; }
+
+	// FIR filter applied by FreeType to LCD glyphs to reduce color fringes.
+	// It has no effect when FreeType is built without subpixel rendering.
+	enum class LcdFilter
+	{
+		None,
+		Default,
+		Light,
+		Legacy
+	};
+
+	// Order of the subpixels of the display, left to right or top to bottom
+	enum class SubpixelOrder
+	{
+		Rgb,
+		Bgr
+	};
+
+	// Grid fitting applied when glyphs are loaded
+	enum class Hinting
+	{
+		Normal,	// native hinter of the font, or the autohinter when it has no instructions
+		Light,	// vertical only autohinting, keeps the glyph shapes
+		Auto,	// forces the autohinter, for faces with poor native hinting
+		None
+	};
+
+	// Per font loading and rendering settings, part of the glyph key so that variants
+	// rendered with different options can be resident at the same time
+	struct RenderOptions
+	{
+		int			loadFlags = 0;	// extra FT_LOAD_XXX flags, FT_LOAD_NO_BITMAP for instance
+		Hinting		hinting = Hinting::Normal;
+		GlyphMode	renderMode = GlyphMode::Bitmap;	// mode of the glyphs requested with GlyphMode::Default
+		bool		embolden = false;	// synthetic bold, ignored by distance fields from outlines and color strikes
+
+		bool operator <(const RenderOptions& b) const
+		{
+			return std::tie(loadFlags, hinting, embolden) < std::tie(b.loadFlags, b.hinting, b.embolden);
+		}
+		bool operator ==(const RenderOptions& b) const { return !(*this < b) && !(b < *this); }
+		bool operator !=(const RenderOptions& b) const { return !(*this == b); }
+	};
+
+	// Identifies a glyph to rasterize and store in the atlas, either by codepoint
+	// or directly by glyph index for callers which already shaped their text
+	struct GlyphRequest
+	{
+		GlyphRequest(int _fontIndex, int _char, int _pixelSize, GlyphMode _mode = GlyphMode::Default) : fontIndex(_fontIndex), unicodeChar(_char), pixelSize(_pixelSize), mode(_mode) {}
+
+		static GlyphRequest fromGlyphIndex(int _fontIndex, unsigned int _glyphIndex, int _pixelSize, GlyphMode _mode = GlyphMode::Default)
+		{
+			GlyphRequest request(_fontIndex, static_cast<int>(_glyphIndex), _pixelSize, _mode);
+			request.byGlyphIndex = true;
+			request.glyphIndex = _glyphIndex;
+			return request;
+		}
+
+		int				fontIndex;
+		int				unicodeChar;	// glyph index when byGlyphIndex is set
+		int				pixelSize;	// reference size for distance fields, set by the cache
+		GlyphMode		mode;
+		int				spread = 0;	// distance field range in pixels, set by the cache
+		LcdFilter		lcdFilter = LcdFilter::None;	// set by the cache for LCD modes
+		SubpixelOrder	subpixelOrder = SubpixelOrder::Rgb;
+		RenderOptions	options;	// options of the font, set by the cache
+		float			strokeWidth = 0.f;	// border in pixels stroked around Bitmap and Sdf glyphs, 0 for the fill
+		bool			byGlyphIndex = false;
+		unsigned int	glyphIndex = 0;	// resolved by the cache before rasterization
+	};
+
+	// Bitmap detached from the FT_GlyphSlot which produced it, tightly packed rows.
+	// Mono1 rows are padded to whole bytes.
+	struct GlyphBitmap
+	{
+		PageFormat					format = PageFormat::Gray8;
+		unsigned int				width = 0;
+		unsigned int				rows = 0;
+		int							left = 0;	// origin of the bitmap from the pen position, as bitmap_left
+		int							top = 0;	// and bitmap_top of FreeType, y up
+		std::vector<unsigned char>	buffer;
+	};
+
+	// Renders the glyph index of the request with the given face, returns false if the glyph is empty.
+	// With an outline cache, unhinted scalable glyphs are rendered from their cached unscaled outline.
+	// Color glyphs of bitmap only fonts are downscaled from the closest larger strike, through
+	// the strike cache when there is one.
+	bool rasterizeGlyph(FT_Face _face, const GlyphRequest& _request, GlyphBitmap& _bitmap, OutlineCache* _outlines = nullptr, StrikeCache* _strikes = nullptr);
+
+	// Rasterizes glyphs on background threads.
+	// A FT_Face can't be used by several threads, so every worker owns its FT_Library
+	// and opens its own face on the shared font data registered with addFont().
+	class RasterWorkerPool
+	{
+	public:
+		struct Job
+		{
+			explicit Job(const GlyphRequest& _request) : request(_request) {}
+
+			GlyphRequest		request;
+			GlyphBitmap			bitmap;
+			bool				found = false;
+			bool				skipped = false;	// no worker rasterized it (no FreeType library, or the pool stopped), to rasterize on the calling thread
+			float				rasterizeMs = 0.f;
+			std::atomic<bool>	done{ false };
+		};
+		typedef std::shared_ptr<Job> JobPtr;
+
+		explicit RasterWorkerPool(unsigned int _threadCount);
+		~RasterWorkerPool();
+
+		unsigned int getThreadCount() const { return m_threads.size(); }
+
+		// Fonts must be added in the same order as BitmapFontCache::loadFont so indices match
+		void addFont(const FontDataPtr& _fontData);
+		void setOutlineCache(const std::shared_ptr<OutlineCache>& _outlines);
+		void setStrikeCache(const std::shared_ptr<StrikeCache>& _strikes);
+
+		void submit(const JobPtr& _job);
+		void submit(const std::vector<JobPtr>& _jobs);
+		void wait(const std::vector<JobPtr>& _jobs);
+
+	private:
+		void workerMain();
+
+		std::vector<std::thread>	m_threads;
+		std::deque<JobPtr>			m_queue;
+		std::vector<FontDataPtr>	m_fonts;
+		std::shared_ptr<OutlineCache>	m_outlines;
+		std::shared_ptr<StrikeCache>	m_strikes;
+		std::mutex					m_mutex;
+		std::condition_variable		m_jobAvailable;
+		std::condition_variable		m_jobDone;
+		bool						m_stop = false;
+	};
+}
+
+#endif
@@ -0,0 +1,95 @@
+#pragma once
+
+#ifndef _LRU_CACHE_H_
+#define _LRU_CACHE_H_
+
+#include <map>
+#include <list>
+#include <mutex>
+
+namespace bmf
+{
+	// Values keyed by Key, the least recently used being dropped when their memory exceeds the
+	// budget. Value is a shared pointer, so that a dropped value outlives the callers still using
+	// it. Shared by the raster workers, hence the lock.
+	template<typename Key, typename Value>
+	class LruCache
+	{
+	public:
+		explicit LruCache(size_t _budget) : m_budget(_budget) {}
+
+		// Returns nullptr if the key is not cached
+		Value find(const Key& _key)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto it = m_values.find(_key);
+			if (it == m_values.end())
+			{
+				m_missesCount++;
+				return nullptr;
+			}
+
+			m_hitsCount++;
+			m_lru.splice(m_lru.begin(), m_lru, it->second.lruPosition);
+			return it->second.value;
+		}
+
+		// _memorySize is what the value weighs against the budget, a key already cached is kept as is
+		void insert(const Key& _key, const Value& _value, size_t _memorySize)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_values.find(_key) != m_values.end())
+				return;
+
+			m_lru.push_front(_key);
+			Entry& entry = m_values[_key];
+			entry.value = _value;
+			entry.memorySize = _memorySize;
+			entry.lruPosition = m_lru.begin();
+			m_memoryUsage += _memorySize;
+			trim();
+		}
+
+		void setBudget(size_t _budget)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_budget = _budget;
+			trim();
+		}
+
+		size_t getBudget() const { return m_budget; }
+		size_t getMemoryUsage() const { return m_memoryUsage; }
+		unsigned int getCount() const { return m_values.size(); }
+		unsigned int getHitsCount() const { return m_hitsCount; }
+		unsigned int getMissesCount() const { return m_missesCount; }
+
+	private:
+		struct Entry
+		{
+			Value								value;
+			size_t								memorySize = 0;
+			typename std::list<Key>::iterator	lruPosition;
+		};
+
+		void trim()
+		{
+			while (m_memoryUsage > m_budget && !m_lru.empty())
+			{
+				auto it = m_values.find(m_lru.back());
+				m_memoryUsage -= it->second.memorySize;
+				m_values.erase(it);
+				m_lru.pop_back();
+			}
+		}
+
+		std::mutex				m_mutex;
+		std::map<Key, Entry>	m_values;
+		std::list<Key>			m_lru;	// most recently used first
+		size_t					m_budget;
+		size_t					m_memoryUsage = 0;
+		unsigned int			m_hitsCount = 0;
+		unsigned int			m_missesCount = 0;
+	};
+}
+
+#endif
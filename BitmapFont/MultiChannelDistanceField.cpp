@@ -0,0 +1,425 @@
+#include "stdafx.h"
+#include "MultiChannelDistanceField.h"
+#include "GlyphRasterizer.h"
+#include "OutlineCache.h"
+
+#include <cmath>
+#include <cfloat>
+#include <vector>
+#include <algorithm>
+
+#include <ft2build.h>
+#include <freetype/freetype.h>
+#include <freetype/ftoutln.h>
+
+namespace bmf
+{
+	namespace
+	{
+		struct Vector2
+		{
+			Vector2(double _x = 0.0, double _y = 0.0) : x(_x), y(_y) {}
+
+			Vector2 operator+(const Vector2& _b) const { return Vector2(x + _b.x, y + _b.y); }
+			Vector2 operator-(const Vector2& _b) const { return Vector2(x - _b.x, y - _b.y); }
+			Vector2 operator*(double _s) const { return Vector2(x * _s, y * _s); }
+			bool operator==(const Vector2& _b) const { return x == _b.x && y == _b.y; }
+
+			double length() const { return std::sqrt(x * x + y * y); }
+			Vector2 normalize() const
+			{
+				double len = length();
+				return len == 0.0 ? Vector2(0.0, 1.0) : Vector2(x / len, y / len);
+			}
+
+			double x, y;
+		};
+
+		Vector2 operator*(double _s, const Vector2& _v) { return _v * _s; }
+		double dot(const Vector2& _a, const Vector2& _b) { return _a.x * _b.x + _a.y * _b.y; }
+		double cross(const Vector2& _a, const Vector2& _b) { return _a.x * _b.y - _a.y * _b.x; }
+		int nonZeroSign(double _value) { return _value > 0.0 ? 1 : -1; }
+
+		// Channels combination of an edge, the channels shared by two edges meeting at a corner
+		// are what keeps it sharp
+		enum EdgeColor
+		{
+			Red = 1,
+			Green = 2,
+			Yellow = 3,
+			Blue = 4,
+			Magenta = 5,
+			Cyan = 6,
+			White = 7
+		};
+
+		struct SignedDistance
+		{
+			SignedDistance(double _distance = -DBL_MAX, double _dot = 1.0) : distance(_distance), dot(_dot) {}
+
+			// Ties are resolved in favor of the edge the most orthogonal to the direction of the point
+			bool operator<(const SignedDistance& _b) const
+			{
+				return std::fabs(distance) < std::fabs(_b.distance) || (std::fabs(distance) == std::fabs(_b.distance) && dot < _b.dot);
+			}
+
+			double distance;
+			double dot;
+		};
+
+		// Linear or cubic segment, quadratic segments are elevated to cubic
+		struct Edge
+		{
+			Vector2 point(double _t) const
+			{
+				if (degree == 1)
+					return p[0] + _t * (p[1] - p[0]);
+				double u = 1.0 - _t;
+				return u * u * u * p[0] + 3.0 * u * u * _t * p[1] + 3.0 * u * _t * _t * p[2] + _t * _t * _t * p[3];
+			}
+
+			Vector2 direction(double _t) const
+			{
+				if (degree == 1)
+					return p[1] - p[0];
+				double u = 1.0 - _t;
+				Vector2 tangent = 3.0 * u * u * (p[1] - p[0]) + 6.0 * u * _t * (p[2] - p[1]) + 3.0 * _t * _t * (p[3] - p[2]);
+				if (tangent == Vector2())
+				{
+					// Control point merged with an end point
+					if (_t == 0.0)
+						return p[2] - p[0];
+					if (_t == 1.0)
+						return p[3] - p[1];
+				}
+				return tangent;
+			}
+
+			Vector2 end() const { return p[degree]; }
+
+			SignedDistance signedDistance(const Vector2& _origin, double& _param) const
+			{
+				if (degree == 1)
+				{
+					Vector2 aq = _origin - p[0];
+					Vector2 ab = p[1] - p[0];
+					_param = dot(aq, ab) / dot(ab, ab);
+					Vector2 eq = (_param > 0.5 ? p[1] : p[0]) - _origin;
+					double endpointDistance = eq.length();
+					if (_param > 0.0 && _param < 1.0)
+					{
+						Vector2 normal = Vector2(ab.y, -ab.x).normalize();
+						double orthoDistance = dot(normal, aq);
+						if (std::fabs(orthoDistance) < endpointDistance)
+							return SignedDistance(orthoDistance, 0.0);
+					}
+					return SignedDistance(nonZeroSign(cross(aq, ab)) * endpointDistance, std::fabs(dot(ab.normalize(), eq.normalize())));
+				}
+
+				// Newton iterations from a few starting points on the curve
+				const int SEARCH_STARTS = 4;
+				const int SEARCH_STEPS = 4;
+				Vector2 qa = p[0] - _origin;
+				Vector2 ab = p[1] - p[0];
+				Vector2 br = p[2] - p[1] - ab;
+				Vector2 as = (p[3] - p[2]) - (p[2] - p[1]) - br;
+
+				Vector2 epDir = direction(0.0);
+				double minDistance = nonZeroSign(cross(epDir, qa)) * qa.length();
+				_param = -dot(qa, epDir) / dot(epDir, epDir);
+				{
+					epDir = direction(1.0);
+					Vector2 qd = p[3] - _origin;
+					double distance = qd.length();
+					if (distance < std::fabs(minDistance))
+					{
+						minDistance = nonZeroSign(cross(epDir, qd)) * distance;
+						_param = dot(epDir - qd, epDir) / dot(epDir, epDir);
+					}
+				}
+				for (int i = 0; i <= SEARCH_STARTS; i++)
+				{
+					double t = static_cast<double>(i) / SEARCH_STARTS;
+					Vector2 qe = qa + 3.0 * t * ab + 3.0 * t * t * br + t * t * t * as;
+					for (int step = 0; step < SEARCH_STEPS; step++)
+					{
+						Vector2 d1 = 3.0 * ab + 6.0 * t * br + 3.0 * t * t * as;
+						Vector2 d2 = 6.0 * br + 6.0 * t * as;
+						t -= dot(qe, d1) / (dot(d1, d1) + dot(qe, d2));
+						if (t <= 0.0 || t >= 1.0)
+							break;
+						qe = qa + 3.0 * t * ab + 3.0 * t * t * br + t * t * t * as;
+						double distance = qe.length();
+						if (distance < std::fabs(minDistance))
+						{
+							minDistance = nonZeroSign(cross(direction(t), qe)) * distance;
+							_param = t;
+						}
+					}
+				}
+
+				if (_param >= 0.0 && _param <= 1.0)
+					return SignedDistance(minDistance, 0.0);
+				if (_param < 0.5)
+					return SignedDistance(minDistance, std::fabs(dot(direction(0.0).normalize(), qa.normalize())));
+				return SignedDistance(minDistance, std::fabs(dot(direction(1.0).normalize(), (p[3] - _origin).normalize())));
+			}
+
+			// Beyond its end points, the distance to the edge is measured to its tangent line
+			void distanceToPseudoDistance(SignedDistance& _distance, const Vector2& _origin, double _param) const
+			{
+				if (_param < 0.0)
+				{
+					Vector2 dir = direction(0.0).normalize();
+					Vector2 aq = _origin - p[0];
+					if (dot(aq, dir) < 0.0)
+					{
+						double pseudoDistance = cross(aq, dir);
+						if (std::fabs(pseudoDistance) <= std::fabs(_distance.distance))
+							_distance = SignedDistance(pseudoDistance, 0.0);
+					}
+				}
+				else if (_param > 1.0)
+				{
+					Vector2 dir = direction(1.0).normalize();
+					Vector2 bq = _origin - end();
+					if (dot(bq, dir) > 0.0)
+					{
+						double pseudoDistance = cross(bq, dir);
+						if (std::fabs(pseudoDistance) <= std::fabs(_distance.distance))
+							_distance = SignedDistance(pseudoDistance, 0.0);
+					}
+				}
+			}
+
+			int		degree = 1;
+			Vector2	p[4];
+			int		color = White;
+		};
+
+		typedef std::vector<Edge> Contour;
+
+		struct ShapeBuilder
+		{
+			std::vector<Contour>	contours;
+			Vector2					current;
+			double					scale;
+
+			Vector2 toPixels(const FT_Vector* _v) const { return Vector2(_v->x * scale, _v->y * scale); }
+
+			static int moveTo(const FT_Vector* _to, void* _user)
+			{
+				ShapeBuilder* builder = static_cast<ShapeBuilder*>(_user);
+				builder->contours.push_back(Contour());
+				builder->current = builder->toPixels(_to);
+				return 0;
+			}
+
+			static int lineTo(const FT_Vector* _to, void* _user)
+			{
+				ShapeBuilder* builder = static_cast<ShapeBuilder*>(_user);
+				Vector2 to = builder->toPixels(_to);
+				if (!(to == builder->current))
+				{
+					Edge edge;
+					edge.p[0] = builder->current;
+					edge.p[1] = to;
+					builder->contours.back().push_back(edge);
+				}
+				builder->current = to;
+				return 0;
+			}
+
+			static int conicTo(const FT_Vector* _control, const FT_Vector* _to, void* _user)
+			{
+				ShapeBuilder* builder = static_cast<ShapeBuilder*>(_user);
+				Vector2 control = builder->toPixels(_control);
+				Vector2 to = builder->toPixels(_to);
+				Edge edge;
+				edge.degree = 3;
+				edge.p[0] = builder->current;
+				edge.p[1] = builder->current + (2.0 / 3.0) * (control - builder->current);
+				edge.p[2] = to + (2.0 / 3.0) * (control - to);
+				edge.p[3] = to;
+				builder->contours.back().push_back(edge);
+				builder->current = to;
+				return 0;
+			}
+
+			static int cubicTo(const FT_Vector* _control1, const FT_Vector* _control2, const FT_Vector* _to, void* _user)
+			{
+				ShapeBuilder* builder = static_cast<ShapeBuilder*>(_user);
+				Edge edge;
+				edge.degree = 3;
+				edge.p[0] = builder->current;
+				edge.p[1] = builder->toPixels(_control1);
+				edge.p[2] = builder->toPixels(_control2);
+				edge.p[3] = builder->toPixels(_to);
+				builder->contours.back().push_back(edge);
+				builder->current = edge.p[3];
+				return 0;
+			}
+		};
+
+		bool isCorner(const Vector2& _a, const Vector2& _b, double _crossThreshold)
+		{
+			return dot(_a, _b) <= 0.0 || std::fabs(cross(_a, _b)) > _crossThreshold;
+		}
+
+		int symmetricalTrichotomy(int _position, int _n)
+		{
+			return static_cast<int>(3 + 2.875 * _position / (_n - 1) - 1.4375 + 0.5) - 3;
+		}
+
+		// Edges between two corners share a color, consecutive ones have different colors
+		void colorEdges(Contour& _contour)
+		{
+			const double crossThreshold = std::sin(3.0);
+
+			std::vector<int> corners;
+			Vector2 previousDirection = _contour.back().direction(1.0);
+			for (size_t i = 0; i < _contour.size(); i++)
+			{
+				if (isCorner(previousDirection.normalize(), _contour[i].direction(0.0).normalize(), crossThreshold))
+					corners.push_back(static_cast<int>(i));
+				previousDirection = _contour[i].direction(1.0);
+			}
+
+			const int m = static_cast<int>(_contour.size());
+			if (corners.empty() || (corners.size() == 1 && m < 3))
+			{
+				// Smooth contour
+				for (Edge& edge : _contour)
+					edge.color = White;
+			}
+			else if (corners.size() == 1)
+			{
+				// Teardrop: the edges around the single corner get two different colors
+				const int colors[] = { Magenta, White, Yellow };
+				for (int i = 0; i < m; i++)
+					_contour[(corners[0] + i) % m].color = colors[1 + symmetricalTrichotomy(i, m)];
+			}
+			else
+			{
+				const int colors[] = { Cyan, Magenta, Yellow };
+				const int cornerCount = static_cast<int>(corners.size());
+				int spline = 0;
+				for (int i = 0; i < m; i++)
+				{
+					int index = (corners[0] + i) % m;
+					if (spline + 1 < cornerCount && corners[spline + 1] == index)
+						spline++;
+					// The last spline must differ from the first one too
+					bool lastSpline = cornerCount % 3 == 1 && spline == cornerCount - 1;
+					_contour[index].color = lastSpline ? colors[1] : colors[spline % 3];
+				}
+			}
+		}
+	}
+
+	bool generateMsdf(const GlyphOutline& _outline, int _pixelSize, int _spread, GlyphBitmap& _msdf)
+	{
+		std::vector<FT_Vector> points(_outline.points.size() / 2);
+		for (size_t i = 0; i < points.size(); i++)
+		{
+			points[i].x = _outline.points[i * 2];
+			points[i].y = _outline.points[i * 2 + 1];
+		}
+		std::vector<char> tags(_outline.tags);
+		std::vector<short> contours(_outline.contours);
+
+		FT_Outline outline;
+		outline.n_points = static_cast<short>(points.size());
+		outline.n_contours = static_cast<short>(contours.size());
+		outline.points = points.data();
+		outline.tags = tags.data();
+		outline.contours = contours.data();
+		outline.flags = _outline.flags;
+
+		ShapeBuilder shape;
+		shape.scale = static_cast<double>(_pixelSize) / _outline.unitsPerEm;
+		FT_Outline_Funcs funcs = {};
+		funcs.move_to = &ShapeBuilder::moveTo;
+		funcs.line_to = &ShapeBuilder::lineTo;
+		funcs.conic_to = &ShapeBuilder::conicTo;
+		funcs.cubic_to = &ShapeBuilder::cubicTo;
+		if (outline.n_contours == 0 || FT_Outline_Decompose(&outline, &funcs, &shape) != 0)
+			return false;
+
+		shape.contours.erase(std::remove_if(shape.contours.begin(), shape.contours.end(), [](const Contour& _c) { return _c.empty(); }), shape.contours.end());
+		if (shape.contours.empty())
+			return false;
+
+		// Bounds, and orientation from the area of the control polygons
+		double xMin = DBL_MAX, yMin = DBL_MAX, xMax = -DBL_MAX, yMax = -DBL_MAX;
+		double area = 0.0;
+		for (Contour& contour : shape.contours)
+		{
+			colorEdges(contour);
+			for (const Edge& edge : contour)
+			{
+				for (int i = 0; i <= edge.degree; i++)
+				{
+					xMin = std::min(xMin, edge.p[i].x);
+					yMin = std::min(yMin, edge.p[i].y);
+					xMax = std::max(xMax, edge.p[i].x);
+					yMax = std::max(yMax, edge.p[i].y);
+				}
+				area += cross(edge.p[0], edge.end());
+			}
+		}
+
+		// TrueType outer contours are clockwise, PostScript ones counter-clockwise
+		const double sign = area < 0.0 ? 1.0 : -1.0;
+
+		const int left = static_cast<int>(std::floor(xMin)) - _spread;
+		const int top = static_cast<int>(std::ceil(yMax)) + _spread;
+		_msdf.format = PageFormat::Rgb8;
+		_msdf.width = static_cast<unsigned int>(std::ceil(xMax) - std::floor(xMin)) + 2 * _spread;
+		_msdf.rows = static_cast<unsigned int>(std::ceil(yMax) - std::floor(yMin)) + 2 * _spread;
+		_msdf.left = left;
+		_msdf.top = top;
+		_msdf.buffer.resize(_msdf.width * _msdf.rows * 3);
+
+		const double toValue = sign * 127.0 / _spread;
+		const int channels[] = { Red, Green, Blue };
+		for (unsigned int y = 0; y < _msdf.rows; y++)
+		{
+			for (unsigned int x = 0; x < _msdf.width; x++)
+			{
+				Vector2 p(left + x + 0.5, top - (y + 0.5));
+
+				SignedDistance nearest[3];
+				const Edge* nearestEdge[3] = { nullptr, nullptr, nullptr };
+				double nearestParam[3] = { 0.0, 0.0, 0.0 };
+				for (const Contour& contour : shape.contours)
+				{
+					for (const Edge& edge : contour)
+					{
+						double param;
+						SignedDistance distance = edge.signedDistance(p, param);
+						for (int c = 0; c < 3; c++)
+						{
+							if ((edge.color & channels[c]) && distance < nearest[c])
+							{
+								nearest[c] = distance;
+								nearestEdge[c] = &edge;
+								nearestParam[c] = param;
+							}
+						}
+					}
+				}
+
+				unsigned char* pixel = &_msdf.buffer[(x + y * _msdf.width) * 3];
+				for (int c = 0; c < 3; c++)
+				{
+					if (nearestEdge[c])
+						nearestEdge[c]->distanceToPseudoDistance(nearest[c], p, nearestParam[c]);
+					double value = 128.0 + nearest[c].distance * toValue;
+					pixel[c] = static_cast<unsigned char>(std::min(255.0, std::max(0.0, value + 0.5)));
+				}
+			}
+		}
+		return true;
+	}
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#ifndef _MULTI_CHANNEL_DISTANCE_FIELD_H_
+#define _MULTI_CHANNEL_DISTANCE_FIELD_H_
+
+namespace bmf
+{
+	struct GlyphBitmap;
+	struct GlyphOutline;
+
+	// Renders a 3 channels distance field of the outline scaled to _pixelSize, grown by _spread
+	// pixels on each side, with the same value mapping as generateSdf. Edges are colored so that
+	// the median of the channels keeps corners sharp when magnified.
+	// Returns false if the outline is empty.
+	bool generateMsdf(const GlyphOutline& _outline, int _pixelSize, int _spread, GlyphBitmap& _msdf);
+}
+
+#endif
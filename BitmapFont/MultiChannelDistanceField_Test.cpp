@@ -0,0 +1,145 @@
+#include "stdafx.h"
+#include "MultiChannelDistanceField.h"
+#include "GlyphRasterizer.h"
+#include "OutlineCache.h"
+#include "BitmapFontCache.h"
+
+#include "catch.hpp"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include <ft2build.h>
+#include <freetype/freetype.h>
+
+namespace bmf
+{
+	TEST_CASE("Multi-channel distance field generation", "[MultiChannelDistanceField]")
+	{
+		FT_Library library;
+		REQUIRE(FT_Init_FreeType(&library) == 0);
+		FT_Face face;
+		REQUIRE(FT_New_Face(library, "C:/windows/fonts/arial.ttf", 0, &face) == 0);
+
+		const int size = 32;
+		const int spread = 4;
+		auto median = [](const unsigned char* _p) { return std::max(std::min(_p[0], _p[1]), std::min(std::max(_p[0], _p[1]), _p[2])); };
+
+		SECTION("Median follows the outline")
+		{
+			GlyphOutlinePtr outline = loadGlyphOutline(face, FT_Get_Char_Index(face, 'O'));
+			REQUIRE(outline != nullptr);
+
+			GlyphBitmap coverage, msdf;
+			REQUIRE(rasterizeOutline(library, *outline, size, coverage));
+			REQUIRE(generateMsdf(*outline, size, spread, msdf));
+			REQUIRE(msdf.format == PageFormat::Rgb8);
+			REQUIRE(msdf.buffer.size() == msdf.width * msdf.rows * 3);
+			REQUIRE(std::abs(static_cast<int>(msdf.width - 2 * spread) - static_cast<int>(coverage.width)) <= 1);
+			REQUIRE(std::abs(static_cast<int>(msdf.rows - 2 * spread) - static_cast<int>(coverage.rows)) <= 1);
+
+			auto pixel = [&](int _x, int _y) { return &msdf.buffer[(_x + _y * msdf.width) * 3]; };
+
+			// Corners are further than the spread, the hole of the 'O' is outside, its left stroke inside
+			REQUIRE(median(pixel(0, 0)) == 0);
+			int middleY = msdf.rows / 2;
+			REQUIRE(median(pixel(msdf.width / 2, middleY)) < 128);
+			unsigned char strokeMax = 0;
+			for (unsigned int x = 0; x < msdf.width / 3; x++)
+				strokeMax = std::max(strokeMax, median(pixel(x, middleY)));
+			REQUIRE(strokeMax > 128);
+
+			// Smooth contours don't need several channels
+			for (unsigned int i = 0; i < msdf.width * msdf.rows; i++)
+			{
+				REQUIRE(msdf.buffer[i * 3] == msdf.buffer[i * 3 + 1]);
+				REQUIRE(msdf.buffer[i * 3] == msdf.buffer[i * 3 + 2]);
+			}
+		}
+
+		SECTION("Corners are encoded in different channels")
+		{
+			GlyphOutlinePtr outline = loadGlyphOutline(face, FT_Get_Char_Index(face, 'H'));
+			REQUIRE(outline != nullptr);
+
+			GlyphBitmap msdf;
+			REQUIRE(generateMsdf(*outline, size, spread, msdf));
+
+			bool channelsDiffer = false;
+			for (unsigned int i = 0; i < msdf.width * msdf.rows; i++)
+				channelsDiffer |= msdf.buffer[i * 3] != msdf.buffer[i * 3 + 1] || msdf.buffer[i * 3] != msdf.buffer[i * 3 + 2];
+			REQUIRE(channelsDiffer);
+
+			// The middle of the left stem is inside
+			const unsigned char* p = &msdf.buffer[(spread + 2 + msdf.rows / 4 * msdf.width) * 3];
+			REQUIRE(median(p) > 128);
+		}
+
+		SECTION("Empty outlines have no field")
+		{
+			GlyphOutlinePtr outline = loadGlyphOutline(face, FT_Get_Char_Index(face, ' '));
+			GlyphBitmap msdf;
+			REQUIRE((outline == nullptr || !generateMsdf(*outline, size, spread, msdf)));
+		}
+
+		SECTION("The cache stores them in RGB pages")
+		{
+			BitmapFontCache bitmapCache(library);
+			bitmapCache.loadFont("C:/windows/fonts/arial.ttf");
+			REQUIRE(bitmapCache.getPageCount() == POOL_COUNT);
+
+			REQUIRE(bitmapCache.addGlyph(0, 'A', 12) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.addGlyph(0, 'A', 12, GlyphMode::Msdf) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.addGlyph(0, 'A', 64, GlyphMode::Msdf) == BitmapFontCache::AlreadyAdded);
+			REQUIRE(bitmapCache.addGlyph(0, 'B', 12, GlyphMode::Msdf) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getPageCount() == POOL_COUNT + 1);
+
+			Rect rect;
+			unsigned int pageIndex = 0;
+			REQUIRE(bitmapCache.getGlyphRect(GlyphRequest(0, 'B', 20, GlyphMode::Msdf), rect, &pageIndex));
+			const AtlasPage& page = bitmapCache.getPage(pageIndex);
+			REQUIRE(page.getFormat() == PageFormat::Rgb8);
+			REQUIRE(page.getPitch() == page.getWidth() * 3);
+
+			// The left stem of the 'B' is inside
+			const unsigned char* row = page.getData() + (rect.top() + rect.height() / 2) * page.getPitch();
+			unsigned char stemMax = 0;
+			for (int x = rect.left(); x < rect.left() + static_cast<int>(rect.width()) / 3; x++)
+				stemMax = std::max(stemMax, median(row + x * 3));
+			REQUIRE(stemMax > 128);
+
+			REQUIRE(bitmapCache.removeGlyph(0, 'B', 12, GlyphMode::Msdf) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getGlyphsCount() == 2);
+		}
+
+		FT_Done_Face(face);
+		FT_Done_FreeType(library);
+	}
+
+	TEST_CASE("Multi-channel distance field throughput", "[.][benchmark]")
+	{
+		FT_Library library;
+		REQUIRE(FT_Init_FreeType(&library) == 0);
+
+		std::vector<GlyphRequest> requests;
+		for (int c = 0x21; c < 0x7F; c++)
+			requests.push_back(GlyphRequest(0, c, 32, GlyphMode::Msdf));
+		for (int c = 0xC0; c < 0x180; c++)
+			requests.push_back(GlyphRequest(0, c, 32, GlyphMode::Msdf));
+
+		unsigned int threadCounts[] = { 0, 1, std::thread::hardware_concurrency() };
+		for (unsigned int threadCount : threadCounts)
+		{
+			BitmapFontCache bitmapCache(library);
+			bitmapCache.setRasterThreadCount(threadCount);
+			REQUIRE(bitmapCache.loadFont("C:/windows/fonts/arial.ttf") == 0);
+
+			auto start = std::chrono::high_resolution_clock::now();
+			unsigned int added = bitmapCache.addGlyphs(requests);
+			double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+			WARN(threadCount << " worker(s): " << added << " glyphs, " << added / seconds << " glyphs/s");
+		}
+
+		FT_Done_FreeType(library);
+	}
+}
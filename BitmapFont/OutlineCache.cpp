@@ -0,0 +1,85 @@
+#include "stdafx.h"
+#include "OutlineCache.h"
+#include "GlyphRasterizer.h"
+
+#include <ft2build.h>
+#include <freetype/freetype.h>
+#include <freetype/ftoutln.h>
+
+namespace bmf
+{
+	GlyphOutlinePtr loadGlyphOutline(FT_Face _face, unsigned int _glyphIndex)
+	{
+		if (!FT_IS_SCALABLE(_face) || FT_Load_Glyph(_face, _glyphIndex, FT_LOAD_NO_SCALE) != 0)
+			return nullptr;
+
+		FT_GlyphSlot slot = _face->glyph;
+		if (slot->format != FT_GLYPH_FORMAT_OUTLINE)
+			return nullptr;
+
+		const FT_Outline& source = slot->outline;
+		std::shared_ptr<GlyphOutline> outline = std::make_shared<GlyphOutline>();
+		outline->points.resize(source.n_points * 2);
+		for (int i = 0; i < source.n_points; i++)
+		{
+			outline->points[i * 2] = source.points[i].x;
+			outline->points[i * 2 + 1] = source.points[i].y;
+		}
+		outline->tags.assign(source.tags, source.tags + source.n_points);
+		outline->contours.assign(source.contours, source.contours + source.n_contours);
+		outline->flags = source.flags;
+		outline->unitsPerEm = _face->units_per_EM;
+		return outline;
+	}
+
+	bool rasterizeOutline(FT_Library _library, const GlyphOutline& _outline, int _pixelSize, GlyphBitmap& _bitmap)
+	{
+		if (_outline.contours.empty())
+			return false;
+
+		// Same scaling as FT_Set_Pixel_Sizes, from font units to 26.6
+		FT_Fixed scale = FT_DivFix(_pixelSize * 64, _outline.unitsPerEm);
+		std::vector<FT_Vector> points(_outline.points.size() / 2);
+		for (size_t i = 0; i < points.size(); i++)
+		{
+			points[i].x = FT_MulFix(_outline.points[i * 2], scale);
+			points[i].y = FT_MulFix(_outline.points[i * 2 + 1], scale);
+		}
+		std::vector<char> tags(_outline.tags);
+		std::vector<short> contours(_outline.contours);
+
+		FT_Outline outline;
+		outline.n_points = static_cast<short>(points.size());
+		outline.n_contours = static_cast<short>(contours.size());
+		outline.points = points.data();
+		outline.tags = tags.data();
+		outline.contours = contours.data();
+		outline.flags = _outline.flags;
+
+		// Snap the control box to the pixel grid, as the smooth renderer does
+		FT_BBox cbox;
+		FT_Outline_Get_CBox(&outline, &cbox);
+		cbox.xMin = cbox.xMin & ~63;
+		cbox.yMin = cbox.yMin & ~63;
+		cbox.xMax = (cbox.xMax + 63) & ~63;
+		cbox.yMax = (cbox.yMax + 63) & ~63;
+		if (cbox.xMax <= cbox.xMin || cbox.yMax <= cbox.yMin)
+			return false;
+		FT_Outline_Translate(&outline, -cbox.xMin, -cbox.yMin);
+
+		_bitmap.width = static_cast<unsigned int>((cbox.xMax - cbox.xMin) >> 6);
+		_bitmap.rows = static_cast<unsigned int>((cbox.yMax - cbox.yMin) >> 6);
+		_bitmap.left = static_cast<int>(cbox.xMin >> 6);
+		_bitmap.top = static_cast<int>(cbox.yMax >> 6);
+		_bitmap.buffer.assign(_bitmap.width * _bitmap.rows, 0);
+
+		FT_Bitmap target = {};
+		target.width = _bitmap.width;
+		target.rows = _bitmap.rows;
+		target.pitch = static_cast<int>(_bitmap.width);
+		target.buffer = _bitmap.buffer.data();
+		target.num_grays = 256;
+		target.pixel_mode = FT_PIXEL_MODE_GRAY;
+		return FT_Outline_Get_Bitmap(_library, &outline, &target) == 0;
+	}
+}
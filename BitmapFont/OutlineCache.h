@@ -0,0 +1,64 @@
+#pragma once
+
+#ifndef _OUTLINE_CACHE_H_
+#define _OUTLINE_CACHE_H_
+
+#include <vector>
+#include <memory>
+
+#include "LruCache.h"
+
+typedef struct FT_LibraryRec_  *FT_Library;
+typedef struct FT_FaceRec_  *FT_Face;
+
+namespace bmf
+{
+	struct GlyphBitmap;
+
+	// Decomposed outline of a glyph, in font units
+	struct GlyphOutline
+	{
+		std::vector<long>	points;		// x, y pairs
+		std::vector<char>	tags;
+		std::vector<short>	contours;
+		int					flags = 0;
+		int					unitsPerEm = 0;
+
+		size_t getMemorySize() const
+		{
+			return sizeof(GlyphOutline) + points.size() * sizeof(long) + tags.size() + contours.size() * sizeof(short);
+		}
+	};
+	typedef std::shared_ptr<const GlyphOutline> GlyphOutlinePtr;
+
+	// Returns nullptr if the glyph has no outline (bitmap only fonts)
+	GlyphOutlinePtr loadGlyphOutline(FT_Face _face, unsigned int _glyphIndex);
+
+	// Scales the outline to the pixel size and renders it, returns false if the glyph is empty
+	bool rasterizeOutline(FT_Library _library, const GlyphOutline& _outline, int _pixelSize, GlyphBitmap& _bitmap);
+
+	// Unscaled outlines keyed by (font, glyph index), so that a glyph requested at many sizes
+	// is parsed from the font only once, within a memory budget (see LruCache)
+	class OutlineCache
+	{
+	public:
+		explicit OutlineCache(size_t _budget) : m_outlines(_budget) {}
+
+		GlyphOutlinePtr find(int _fontIndex, unsigned int _glyphIndex) { return m_outlines.find(Key(_fontIndex, _glyphIndex)); }
+		void insert(int _fontIndex, unsigned int _glyphIndex, const GlyphOutlinePtr& _outline) { m_outlines.insert(Key(_fontIndex, _glyphIndex), _outline, _outline->getMemorySize()); }
+
+		void setBudget(size_t _budget) { m_outlines.setBudget(_budget); }
+		size_t getBudget() const { return m_outlines.getBudget(); }
+		size_t getMemoryUsage() const { return m_outlines.getMemoryUsage(); }
+		unsigned int getOutlinesCount() const { return m_outlines.getCount(); }
+		unsigned int getHitsCount() const { return m_outlines.getHitsCount(); }
+		unsigned int getMissesCount() const { return m_outlines.getMissesCount(); }
+
+	private:
+		typedef std::pair<int, unsigned int> Key;
+
+		LruCache<Key, GlyphOutlinePtr>	m_outlines;
+	};
+}
+
+#endif
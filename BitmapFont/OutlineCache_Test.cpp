@@ -0,0 +1,121 @@
+#include "stdafx.h"
+#include "OutlineCache.h"
+#include "GlyphRasterizer.h"
+#include "BitmapFontCache.h"
+
+#include "catch.hpp"
+#include <cstdlib>
+
+#include <ft2build.h>
+#include <freetype/freetype.h>
+
+namespace bmf
+{
+	TEST_CASE("Outline cache works properly", "[OutlineCache]")
+	{
+		FT_Library library;
+		REQUIRE(FT_Init_FreeType(&library) == 0);
+		FT_Face face;
+		REQUIRE(FT_New_Face(library, "C:/windows/fonts/arial.ttf", 0, &face) == 0);
+		unsigned int glyphA = FT_Get_Char_Index(face, 'a');
+		unsigned int glyphB = FT_Get_Char_Index(face, 'b');
+
+		SECTION("Scaled outlines match FreeType rendering")
+		{
+			GlyphOutlinePtr outline = loadGlyphOutline(face, glyphA);
+			REQUIRE(outline != nullptr);
+			REQUIRE(outline->unitsPerEm == face->units_per_EM);
+
+			for (int size : { 12, 18, 32, 64 })
+			{
+				GlyphBitmap bitmap;
+				REQUIRE(rasterizeOutline(library, *outline, size, bitmap));
+
+				FT_Set_Pixel_Sizes(face, 0, size);
+				REQUIRE(FT_Load_Glyph(face, glyphA, FT_LOAD_RENDER | FT_LOAD_NO_HINTING) == 0);
+				REQUIRE(std::abs(static_cast<int>(bitmap.width) - static_cast<int>(face->glyph->bitmap.width)) <= 1);
+				REQUIRE(std::abs(static_cast<int>(bitmap.rows) - static_cast<int>(face->glyph->bitmap.rows)) <= 1);
+			}
+
+			GlyphOutlinePtr space = loadGlyphOutline(face, FT_Get_Char_Index(face, ' '));
+			REQUIRE(space != nullptr);
+			GlyphBitmap bitmap;
+			REQUIRE(!rasterizeOutline(library, *space, 18, bitmap));
+		}
+
+		SECTION("Least recently used outlines are dropped beyond the budget")
+		{
+			GlyphOutlinePtr outlineA = loadGlyphOutline(face, glyphA);
+			GlyphOutlinePtr outlineB = loadGlyphOutline(face, glyphB);
+
+			OutlineCache cache(outlineA->getMemorySize() + outlineB->getMemorySize());
+			REQUIRE(cache.find(0, glyphA) == nullptr);
+			cache.insert(0, glyphA, outlineA);
+			cache.insert(0, glyphB, outlineB);
+			REQUIRE(cache.getOutlinesCount() == 2);
+			REQUIRE(cache.getMemoryUsage() == cache.getBudget());
+			REQUIRE(cache.find(0, glyphA) == outlineA);
+			REQUIRE(cache.getHitsCount() == 1);
+			REQUIRE(cache.getMissesCount() == 1);
+
+			// b is the least recently used
+			cache.insert(1, glyphB, outlineB);
+			REQUIRE(cache.find(0, glyphB) == nullptr);
+			REQUIRE(cache.find(0, glyphA) == outlineA);
+			REQUIRE(cache.find(1, glyphB) == outlineB);
+
+			cache.setBudget(0);
+			REQUIRE(cache.getOutlinesCount() == 0);
+			REQUIRE(cache.getMemoryUsage() == 0);
+		}
+
+		SECTION("Bitmap font cache scales cached outlines")
+		{
+			RenderOptions unhinted;
+			unhinted.hinting = Hinting::None;
+			BitmapFontCache bitmapCache(library);
+			bitmapCache.loadFont("C:/windows/fonts/arial.ttf", unhinted);
+			bitmapCache.setOutlineCacheBudget(1024 * 1024);
+
+			for (int size = 10; size < 20; size++)
+				REQUIRE(bitmapCache.addGlyph(0, 'a', size) == BitmapFontCache::OK);
+			REQUIRE(bitmapCache.getOutlineCache()->getOutlinesCount() == 1);
+			REQUIRE(bitmapCache.getOutlineCache()->getHitsCount() == 9);
+
+			bitmapCache.setRasterThreadCount(2);
+			std::vector<GlyphRequest> requests;
+			for (int size = 20; size < 40; size++)
+				requests.push_back(GlyphRequest(0, 'a', size));
+			REQUIRE(bitmapCache.addGlyphs(requests) == requests.size());
+			REQUIRE(bitmapCache.getOutlineCache()->getOutlinesCount() == 1);
+			REQUIRE(bitmapCache.getOutlineCache()->getHitsCount() >= 9 + 19);
+
+			REQUIRE(bitmapCache.addGlyph(0, ' ', 18) == BitmapFontCache::NotFound);
+
+			bitmapCache.setOutlineCacheBudget(0);
+			REQUIRE(bitmapCache.getOutlineCache() == nullptr);
+			REQUIRE(bitmapCache.addGlyph(0, 'a', 40) == BitmapFontCache::OK);
+		}
+
+		SECTION("Hinted glyphs aren't rendered from cached outlines")
+		{
+			OutlineCache cache(1024 * 1024);
+			GlyphRequest hinted = GlyphRequest::fromGlyphIndex(0, glyphA, 13);
+			GlyphRequest unhinted = hinted;
+			unhinted.options.hinting = Hinting::None;
+
+			GlyphBitmap hintedBitmap, unhintedBitmap, uncachedBitmap;
+			REQUIRE(rasterizeGlyph(face, hinted, hintedBitmap, &cache));
+			REQUIRE(cache.getOutlinesCount() == 0);
+			REQUIRE(rasterizeGlyph(face, unhinted, unhintedBitmap, &cache));
+			REQUIRE(cache.getOutlinesCount() == 1);
+			REQUIRE(hintedBitmap.buffer != unhintedBitmap.buffer);
+
+			REQUIRE(rasterizeGlyph(face, hinted, uncachedBitmap));
+			REQUIRE(hintedBitmap.buffer == uncachedBitmap.buffer);
+		}
+
+		FT_Done_Face(face);
+		FT_Done_FreeType(library);
+	}
+}
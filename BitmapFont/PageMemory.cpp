@@ -0,0 +1,115 @@
+#include "stdafx.h"
+#include "PageMemory.h"
+
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace bmf
+{
+	size_t getSystemPageSize()
+	{
+#ifdef _WIN32
+		SYSTEM_INFO info;
+		::GetSystemInfo(&info);
+		return info.dwPageSize;
+#else
+		return static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+#endif
+	}
+
+	void* allocatePageMemory(size_t _size, bool _largePages)
+	{
+		void* data = nullptr;
+#ifdef _WIN32
+		// Large pages must be a multiple of the large page size, and fall back to regular pages
+		const SIZE_T largePageSize = _largePages ? ::GetLargePageMinimum() : 0;
+		if (largePageSize > 0 && _size % largePageSize == 0)
+			data = ::VirtualAlloc(nullptr, _size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (!data)
+			data = ::VirtualAlloc(nullptr, _size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+		data = ::mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (data == MAP_FAILED)
+			data = nullptr;
+#ifdef MADV_HUGEPAGE
+		if (data && _largePages)
+			::madvise(data, _size, MADV_HUGEPAGE);
+#endif
+#endif
+		if (!data)
+			throw std::bad_alloc();
+		return data;
+	}
+
+	void freePageMemory(void* _data, size_t _size)
+	{
+		if (!_data)
+			return;
+#ifdef _WIN32
+		(void)_size;
+		::VirtualFree(_data, 0, MEM_RELEASE);
+#else
+		::munmap(_data, _size);
+#endif
+	}
+
+	void* mapFileMemory(const char* _filename, size_t _offset, size_t _size)
+	{
+#ifdef _WIN32
+		HANDLE file = ::CreateFileA(_filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return nullptr;
+		// Views beyond the end of the file would fault when accessed
+		LARGE_INTEGER fileSize;
+		if (!::GetFileSizeEx(file, &fileSize) || static_cast<unsigned long long>(fileSize.QuadPart) < static_cast<unsigned long long>(_offset) + _size)
+		{
+			::CloseHandle(file);
+			return nullptr;
+		}
+		HANDLE mapping = ::CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+		::CloseHandle(file);
+		if (mapping == nullptr)
+			return nullptr;
+
+		// The view keeps the mapping alive
+		const unsigned long long offset = _offset;
+		void* data = ::MapViewOfFile(mapping, FILE_MAP_COPY, static_cast<DWORD>(offset >> 32), static_cast<DWORD>(offset), _size);
+		::CloseHandle(mapping);
+		return data;
+#else
+		int file = ::open(_filename, O_RDONLY);
+		if (file < 0)
+			return nullptr;
+		// Pages beyond the end of the file would raise SIGBUS when accessed
+		struct stat status;
+		if (::fstat(file, &status) != 0 || static_cast<unsigned long long>(status.st_size) < static_cast<unsigned long long>(_offset) + _size)
+		{
+			::close(file);
+			return nullptr;
+		}
+		void* data = ::mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, static_cast<off_t>(_offset));
+		::close(file);
+		return data == MAP_FAILED ? nullptr : data;
+#endif
+	}
+
+	void unmapFileMemory(void* _data, size_t _size)
+	{
+		if (!_data)
+			return;
+#ifdef _WIN32
+		(void)_size;
+		::UnmapViewOfFile(_data);
+#else
+		::munmap(_data, _size);
+#endif
+	}
+}
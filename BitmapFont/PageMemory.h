@@ -0,0 +1,28 @@
+#pragma once
+
+#ifndef _PAGE_MEMORY_H_
+#define _PAGE_MEMORY_H_
+
+#include <cstddef>
+
+namespace bmf
+{
+	// Zero filled memory mapped from the system instead of the heap. Pages of memory are only
+	// committed when first written, so an atlas page which receives a few glyphs costs a few
+	// pages of memory, and nothing to create. Aligned on the system page size.
+	// Large pages are used when requested and possible: transparent huge pages on Linux, which
+	// stay lazy, or MEM_LARGE_PAGES on Windows, which needs the "Lock pages in memory" privilege
+	// and commits the memory up front. Throws std::bad_alloc on failure, like new.
+	void* allocatePageMemory(size_t _size, bool _largePages = false);
+	void freePageMemory(void* _data, size_t _size);
+
+	size_t getSystemPageSize();
+
+	// Private copy on write view of a region of a file: pages are read from the file when first
+	// accessed, and copied when first written. The offset must be a multiple of 64 KB.
+	// Returns nullptr on failure, or when the file is shorter than the region.
+	void* mapFileMemory(const char* _filename, size_t _offset, size_t _size);
+	void unmapFileMemory(void* _data, size_t _size);
+}
+
+#endif
@@ -0,0 +1,111 @@
+#include "stdafx.h"
+#include "PageMemory.h"
+#include "BitmapFontCache.h"
+#include "catch.hpp"
+
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <ft2build.h>
+#include <freetype/freetype.h>
+
+namespace bmf
+{
+	static size_t getResidentMemory()
+	{
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (::K32GetProcessMemoryInfo(::GetCurrentProcess(), &counters, sizeof(counters)))
+			return counters.WorkingSetSize;
+		return 0;
+#else
+		size_t pages = 0, resident = 0;
+		FILE* file = std::fopen("/proc/self/statm", "r");
+		if (file)
+		{
+			if (std::fscanf(file, "%zu %zu", &pages, &resident) != 2)
+				resident = 0;
+			std::fclose(file);
+		}
+		return resident * getSystemPageSize();
+#endif
+	}
+
+	TEST_CASE("Page memory is zero filled and page aligned", "[PageMemory]")
+	{
+		for (bool largePages : { false, true })
+		{
+			const size_t size = 4 * 1024 * 1024;
+			unsigned char* data = static_cast<unsigned char*>(allocatePageMemory(size, largePages));
+			REQUIRE(data != nullptr);
+			REQUIRE(reinterpret_cast<uintptr_t>(data) % getSystemPageSize() == 0);
+			for (size_t i = 0; i < size; i += 4093)
+				REQUIRE(data[i] == 0);
+			data[0] = 1;
+			data[size - 1] = 2;
+			REQUIRE(data[size - 1] == 2);
+			freePageMemory(data, size);
+		}
+
+		AtlasPage page(PageFormat::Gray8, 1024, 1024);
+		REQUIRE(page.getSize() == 1024 * 1024);
+		REQUIRE(reinterpret_cast<uintptr_t>(page.getData()) % 64 == 0);
+		REQUIRE(page.getData()[page.getSize() - 1] == 0);
+	}
+
+	TEST_CASE("Cache construction time and resident memory", "[.][benchmark]")
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+		FT_Library library;
+		REQUIRE(FT_Init_FreeType(&library) == 0);
+		const int count = 64;
+
+		// Previous allocation: new[] then memset of the whole page
+		size_t before = getResidentMemory();
+		auto start = Clock::now();
+		std::vector<std::unique_ptr<unsigned char[]>> buffers;
+		for (int i = 0; i < count; i++)
+		{
+			buffers.emplace_back(new unsigned char[BitmapFontCache::getImageWidth() * BitmapFontCache::getImageHeight()]);
+			std::memset(buffers.back().get(), 0, BitmapFontCache::getImageWidth() * BitmapFontCache::getImageHeight());
+		}
+		double heapMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		size_t heapResident = getResidentMemory() - before;
+		buffers.clear();
+
+		before = getResidentMemory();
+		start = Clock::now();
+		std::vector<std::unique_ptr<BitmapFontCache>> caches;
+		for (int i = 0; i < count; i++)
+			caches.emplace_back(new BitmapFontCache(library));
+		double cacheMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		size_t cacheResident = getResidentMemory() - before;
+
+		// A few glyphs in every cache, as a short lived document view would
+		for (auto& cache : caches)
+		{
+			cache->loadFont("C:/windows/fonts/arial.ttf");
+			for (int c = 'a'; c <= 'z'; c++)
+				cache->addGlyph(0, c, 14);
+		}
+		size_t usedResident = getResidentMemory() - before;
+
+		WARN(count << " pages with new[] and memset: " << heapMs << " ms, " << heapResident / 1024 << " KB resident");
+		WARN(count << " caches: " << cacheMs << " ms, " << cacheResident / 1024 << " KB resident, "
+			<< usedResident / 1024 << " KB once 26 glyphs are added to each");
+
+		caches.clear();
+		FT_Done_FreeType(library);
+	}
+}
@@ -32,6 +32,18 @@ namespace bmf
 			return w <= _other.w &&  h <= _other.h;
 		}
 
+		bool contains(const Rect _other) const
+		{
+			return _other.x >= x && _other.y >= y && _other.x + _other.w <= x + w && _other.y + _other.h <= y + h;
+		}
+
+		// Smallest rect holding both
+		Rect united(const Rect _other) const
+		{
+			int l = std::min(x, _other.x), t = std::min(y, _other.y);
+			return Rect(l, t, std::max(x + w, _other.x + _other.w) - l, std::max(y + h, _other.y + _other.h) - t);
+		}
+
 		void offset(int _x, int _y)
 		{
 			x += _x;
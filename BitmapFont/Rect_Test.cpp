@@ -134,5 +134,19 @@ namespace bmf
 
 			}
 		}
+
+		SECTION("Contains / united")
+		{
+			Rect a(0, 0, 10, 10), b(20, 5, 10, 10);
+			REQUIRE(a.contains(Rect(2, 2, 8, 8)));
+			REQUIRE(!a.contains(Rect(2, 2, 9, 8)));
+			Rect u = a.united(b);
+			REQUIRE(u.left() == 0);
+			REQUIRE(u.top() == 0);
+			REQUIRE(u.right() == 30);
+			REQUIRE(u.bottom() == 15);
+			REQUIRE(u.contains(a));
+			REQUIRE(u.contains(b));
+		}
 	}
-}
\ No newline at end of file
+}
@@ -0,0 +1,472 @@
+#include "stdafx.h"
+#include "SharedAtlas.h"
+#include "PageMemory.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace bmf
+{
+	namespace
+	{
+		const char MAGIC[4] = { 'B', 'M', 'F', 'S' };
+		const uint32_t VERSION = 1;
+		const int READ_ATTEMPTS = 64;
+
+		// Glyphs are identified by the fields of their record preceding the slot
+		const size_t KEY_SIZE = offsetof(atlasFile::GlyphRecord, slot);
+
+		enum EntryState : uint32_t
+		{
+			Empty,
+			Used,
+			Removed
+		};
+
+		struct PageRecord
+		{
+			uint8_t		format;
+			uint8_t		layout;
+			uint8_t		padding[6];
+			uint64_t	offset;	// from the start of the page data
+		};
+
+		size_t alignUp(size_t _value, size_t _alignment)
+		{
+			return (_value + _alignment - 1) / _alignment * _alignment;
+		}
+
+#ifdef _WIN32
+		std::string getSegmentName(const char* _name) { return std::string("Local\\") + _name; }
+#else
+		std::string getSegmentName(const char* _name) { return std::string("/") + _name; }
+#endif
+
+		void* createSegment(const std::string& _name, size_t _size, void*& _handle)
+		{
+#ifdef _WIN32
+			const unsigned long long size = _size;
+			HANDLE mapping = ::CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), _name.c_str());
+			if (mapping == nullptr)
+				return nullptr;
+			void* data = ::MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, _size);
+			if (!data)
+			{
+				::CloseHandle(mapping);
+				return nullptr;
+			}
+			_handle = mapping;
+			return data;
+#else
+			(void)_handle;
+			// A segment left by a writer which crashed is replaced, readers of it keep their view
+			::shm_unlink(_name.c_str());
+			int segment = ::shm_open(_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+			if (segment < 0)
+				return nullptr;
+			void* data = MAP_FAILED;
+			if (::ftruncate(segment, static_cast<off_t>(_size)) == 0)
+				data = ::mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, segment, 0);
+			::close(segment);
+			if (data == MAP_FAILED)
+			{
+				::shm_unlink(_name.c_str());
+				return nullptr;
+			}
+			return data;
+#endif
+		}
+
+		void* openSegment(const std::string& _name, size_t& _size, void*& _handle)
+		{
+#ifdef _WIN32
+			HANDLE mapping = ::OpenFileMappingA(FILE_MAP_READ, FALSE, _name.c_str());
+			if (mapping == nullptr)
+				return nullptr;
+			void* data = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			MEMORY_BASIC_INFORMATION info;
+			if (!data || ::VirtualQuery(data, &info, sizeof(info)) == 0)
+			{
+				if (data)
+					::UnmapViewOfFile(data);
+				::CloseHandle(mapping);
+				return nullptr;
+			}
+			_size = info.RegionSize;
+			_handle = mapping;
+			return data;
+#else
+			(void)_handle;
+			int segment = ::shm_open(_name.c_str(), O_RDONLY, 0);
+			if (segment < 0)
+				return nullptr;
+			struct stat info;
+			void* data = MAP_FAILED;
+			if (::fstat(segment, &info) == 0 && info.st_size > 0)
+			{
+				_size = static_cast<size_t>(info.st_size);
+				data = ::mmap(nullptr, _size, PROT_READ, MAP_SHARED, segment, 0);
+			}
+			::close(segment);
+			return data == MAP_FAILED ? nullptr : data;
+#endif
+		}
+
+		void closeSegment(void* _data, size_t _size, void* _handle, const std::string& _unlinkName)
+		{
+#ifdef _WIN32
+			(void)_size;
+			(void)_unlinkName;
+			::UnmapViewOfFile(_data);
+			::CloseHandle(_handle);
+#else
+			(void)_handle;
+			::munmap(_data, _size);
+			if (!_unlinkName.empty())
+				::shm_unlink(_unlinkName.c_str());
+#endif
+		}
+	}
+
+	// Bound by reference to std::min
+	const unsigned int SharedAtlas::MAX_FONTS;
+	const unsigned int SharedAtlas::MAX_PAGES;
+
+	struct SharedAtlas::Header
+	{
+		char					magic[4];	// written last by the writer
+		uint32_t				version;
+		std::atomic<uint32_t>	sequence;	// odd while the writer modifies the segment
+		int32_t					pageWidth;
+		int32_t					pageHeight;
+		uint32_t				tableSize;	// entries of the index, power of 2
+		uint32_t				glyphCapacity;
+		uint32_t				glyphCount;
+		uint32_t				removedCount;	// entries of removed glyphs, until the index is rebuilt
+		uint32_t				fontCount;
+		uint32_t				pageCount;
+		float					gamma;
+		uint64_t				dataOffset;	// of the page data, from the start of the segment
+		uint64_t				dataSize;
+		uint64_t				dataUsed;
+		atlasFile::FontRecord	fonts[MAX_FONTS];
+		PageRecord				pages[MAX_PAGES];
+	};
+
+	// Open addressing with linear probing
+	struct SharedAtlas::Entry
+	{
+		uint32_t				state;
+		uint32_t				page;
+		atlasFile::GlyphRecord	record;
+	};
+
+	std::unique_ptr<SharedAtlas> SharedAtlas::create(const char* _name, int _pageWidth, int _pageHeight, size_t _pageBytes, unsigned int _glyphCapacity)
+	{
+		// The index stays at most 3/4 full
+		uint32_t tableSize = 16;
+		while (tableSize < _glyphCapacity + _glyphCapacity / 2)
+			tableSize *= 2;
+
+		const size_t pageSize = getSystemPageSize();
+		const size_t dataOffset = alignUp(alignUp(sizeof(Header), 64) + tableSize * sizeof(Entry), pageSize);
+		const size_t size = dataOffset + alignUp(_pageBytes, pageSize);
+
+		std::unique_ptr<SharedAtlas> atlas(new SharedAtlas());
+		atlas->m_name = getSegmentName(_name);
+		unsigned char* data = static_cast<unsigned char*>(createSegment(atlas->m_name, size, atlas->m_handle));
+		if (!data)
+			return nullptr;
+		atlas->m_writer = true;
+		atlas->m_size = size;
+		atlas->m_header = new (data) Header();
+		atlas->m_entries = reinterpret_cast<Entry*>(data + alignUp(sizeof(Header), 64));
+		atlas->m_data = data + dataOffset;
+
+		Header& header = *atlas->m_header;
+		header.version = VERSION;
+		header.sequence.store(0, std::memory_order_relaxed);
+		header.pageWidth = _pageWidth;
+		header.pageHeight = _pageHeight;
+		header.tableSize = tableSize;
+		header.glyphCapacity = _glyphCapacity;
+		header.dataOffset = dataOffset;
+		header.dataSize = size - dataOffset;
+		std::atomic_thread_fence(std::memory_order_release);
+		std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+		return atlas;
+	}
+
+	std::unique_ptr<SharedAtlas> SharedAtlas::open(const char* _name)
+	{
+		std::unique_ptr<SharedAtlas> atlas(new SharedAtlas());
+		const std::string name = getSegmentName(_name);
+		unsigned char* data = static_cast<unsigned char*>(openSegment(name, atlas->m_size, atlas->m_handle));
+		if (!data)
+			return nullptr;
+		atlas->m_header = reinterpret_cast<Header*>(data);
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		const Header& header = *atlas->m_header;
+		if (atlas->m_size < sizeof(Header) || std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION
+			|| header.dataOffset + header.dataSize > atlas->m_size)
+			return nullptr;	// the destructor unmaps the view
+		atlas->m_entries = reinterpret_cast<Entry*>(data + alignUp(sizeof(Header), 64));
+		atlas->m_data = data + header.dataOffset;
+		return atlas;
+	}
+
+	SharedAtlas::~SharedAtlas()
+	{
+		if (m_header)
+			closeSegment(m_header, m_size, m_handle, m_writer ? m_name : std::string());
+	}
+
+	int SharedAtlas::getPageWidth() const
+	{
+		return m_header->pageWidth;
+	}
+
+	int SharedAtlas::getPageHeight() const
+	{
+		return m_header->pageHeight;
+	}
+
+	uint32_t SharedAtlas::beginRead() const
+	{
+		return m_header->sequence.load(std::memory_order_acquire);
+	}
+
+	bool SharedAtlas::endRead(uint32_t _sequence) const
+	{
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return (_sequence & 1) == 0 && m_header->sequence.load(std::memory_order_relaxed) == _sequence;
+	}
+
+	void SharedAtlas::beginWrite()
+	{
+		assert(m_writer);
+		if (m_writeDepth++ > 0)
+			return;
+		m_header->sequence.store(m_header->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	void SharedAtlas::endWrite()
+	{
+		assert(m_writer && m_writeDepth > 0);
+		if (--m_writeDepth > 0)
+			return;
+		m_header->sequence.store(m_header->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	uint32_t SharedAtlas::findEntry(const atlasFile::GlyphRecord& _key, bool& _found) const
+	{
+		// Readers may see entries being modified, the probe is bounded and its result discarded
+		const uint32_t mask = m_header->tableSize - 1;
+		uint32_t index = static_cast<uint32_t>(atlasFile::hash(reinterpret_cast<const unsigned char*>(&_key), KEY_SIZE)) & mask;
+		uint32_t insertion = UINT32_MAX;
+		for (uint32_t probe = 0; probe <= mask; probe++, index = (index + 1) & mask)
+		{
+			const Entry& entry = m_entries[index];
+			if (entry.state == Empty)
+				break;
+			if (entry.state == Used && std::memcmp(&entry.record, &_key, KEY_SIZE) == 0)
+			{
+				_found = true;
+				return index;
+			}
+			if (entry.state == Removed && insertion == UINT32_MAX)
+				insertion = index;
+		}
+		_found = false;
+		return insertion != UINT32_MAX ? insertion : index;
+	}
+
+	bool SharedAtlas::find(const atlasFile::GlyphRecord& _key, Glyph& _glyph) const
+	{
+		for (int attempt = 0; attempt < READ_ATTEMPTS; attempt++)
+		{
+			const uint32_t sequence = beginRead();
+			if (sequence & 1)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+
+			bool found = false;
+			Entry entry;
+			const uint32_t index = findEntry(_key, found);
+			if (found)
+				std::memcpy(&entry, &m_entries[index], sizeof(entry));
+			if (!endRead(sequence))
+				continue;
+
+			if (!found)
+				return false;
+			const atlasFile::GlyphRecord& record = entry.record;
+			_glyph.page = entry.page;
+			_glyph.rect = Rect(record.rect[0], record.rect[1], record.rect[2], record.rect[3]);
+			_glyph.left = record.left;
+			_glyph.top = record.top;
+			return true;
+		}
+		return false;
+	}
+
+	bool SharedAtlas::getFonts(std::vector<atlasFile::FontRecord>& _fonts, float& _gamma) const
+	{
+		for (int attempt = 0; attempt < READ_ATTEMPTS; attempt++)
+		{
+			const uint32_t sequence = beginRead();
+			const uint32_t count = std::min<uint32_t>(m_header->fontCount, MAX_FONTS);
+			_fonts.assign(m_header->fonts, m_header->fonts + count);
+			_gamma = m_header->gamma;
+			if (endRead(sequence))
+				return true;
+			std::this_thread::yield();
+		}
+		return false;
+	}
+
+	unsigned int SharedAtlas::getPageCount() const
+	{
+		return std::min<uint32_t>(m_header->pageCount, MAX_PAGES);
+	}
+
+	bool SharedAtlas::getPage(unsigned int _index, Page& _page) const
+	{
+		for (int attempt = 0; attempt < READ_ATTEMPTS; attempt++)
+		{
+			const uint32_t sequence = beginRead();
+			const PageRecord record = m_header->pages[std::min(_index, MAX_PAGES - 1)];
+			const bool exists = _index < getPageCount();
+			if (!endRead(sequence))
+			{
+				std::this_thread::yield();
+				continue;
+			}
+
+			if (!exists)
+				return false;
+			_page.format = static_cast<PageFormat>(record.format);
+			_page.layout = static_cast<PageLayout>(record.layout);
+			_page.data = m_data + record.offset;
+			return true;
+		}
+		return false;
+	}
+
+	unsigned int SharedAtlas::getGlyphsCount() const
+	{
+		return m_header->glyphCount;
+	}
+
+	void SharedAtlas::setFonts(const std::vector<atlasFile::FontRecord>& _fonts, float _gamma)
+	{
+		beginWrite();
+		m_header->fontCount = std::min<uint32_t>(_fonts.size(), MAX_FONTS);
+		std::copy(_fonts.begin(), _fonts.begin() + m_header->fontCount, m_header->fonts);
+		m_header->gamma = _gamma;
+		endWrite();
+	}
+
+	unsigned char* SharedAtlas::allocatePage(PageFormat _format, PageLayout _layout, size_t _size)
+	{
+		const size_t offset = alignUp(static_cast<size_t>(m_header->dataUsed), getSystemPageSize());
+		if (m_header->pageCount == MAX_PAGES || offset + _size > m_header->dataSize)
+			return nullptr;
+
+		beginWrite();
+		PageRecord& record = m_header->pages[m_header->pageCount++];
+		record.format = static_cast<uint8_t>(_format);
+		record.layout = static_cast<uint8_t>(_layout);
+		record.offset = offset;
+		m_header->dataUsed = offset + _size;
+		endWrite();
+		return m_data + offset;
+	}
+
+	void SharedAtlas::setPageLayout(unsigned int _index, PageLayout _layout)
+	{
+		assert(_index < m_header->pageCount);
+		beginWrite();
+		m_header->pages[_index].layout = static_cast<uint8_t>(_layout);
+		endWrite();
+	}
+
+	void SharedAtlas::rebuildIndex()
+	{
+		std::vector<Entry> entries;
+		for (uint32_t i = 0; i < m_header->tableSize; i++)
+		{
+			if (m_entries[i].state == Used)
+				entries.push_back(m_entries[i]);
+		}
+
+		std::memset(m_entries, 0, m_header->tableSize * sizeof(Entry));
+		for (const Entry& entry : entries)
+		{
+			bool found = false;
+			m_entries[findEntry(entry.record, found)] = entry;
+		}
+		m_header->removedCount = 0;
+	}
+
+	bool SharedAtlas::insert(const atlasFile::GlyphRecord& _record, unsigned int _page)
+	{
+		assert(m_writer);
+		bool found = false;
+		uint32_t index = findEntry(_record, found);
+		if (!found && m_header->glyphCount == m_header->glyphCapacity)
+			return false;
+
+		beginWrite();
+		if (!found && m_entries[index].state == Empty && m_header->glyphCount + m_header->removedCount >= m_header->tableSize * 3 / 4)
+		{
+			rebuildIndex();
+			index = findEntry(_record, found);
+		}
+		Entry& entry = m_entries[index];
+		if (!found)
+		{
+			if (entry.state == Removed)
+				m_header->removedCount--;
+			m_header->glyphCount++;
+		}
+		entry.state = Used;
+		entry.page = _page;
+		entry.record = _record;
+		endWrite();
+		return true;
+	}
+
+	void SharedAtlas::remove(const atlasFile::GlyphRecord& _key)
+	{
+		assert(m_writer);
+		bool found = false;
+		const uint32_t index = findEntry(_key, found);
+		if (!found)
+			return;
+
+		beginWrite();
+		m_entries[index].state = Removed;
+		m_header->glyphCount--;
+		m_header->removedCount++;
+		endWrite();
+	}
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#ifndef _SHARED_ATLAS_H_
+#define _SHARED_ATLAS_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "AtlasFile.h"
+#include "AtlasPage.h"
+#include "Rect.h"
+
+namespace bmf
+{
+	// Pages and glyph index of a BitmapFontCache in a named shared memory segment, so that the
+	// processes of a host share a single atlas: one process, the writer, rasterizes and inserts the
+	// glyphs, the others look them up and read the pages in place.
+	// Readers are coordinated by a sequence counter (seqlock): the writer makes it odd while it
+	// modifies the index, or pixels which could be referenced by it, and readers retry the reads
+	// which overlapped a modification. New glyphs are written to free slots before being indexed,
+	// so the writer never waits for readers and readers only retry on index updates.
+	class SharedAtlas
+	{
+	public:
+		static const unsigned int MAX_FONTS = 64;
+		static const unsigned int MAX_PAGES = 32;
+
+		// Replaces any segment of the same name. _pageBytes is reserved for the pages, and the glyph
+		// index holds up to _glyphCapacity glyphs. Returns nullptr on failure.
+		static std::unique_ptr<SharedAtlas> create(const char* _name, int _pageWidth, int _pageHeight, size_t _pageBytes, unsigned int _glyphCapacity);
+		// Read only view of a segment created by another process, nullptr if it doesn't exist
+		static std::unique_ptr<SharedAtlas> open(const char* _name);
+
+		// The writer removes the name, readers keep their view until they are destroyed
+		~SharedAtlas();
+
+		bool isWriter() const { return m_writer; }
+		int getPageWidth() const;
+		int getPageHeight() const;
+
+		struct Glyph
+		{
+			unsigned int	page;
+			Rect			rect;
+			int				left;
+			int				top;
+		};
+
+		struct Page
+		{
+			PageFormat				format;
+			PageLayout				layout;
+			const unsigned char*	data;
+		};
+
+		// Readers, consistent snapshots. find() returns false for missing glyphs, or when the writer
+		// keeps the index locked longer than a few attempts.
+		bool find(const atlasFile::GlyphRecord& _key, Glyph& _glyph) const;
+		bool getFonts(std::vector<atlasFile::FontRecord>& _fonts, float& _gamma) const;
+		unsigned int getPageCount() const;
+		bool getPage(unsigned int _index, Page& _page) const;
+		unsigned int getGlyphsCount() const;
+
+		// Pixels read in place are valid when endRead() returns true for the value of beginRead()
+		// preceding the reads, they must be read again otherwise.
+		uint32_t beginRead() const;
+		bool endRead(uint32_t _sequence) const;
+
+		// Writer. Modifications of pixels which may be indexed are bracketed by beginWrite() and
+		// endWrite(), which nest. insert() and remove() bracket themselves.
+		void beginWrite();
+		void endWrite();
+		void setFonts(const std::vector<atlasFile::FontRecord>& _fonts, float _gamma);
+		// Zero filled, nullptr when the segment is full
+		unsigned char* allocatePage(PageFormat _format, PageLayout _layout, size_t _size);
+		void setPageLayout(unsigned int _index, PageLayout _layout);
+		// The record holds the key, rect and origin of the glyph. Returns false when the index is full.
+		bool insert(const atlasFile::GlyphRecord& _record, unsigned int _page);
+		void remove(const atlasFile::GlyphRecord& _key);
+
+	private:
+		struct Header;
+		struct Entry;
+
+		SharedAtlas() {}
+		SharedAtlas(const SharedAtlas&) = delete;
+		SharedAtlas& operator=(const SharedAtlas&) = delete;
+
+		uint32_t findEntry(const atlasFile::GlyphRecord& _key, bool& _found) const;
+		void rebuildIndex();
+
+		Header*			m_header = nullptr;
+		Entry*			m_entries = nullptr;
+		unsigned char*	m_data = nullptr;
+		size_t			m_size = 0;
+		void*			m_handle = nullptr;	// Windows mapping
+		std::string		m_name;
+		bool			m_writer = false;
+		int				m_writeDepth = 0;
+	};
+}
+
+#endif
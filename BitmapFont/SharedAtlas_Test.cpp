@@ -0,0 +1,247 @@
+#include "stdafx.h"
+#include "SharedAtlas.h"
+#include "BitmapFontCache.h"
+#include "catch.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ft2build.h>
+#include <freetype/freetype.h>
+
+namespace bmf
+{
+	static std::string getSegmentName(const char* _prefix)
+	{
+		return _prefix + std::to_string(std::chrono::high_resolution_clock::now().time_since_epoch().count());
+	}
+
+	TEST_CASE("Shared atlases are read by other caches in place", "[SharedAtlas]")
+	{
+		FT_Library library;
+		REQUIRE(FT_Init_FreeType(&library) == 0);
+		const std::string name = getSegmentName("bmf_shared_test_");
+
+		// Caches release their faces before the library
+		{
+			BitmapFontCache writer(library);
+			writer.loadFont("C:/windows/fonts/arial.ttf");
+			writer.loadFont("C:/windows/fonts/verdana.ttf");
+			for (int c = 'a'; c <= 'm'; c++)
+				REQUIRE(writer.addGlyph(0, c, 16) == BitmapFontCache::OK);
+			REQUIRE(writer.shareAtlas(name.c_str(), 8 * 1024 * 1024, 1024));
+			REQUIRE(writer.getSharedAtlas()->isWriter());
+			for (int c = 'n'; c <= 'z'; c++)
+				REQUIRE(writer.addGlyph(0, c, 16) == BitmapFontCache::OK);
+			REQUIRE(writer.addGlyph(1, 'Q', 24, GlyphMode::Lcd) == BitmapFontCache::OK);
+			REQUIRE(writer.getSharedAtlas()->getGlyphsCount() == 27);
+			REQUIRE(writer.getSharedAtlas()->getPageCount() == 2);
+
+			BitmapFontCache reader(library);
+			reader.loadFont("C:/windows/fonts/arial.ttf");
+			reader.loadFont("C:/windows/fonts/verdana.ttf");
+			REQUIRE(reader.attachSharedAtlas(name.c_str()));
+			const SharedAtlas& shared = *reader.getSharedAtlas();
+			REQUIRE(!shared.isWriter());
+
+			SECTION("Glyphs and pixels are the ones of the writer")
+			{
+				for (GlyphRequest request : { GlyphRequest(0, 'a', 16), GlyphRequest(0, 'z', 16), GlyphRequest(1, 'Q', 24, GlyphMode::Lcd) })
+				{
+					Rect writerRect, readerRect;
+					unsigned int writerPage = 0, readerPage = 0;
+					int writerLeft, writerTop, readerLeft, readerTop;
+					REQUIRE(writer.getGlyphRect(request, writerRect, &writerPage));
+					REQUIRE(reader.getGlyphRect(request, readerRect, &readerPage));
+					REQUIRE(readerPage == writerPage);
+					REQUIRE(readerRect.left() == writerRect.left());
+					REQUIRE(readerRect.top() == writerRect.top());
+					REQUIRE(readerRect.width() == writerRect.width());
+					REQUIRE(readerRect.height() == writerRect.height());
+					REQUIRE(writer.getGlyphOrigin(request, writerLeft, writerTop));
+					REQUIRE(reader.getGlyphOrigin(request, readerLeft, readerTop));
+					REQUIRE(readerLeft == writerLeft);
+					REQUIRE(readerTop == writerTop);
+				}
+
+				for (unsigned int i = 0; i < shared.getPageCount(); i++)
+				{
+					SharedAtlas::Page page;
+					REQUIRE(shared.getPage(i, page));
+					REQUIRE(page.format == writer.getPage(i).getFormat());
+					uint32_t sequence = shared.beginRead();
+					REQUIRE(std::memcmp(page.data, writer.getPage(i).getData(), writer.getPage(i).getSize()) == 0);
+					REQUIRE(shared.endRead(sequence));
+				}
+			}
+
+			SECTION("Readers see the glyphs added and removed by the writer")
+			{
+				REQUIRE(reader.addGlyph(0, 'a', 16) == BitmapFontCache::AlreadyAdded);
+				REQUIRE(reader.addGlyph(0, 'A', 16) == BitmapFontCache::NotFound);
+
+				uint32_t sequence = shared.beginRead();
+				REQUIRE(writer.addGlyph(0, 'A', 16) == BitmapFontCache::OK);
+				REQUIRE(!shared.endRead(sequence));
+				REQUIRE(reader.addGlyph(0, 'A', 16) == BitmapFontCache::AlreadyAdded);
+
+				Rect rect;
+				REQUIRE(writer.removeGlyph(0, 'b', 16) == BitmapFontCache::OK);
+				REQUIRE(!reader.getGlyphRect(0, 'b', 16, rect));
+				REQUIRE(shared.getGlyphsCount() == 27);
+
+				// Removed entries are reclaimed by the index
+				for (int n = 0; n < 20; n++)
+				{
+					REQUIRE(writer.addGlyph(0, 'b', 16 + n) == BitmapFontCache::OK);
+					REQUIRE(writer.removeGlyph(0, 'b', 16 + n) == BitmapFontCache::OK);
+				}
+				for (int c = 0x100; c < 0x180; c++)
+					writer.addGlyph(1, c, 12);
+				REQUIRE(shared.getGlyphsCount() == writer.getGlyphsCount());
+				REQUIRE(reader.getGlyphRect(1, 0x101, 12, rect));
+			}
+
+			SECTION("Readers must use the fonts and options of the writer")
+			{
+				RenderOptions light;
+				light.hinting = Hinting::Light;
+				BitmapFontCache otherFonts(library), otherOptions(library), otherGamma(library);
+				otherFonts.loadFont("C:/windows/fonts/verdana.ttf");
+				otherOptions.loadFont("C:/windows/fonts/arial.ttf", light);
+				otherGamma.loadFont("C:/windows/fonts/arial.ttf");
+				otherGamma.setGamma(2.2f);
+				REQUIRE(!otherFonts.attachSharedAtlas(name.c_str()));
+				REQUIRE(!otherOptions.attachSharedAtlas(name.c_str()));
+				REQUIRE(!otherGamma.attachSharedAtlas(name.c_str()));
+
+				// A subset of the fonts of the writer is enough
+				BitmapFontCache firstFont(library);
+				firstFont.loadFont("C:/windows/fonts/arial.ttf");
+				REQUIRE(firstFont.attachSharedAtlas(name.c_str()));
+				REQUIRE(!firstFont.attachSharedAtlas(name.c_str()));
+
+				BitmapFontCache missing(library);
+				REQUIRE(!missing.attachSharedAtlas("bmf_shared_test_missing"));
+			}
+		}
+
+		FT_Done_FreeType(library);
+	}
+
+	TEST_CASE("Shared atlas readers never see torn glyphs", "[SharedAtlas]")
+	{
+		const std::string name = getSegmentName("bmf_shared_seqlock_");
+		std::unique_ptr<SharedAtlas> writer = SharedAtlas::create(name.c_str(), 64, 64, 0, 64);
+		REQUIRE(writer != nullptr);
+		std::unique_ptr<SharedAtlas> reader = SharedAtlas::open(name.c_str());
+		REQUIRE(reader != nullptr);
+
+		// Every field of the rect holds the same value, which changes at every update
+		auto makeRecord = [](int _char, int _value)
+		{
+			atlasFile::GlyphRecord record = {};
+			record.unicodeChar = _char;
+			record.pixelSize = 16;
+			for (int& field : record.rect)
+				field = _value;
+			record.left = record.top = _value;
+			return record;
+		};
+
+		std::atomic<bool> done(false);
+		std::atomic<int> torn(0);
+		std::thread thread([&]()
+		{
+			SharedAtlas::Glyph glyph;
+			while (!done)
+			{
+				for (int c = 0; c < 8; c++)
+				{
+					if (!reader->find(makeRecord(c, 0), glyph))
+						continue;
+					if (glyph.rect.left() != glyph.rect.top() || static_cast<int>(glyph.rect.width()) != glyph.rect.left() || glyph.left != glyph.rect.left()
+						|| glyph.page != static_cast<unsigned int>(glyph.left % 3))
+						torn++;
+				}
+			}
+		});
+
+		for (int n = 0; n < 200000; n++)
+		{
+			const int c = n % 8;
+			if (n % 5 == 4)
+				writer->remove(makeRecord(c, 0));
+			else
+				REQUIRE(writer->insert(makeRecord(c, n), n % 3));
+		}
+		done = true;
+		thread.join();
+
+		REQUIRE(torn == 0);
+		REQUIRE(writer->getGlyphsCount() <= 8);
+	}
+
+	TEST_CASE("Shared atlas versus private atlases per process", "[.][benchmark]")
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+		FT_Library library;
+		REQUIRE(FT_Init_FreeType(&library) == 0);
+		const std::string name = getSegmentName("bmf_shared_benchmark_");
+		const int processCount = 8;
+
+		std::vector<GlyphRequest> requests;
+		for (int size : { 12, 14, 16, 20, 24 })
+		{
+			for (int c = 0x20; c < 0x17f; c++)
+				requests.push_back(GlyphRequest(0, c, size));
+		}
+
+		// Every process builds its own atlas
+		auto start = Clock::now();
+		size_t privateBytes = 0;
+		for (int i = 0; i < processCount; i++)
+		{
+			BitmapFontCache cache(library);
+			cache.loadFont("C:/windows/fonts/arial.ttf");
+			for (const GlyphRequest& request : requests)
+				cache.addGlyph(request.fontIndex, request.unicodeChar, request.pixelSize);
+			for (unsigned int page = 0; page < cache.getPageCount(); page++)
+				privateBytes += cache.getPage(page).getSize();
+		}
+		double privateMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+		// One writer, the other processes look the glyphs up
+		start = Clock::now();
+		std::unique_ptr<BitmapFontCache> writerCache(new BitmapFontCache(library));
+		BitmapFontCache& writer = *writerCache;
+		writer.loadFont("C:/windows/fonts/arial.ttf");
+		REQUIRE(writer.shareAtlas(name.c_str(), 16 * 1024 * 1024, 8192));
+		for (const GlyphRequest& request : requests)
+			writer.addGlyph(request.fontIndex, request.unicodeChar, request.pixelSize);
+		unsigned int lookups = 0;
+		for (int i = 1; i < processCount; i++)
+		{
+			BitmapFontCache reader(library);
+			reader.loadFont("C:/windows/fonts/arial.ttf");
+			REQUIRE(reader.attachSharedAtlas(name.c_str()));
+			Rect rect;
+			for (const GlyphRequest& request : requests)
+				lookups += reader.getGlyphRect(request, rect) ? 1 : 0;
+		}
+		double sharedMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		size_t sharedBytes = 0;
+		for (unsigned int page = 0; page < writer.getPageCount(); page++)
+			sharedBytes += writer.getPage(page).getSize();
+
+		WARN(processCount << " processes, " << requests.size() << " glyphs each: private atlases " << privateMs << " ms, "
+			<< privateBytes / 1024 << " KB of pages; shared atlas " << sharedMs << " ms, " << sharedBytes / 1024 << " KB of pages, "
+			<< lookups << " lookups by the readers");
+		writerCache.reset();
+		FT_Done_FreeType(library);
+	}
+}
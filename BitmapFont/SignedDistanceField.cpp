@@ -0,0 +1,336 @@
+#include "stdafx.h"
+#include "SignedDistanceField.h"
+#include "GlyphRasterizer.h"
+#include "Simd.h"
+
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+namespace bmf
+{
+	// Exact euclidean distance transform (Felzenszwalb & Huttenlocher): vertical distances to the
+	// nearest inside and outside pixels are computed column wise, then combined row wise with the
+	// lower envelope of parabolas. The column and the output passes work on whole rows, so they
+	// are vectorized across columns.
+	namespace
+	{
+		// Distances are capped right above the spread, further pixels all get the same value
+		struct Field
+		{
+			int					width;
+			int					rows;
+			float				cap;
+			std::vector<float>	outside;	// 1 outside of the glyph, 0 inside
+			std::vector<float>	toInside;	// distance to the nearest inside pixel
+			std::vector<float>	toOutside;
+		};
+
+		void columnPassScalar(Field& _field, int _begin)
+		{
+			const int w = _field.width;
+			for (int y = 0; y < _field.rows; y++)
+			{
+				const float* outside = &_field.outside[y * w];
+				float* toInside = &_field.toInside[y * w];
+				float* toOutside = &_field.toOutside[y * w];
+				for (int x = _begin; x < w; x++)
+				{
+					float inPrevious = y > 0 ? toInside[x - w] + 1.f : _field.cap;
+					float outPrevious = y > 0 ? toOutside[x - w] + 1.f : _field.cap;
+					toInside[x] = std::min(inPrevious, _field.cap) * outside[x];
+					toOutside[x] = std::min(outPrevious, _field.cap) * (1.f - outside[x]);
+				}
+			}
+			for (int y = _field.rows - 2; y >= 0; y--)
+			{
+				float* toInside = &_field.toInside[y * w];
+				float* toOutside = &_field.toOutside[y * w];
+				for (int x = _begin; x < w; x++)
+				{
+					toInside[x] = std::min(toInside[x], toInside[x + w] + 1.f);
+					toOutside[x] = std::min(toOutside[x], toOutside[x + w] + 1.f);
+				}
+			}
+		}
+
+		// Squared distances, in place, from the squared vertical distances of the row
+		void rowTransform(float* _f, int _n, std::vector<int>& _v, std::vector<float>& _z, std::vector<float>& _d)
+		{
+			int k = 0;
+			_v[0] = 0;
+			_z[0] = -FLT_MAX;
+			_z[1] = FLT_MAX;
+			for (int q = 1; q < _n; q++)
+			{
+				// Intersection with the last parabola of the envelope, which is dropped while hidden
+				float s = ((_f[q] + q * q) - (_f[_v[k]] + _v[k] * _v[k])) / (2 * q - 2 * _v[k]);
+				while (s <= _z[k])
+				{
+					k--;
+					s = ((_f[q] + q * q) - (_f[_v[k]] + _v[k] * _v[k])) / (2 * q - 2 * _v[k]);
+				}
+				k++;
+				_v[k] = q;
+				_z[k] = s;
+				_z[k + 1] = FLT_MAX;
+			}
+
+			k = 0;
+			for (int q = 0; q < _n; q++)
+			{
+				while (_z[k + 1] < q)
+					k++;
+				float dx = static_cast<float>(q - _v[k]);
+				_d[q] = dx * dx + _f[_v[k]];
+			}
+			std::copy(_d.begin(), _d.begin() + _n, _f);
+		}
+
+		void rowPass(Field& _field)
+		{
+			const int w = _field.width;
+			std::vector<int> v(w);
+			std::vector<float> z(w + 1);
+			std::vector<float> d(w);
+			for (int y = 0; y < _field.rows; y++)
+			{
+				for (std::vector<float>* distances : { &_field.toInside, &_field.toOutside })
+				{
+					float* f = &(*distances)[y * w];
+					for (int x = 0; x < w; x++)
+						f[x] *= f[x];
+					rowTransform(f, w, v, z, d);
+				}
+			}
+		}
+
+		void outputPassScalar(const Field& _field, int _spread, unsigned char* _dst, int _pitch, int _begin)
+		{
+			const float maxDistanceSq = static_cast<float>(_spread * _spread);
+			const float scale = 127.f / _spread;
+			for (int y = 0; y < _field.rows; y++)
+			{
+				const int row = y * _field.width;
+				for (int x = _begin; x < _field.width; x++)
+				{
+					float outside = _field.outside[row + x];
+					float toOutside = _field.toOutside[row + x];
+					float nearestSq = toOutside + outside * (_field.toInside[row + x] - toOutside);
+
+					// The edge lies half way between the two pixel centers
+					float distance = nearestSq > maxDistanceSq ? static_cast<float>(_spread) : std::sqrt(nearestSq) - 0.5f;
+					float value = (1.f - 2.f * outside) * distance * scale + 128.5f;
+					_dst[x + y * _pitch] = static_cast<unsigned char>(std::min(255.f, std::max(0.f, value)));
+				}
+			}
+		}
+
+#ifdef BMF_SSE2
+		int columnPassSse2(Field& _field)
+		{
+			const int w = _field.width;
+			const int end = w & ~3;
+			const __m128 one = _mm_set1_ps(1.f);
+			const __m128 cap = _mm_set1_ps(_field.cap);
+			for (int y = 0; y < _field.rows; y++)
+			{
+				const float* outside = &_field.outside[y * w];
+				float* toInside = &_field.toInside[y * w];
+				float* toOutside = &_field.toOutside[y * w];
+				for (int x = 0; x < end; x += 4)
+				{
+					__m128 out = _mm_loadu_ps(outside + x);
+					__m128 inPrevious = y > 0 ? _mm_add_ps(_mm_loadu_ps(toInside + x - w), one) : cap;
+					__m128 outPrevious = y > 0 ? _mm_add_ps(_mm_loadu_ps(toOutside + x - w), one) : cap;
+					_mm_storeu_ps(toInside + x, _mm_mul_ps(_mm_min_ps(inPrevious, cap), out));
+					_mm_storeu_ps(toOutside + x, _mm_mul_ps(_mm_min_ps(outPrevious, cap), _mm_sub_ps(one, out)));
+				}
+			}
+			for (int y = _field.rows - 2; y >= 0; y--)
+			{
+				float* toInside = &_field.toInside[y * w];
+				float* toOutside = &_field.toOutside[y * w];
+				for (int x = 0; x < end; x += 4)
+				{
+					_mm_storeu_ps(toInside + x, _mm_min_ps(_mm_loadu_ps(toInside + x), _mm_add_ps(_mm_loadu_ps(toInside + x + w), one)));
+					_mm_storeu_ps(toOutside + x, _mm_min_ps(_mm_loadu_ps(toOutside + x), _mm_add_ps(_mm_loadu_ps(toOutside + x + w), one)));
+				}
+			}
+			return end;
+		}
+
+		// 4 floats in [0, 255] to 4 bytes
+		void storeBytes(unsigned char* _dst, __m128i _values)
+		{
+			__m128i bytes = _mm_packus_epi16(_mm_packs_epi32(_values, _values), _mm_setzero_si128());
+			int packed = _mm_cvtsi128_si32(bytes);
+			std::memcpy(_dst, &packed, 4);
+		}
+
+		int outputPassSse2(const Field& _field, int _spread, unsigned char* _dst, int _pitch)
+		{
+			const int end = _field.width & ~3;
+			const __m128 maxDistanceSq = _mm_set1_ps(static_cast<float>(_spread * _spread));
+			const __m128 spread = _mm_set1_ps(static_cast<float>(_spread));
+			const __m128 scale = _mm_set1_ps(127.f / _spread);
+			const __m128 one = _mm_set1_ps(1.f);
+			const __m128 two = _mm_set1_ps(2.f);
+			const __m128 half = _mm_set1_ps(0.5f);
+			const __m128 offset = _mm_set1_ps(128.5f);
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 maxValue = _mm_set1_ps(255.f);
+			for (int y = 0; y < _field.rows; y++)
+			{
+				const int row = y * _field.width;
+				for (int x = 0; x < end; x += 4)
+				{
+					__m128 outside = _mm_loadu_ps(&_field.outside[row + x]);
+					__m128 toOutside = _mm_loadu_ps(&_field.toOutside[row + x]);
+					__m128 nearestSq = _mm_add_ps(toOutside, _mm_mul_ps(outside, _mm_sub_ps(_mm_loadu_ps(&_field.toInside[row + x]), toOutside)));
+
+					__m128 far = _mm_cmpgt_ps(nearestSq, maxDistanceSq);
+					__m128 near = _mm_sub_ps(_mm_sqrt_ps(nearestSq), half);
+					__m128 distance = _mm_or_ps(_mm_and_ps(far, spread), _mm_andnot_ps(far, near));
+					__m128 value = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, outside)), distance), scale), offset);
+					value = _mm_min_ps(maxValue, _mm_max_ps(zero, value));
+					storeBytes(_dst + x + y * _pitch, _mm_cvttps_epi32(value));
+				}
+			}
+			return end;
+		}
+
+		BMF_TARGET_AVX2 int columnPassAvx2(Field& _field)
+		{
+			const int w = _field.width;
+			const int end = w & ~7;
+			const __m256 one = _mm256_set1_ps(1.f);
+			const __m256 cap = _mm256_set1_ps(_field.cap);
+			for (int y = 0; y < _field.rows; y++)
+			{
+				const float* outside = &_field.outside[y * w];
+				float* toInside = &_field.toInside[y * w];
+				float* toOutside = &_field.toOutside[y * w];
+				for (int x = 0; x < end; x += 8)
+				{
+					__m256 out = _mm256_loadu_ps(outside + x);
+					__m256 inPrevious = y > 0 ? _mm256_add_ps(_mm256_loadu_ps(toInside + x - w), one) : cap;
+					__m256 outPrevious = y > 0 ? _mm256_add_ps(_mm256_loadu_ps(toOutside + x - w), one) : cap;
+					_mm256_storeu_ps(toInside + x, _mm256_mul_ps(_mm256_min_ps(inPrevious, cap), out));
+					_mm256_storeu_ps(toOutside + x, _mm256_mul_ps(_mm256_min_ps(outPrevious, cap), _mm256_sub_ps(one, out)));
+				}
+			}
+			for (int y = _field.rows - 2; y >= 0; y--)
+			{
+				float* toInside = &_field.toInside[y * w];
+				float* toOutside = &_field.toOutside[y * w];
+				for (int x = 0; x < end; x += 8)
+				{
+					_mm256_storeu_ps(toInside + x, _mm256_min_ps(_mm256_loadu_ps(toInside + x), _mm256_add_ps(_mm256_loadu_ps(toInside + x + w), one)));
+					_mm256_storeu_ps(toOutside + x, _mm256_min_ps(_mm256_loadu_ps(toOutside + x), _mm256_add_ps(_mm256_loadu_ps(toOutside + x + w), one)));
+				}
+			}
+			_mm256_zeroupper();
+			return end;
+		}
+
+		BMF_TARGET_AVX2 int outputPassAvx2(const Field& _field, int _spread, unsigned char* _dst, int _pitch)
+		{
+			const int end = _field.width & ~7;
+			const __m256 maxDistanceSq = _mm256_set1_ps(static_cast<float>(_spread * _spread));
+			const __m256 spread = _mm256_set1_ps(static_cast<float>(_spread));
+			const __m256 scale = _mm256_set1_ps(127.f / _spread);
+			const __m256 one = _mm256_set1_ps(1.f);
+			const __m256 two = _mm256_set1_ps(2.f);
+			const __m256 half = _mm256_set1_ps(0.5f);
+			const __m256 offset = _mm256_set1_ps(128.5f);
+			const __m256 zero = _mm256_setzero_ps();
+			const __m256 maxValue = _mm256_set1_ps(255.f);
+			for (int y = 0; y < _field.rows; y++)
+			{
+				const int row = y * _field.width;
+				for (int x = 0; x < end; x += 8)
+				{
+					__m256 outside = _mm256_loadu_ps(&_field.outside[row + x]);
+					__m256 toOutside = _mm256_loadu_ps(&_field.toOutside[row + x]);
+					__m256 nearestSq = _mm256_add_ps(toOutside, _mm256_mul_ps(outside, _mm256_sub_ps(_mm256_loadu_ps(&_field.toInside[row + x]), toOutside)));
+
+					__m256 far = _mm256_cmp_ps(nearestSq, maxDistanceSq, _CMP_GT_OQ);
+					__m256 near = _mm256_sub_ps(_mm256_sqrt_ps(nearestSq), half);
+					__m256 distance = _mm256_blendv_ps(near, spread, far);
+					__m256 value = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, outside)), distance), scale), offset);
+					value = _mm256_min_ps(maxValue, _mm256_max_ps(zero, value));
+
+					__m256i values = _mm256_cvttps_epi32(value);
+					__m128i words = _mm_packs_epi32(_mm256_castsi256_si128(values), _mm256_extracti128_si256(values, 1));
+					_mm_storel_epi64(reinterpret_cast<__m128i*>(_dst + x + y * _pitch), _mm_packus_epi16(words, words));
+				}
+			}
+			_mm256_zeroupper();
+			return end;
+		}
+#endif
+	}
+
+	SdfKernel getBestSdfKernel()
+	{
+#ifdef BMF_SSE2
+		static const SdfKernel kernel = cpuSupportsAvx2() ? SdfKernel::Avx2 : SdfKernel::Sse2;
+		return kernel;
+#else
+		return SdfKernel::Scalar;
+#endif
+	}
+
+	void generateSdf(const GlyphBitmap& _coverage, int _spread, GlyphBitmap& _sdf)
+	{
+		_sdf.format = PageFormat::Gray8;
+		_sdf.width = _coverage.width + 2 * _spread;
+		_sdf.rows = _coverage.rows + 2 * _spread;
+		_sdf.left = _coverage.left - _spread;
+		_sdf.top = _coverage.top + _spread;
+		_sdf.buffer.resize(_sdf.width * _sdf.rows);
+		generateSdf(_coverage, _spread, _sdf.buffer.data(), _sdf.width, getBestSdfKernel());
+	}
+
+	void generateSdf(const GlyphBitmap& _coverage, int _spread, unsigned char* _dst, int _pitch, SdfKernel _kernel)
+	{
+		Field field;
+		field.width = _coverage.width + 2 * _spread;
+		field.rows = _coverage.rows + 2 * _spread;
+		field.cap = static_cast<float>(_spread + 1);
+		field.outside.assign(field.width * field.rows, 1.f);
+		field.toInside.resize(field.width * field.rows);
+		field.toOutside.resize(field.width * field.rows);
+		for (unsigned int y = 0; y < _coverage.rows; y++)
+		{
+			for (unsigned int x = 0; x < _coverage.width; x++)
+			{
+				if (_coverage.buffer[x + y * _coverage.width] >= 128)
+					field.outside[x + _spread + (y + _spread) * field.width] = 0.f;
+			}
+		}
+
+		int vectorized = 0;
+#ifdef BMF_SSE2
+		if (_kernel == SdfKernel::Avx2)
+			vectorized = columnPassAvx2(field);
+		else if (_kernel == SdfKernel::Sse2)
+			vectorized = columnPassSse2(field);
+#endif
+		columnPassScalar(field, vectorized);
+
+		rowPass(field);
+
+		vectorized = 0;
+#ifdef BMF_SSE2
+		if (_kernel == SdfKernel::Avx2)
+			vectorized = outputPassAvx2(field, _spread, _dst, _pitch);
+		else if (_kernel == SdfKernel::Sse2)
+			vectorized = outputPassSse2(field, _spread, _dst, _pitch);
+#endif
+		outputPassScalar(field, _spread, _dst, _pitch, vectorized);
+	}
+}
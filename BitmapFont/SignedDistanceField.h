@@ -0,0 +1,29 @@
+#pragma once
+
+#ifndef _SIGNED_DISTANCE_FIELD_H_
+#define _SIGNED_DISTANCE_FIELD_H_
+
+namespace bmf
+{
+	struct GlyphBitmap;
+
+	enum class SdfKernel
+	{
+		Scalar,
+		Sse2,
+		Avx2
+	};
+
+	// Fastest kernel supported by the compiler and the CPU
+	SdfKernel getBestSdfKernel();
+
+	// Converts a coverage bitmap into a signed distance field, grown by _spread pixels on each side.
+	// 128 is the glyph edge, values above are inside, and 1 / 255 are _spread pixels away or more.
+	void generateSdf(const GlyphBitmap& _coverage, int _spread, GlyphBitmap& _sdf);
+
+	// Same, written to (width + 2 * _spread) x (rows + 2 * _spread) pixels of _pitch bytes rows,
+	// such as the slot of the glyph in a page
+	void generateSdf(const GlyphBitmap& _coverage, int _spread, unsigned char* _dst, int _pitch, SdfKernel _kernel = getBestSdfKernel());
+}
+
+#endif
@@ -0,0 +1,161 @@
+#include "stdafx.h"
+#include "SignedDistanceField.h"
+#include "GlyphRasterizer.h"
+
+#include "catch.hpp"
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+
+#include <ft2build.h>
+#include <freetype/freetype.h>
+
+namespace bmf
+{
+	TEST_CASE("Signed distance field generation", "[SignedDistanceField]")
+	{
+		// 8x8 filled square in the middle of a 16x16 coverage bitmap
+		GlyphBitmap coverage;
+		coverage.width = 16;
+		coverage.rows = 16;
+		coverage.buffer.assign(16 * 16, 0);
+		for (int y = 4; y < 12; y++)
+			for (int x = 4; x < 12; x++)
+				coverage.buffer[x + y * 16] = 255;
+
+		const int spread = 4;
+		GlyphBitmap sdf;
+		generateSdf(coverage, spread, sdf);
+		REQUIRE(sdf.width == 16 + 2 * spread);
+		REQUIRE(sdf.rows == 16 + 2 * spread);
+
+		auto value = [&](int _x, int _y) { return static_cast<int>(sdf.buffer[(_x + spread) + (_y + spread) * sdf.width]); };
+
+		SECTION("Sign follows coverage")
+		{
+			REQUIRE(value(7, 7) > 230);
+			REQUIRE(value(4, 7) > 128);
+			REQUIRE(value(3, 7) < 128);
+			REQUIRE(value(-spread, -spread) == 1);	// further than the spread from the edge
+		}
+
+		SECTION("Values are symmetric around the edge")
+		{
+			REQUIRE(value(4, 7) - 128 == 128 - value(3, 7));
+			REQUIRE(value(5, 7) > value(4, 7));
+			REQUIRE(value(2, 7) < value(3, 7));
+			REQUIRE(value(7, 5) == value(5, 7));
+		}
+	}
+
+	// Nearest pixel of the other side searched within the spread
+	static unsigned char bruteForceSdf(const GlyphBitmap& _coverage, int _spread, int _x, int _y)
+	{
+		auto isInside = [&](int _px, int _py)
+		{
+			return _px >= 0 && _py >= 0 && _px < static_cast<int>(_coverage.width) && _py < static_cast<int>(_coverage.rows)
+				&& _coverage.buffer[_px + _py * _coverage.width] >= 128;
+		};
+
+		bool inside = isInside(_x, _y);
+		int nearestSq = _spread * _spread + 1;
+		for (int dy = -_spread; dy <= _spread; dy++)
+			for (int dx = -_spread; dx <= _spread; dx++)
+				if (dx * dx + dy * dy < nearestSq && isInside(_x + dx, _y + dy) != inside)
+					nearestSq = dx * dx + dy * dy;
+
+		float distance = nearestSq > _spread * _spread ? static_cast<float>(_spread) : std::sqrt(static_cast<float>(nearestSq)) - 0.5f;
+		float value = (inside ? 1.f : -1.f) * distance * (127.f / _spread) + 128.5f;
+		return static_cast<unsigned char>(std::min(255.f, std::max(0.f, value)));
+	}
+
+	static GlyphBitmap renderCoverage(FT_Face _face, int _char, int _pixelSize)
+	{
+		FT_Set_Pixel_Sizes(_face, 0, _pixelSize);
+		FT_Load_Char(_face, _char, FT_LOAD_RENDER);
+		const FT_Bitmap& bitmap = _face->glyph->bitmap;
+		GlyphBitmap coverage;
+		coverage.width = bitmap.width;
+		coverage.rows = bitmap.rows;
+		for (unsigned int y = 0; y < bitmap.rows; y++)
+			coverage.buffer.insert(coverage.buffer.end(), bitmap.buffer + y * bitmap.pitch, bitmap.buffer + y * bitmap.pitch + bitmap.width);
+		return coverage;
+	}
+
+	TEST_CASE("Distance transform kernels are exact", "[SignedDistanceField]")
+	{
+		FT_Library library;
+		REQUIRE(FT_Init_FreeType(&library) == 0);
+		FT_Face face;
+		REQUIRE(FT_New_Face(library, "C:/windows/fonts/arial.ttf", 0, &face) == 0);
+
+		std::vector<SdfKernel> kernels = { SdfKernel::Scalar };
+		if (getBestSdfKernel() != SdfKernel::Scalar)
+			kernels.push_back(SdfKernel::Sse2);
+		if (getBestSdfKernel() == SdfKernel::Avx2)
+			kernels.push_back(SdfKernel::Avx2);
+
+		for (int c : { 'g', '@', '%' })
+		{
+			const int spread = 6;
+			GlyphBitmap coverage = renderCoverage(face, c, 48);
+			const int width = coverage.width + 2 * spread;
+			const int rows = coverage.rows + 2 * spread;
+
+			for (SdfKernel kernel : kernels)
+			{
+				// Written with the pitch of a wider page, the rest of the rows is left untouched
+				const int pitch = width + 5;
+				std::vector<unsigned char> page(pitch * rows, 0xAB);
+				generateSdf(coverage, spread, page.data(), pitch, kernel);
+				for (int y = 0; y < rows; y++)
+				{
+					for (int x = 0; x < width; x++)
+						REQUIRE(page[x + y * pitch] == bruteForceSdf(coverage, spread, x - spread, y - spread));
+					REQUIRE(page[width + y * pitch] == 0xAB);
+				}
+			}
+		}
+
+		FT_Done_Face(face);
+		FT_Done_FreeType(library);
+	}
+
+	TEST_CASE("Distance transform throughput", "[.][benchmark]")
+	{
+		FT_Library library;
+		REQUIRE(FT_Init_FreeType(&library) == 0);
+		FT_Face face;
+		REQUIRE(FT_New_Face(library, "C:/windows/fonts/arial.ttf", 0, &face) == 0);
+
+		const char* names[] = { "scalar", "sse2", "avx2" };
+		for (int size : { 32, 64, 128 })
+		{
+			std::vector<GlyphBitmap> coverages;
+			for (int c = 'A'; c <= 'z'; c++)
+				coverages.push_back(renderCoverage(face, c, size));
+
+			const int spread = size / 8;
+			for (int kernel = 0; kernel <= static_cast<int>(getBestSdfKernel()); kernel++)
+			{
+				GlyphBitmap sdf;
+				unsigned int glyphs = 0;
+				auto start = std::chrono::high_resolution_clock::now();
+				for (int n = 0; n < 20; n++)
+				{
+					for (const GlyphBitmap& coverage : coverages)
+					{
+						sdf.buffer.resize((coverage.width + 2 * spread) * (coverage.rows + 2 * spread));
+						generateSdf(coverage, spread, sdf.buffer.data(), coverage.width + 2 * spread, static_cast<SdfKernel>(kernel));
+						glyphs++;
+					}
+				}
+				double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+				WARN(size << " px, " << names[kernel] << ": " << glyphs / seconds << " glyphs/s");
+			}
+		}
+
+		FT_Done_Face(face);
+		FT_Done_FreeType(library);
+	}
+}
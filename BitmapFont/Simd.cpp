@@ -0,0 +1,36 @@
+#include "stdafx.h"
+#include "Simd.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace bmf
+{
+	bool cpuSupportsAvx2()
+	{
+#if !defined(BMF_SSE2)
+		return false;
+#elif defined(_MSC_VER)
+		static const bool supported = []
+		{
+			int info[4];
+			__cpuid(info, 0);
+			if (info[0] < 7)
+				return false;
+
+			// The OS must save the YMM registers
+			__cpuid(info, 1);
+			const int osxsave = 1 << 27;
+			const int avx = 1 << 28;
+			if ((info[2] & (osxsave | avx)) != (osxsave | avx) || (_xgetbv(0) & 6) != 6)
+				return false;
+			__cpuidex(info, 7, 0);
+			return (info[1] & (1 << 5)) != 0;
+		}();
+		return supported;
+#else
+		return __builtin_cpu_supports("avx2") != 0;
+#endif
+	}
+}
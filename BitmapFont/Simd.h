@@ -0,0 +1,24 @@
+#pragma once
+
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+// SSE2 is part of every x64 CPU and of the default 32 bits MSVC target.
+// AVX2 code paths are compiled for their own functions and picked at run time.
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define BMF_SSE2
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define BMF_TARGET_AVX2
+#else
+#define BMF_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace bmf
+{
+	bool cpuSupportsAvx2();
+}
+
+#endif
@@ -0,0 +1,105 @@
+#include "stdafx.h"
+#include "StrikeCache.h"
+#include "GlyphRasterizer.h"
+
+#include <cassert>
+#include <algorithm>
+#include <vector>
+
+namespace bmf
+{
+	void halveBgra(const GlyphBitmap& _src, GlyphBitmap& _dst)
+	{
+		assert(_src.format == PageFormat::Bgra8);
+		_dst.format = PageFormat::Bgra8;
+		_dst.width = (_src.width + 1) / 2;
+		_dst.rows = (_src.rows + 1) / 2;
+		_dst.left = _src.left / 2;
+		_dst.top = _src.top / 2;
+		_dst.buffer.assign(_dst.width * _dst.rows * 4, 0);
+
+		for (unsigned int y = 0; y < _dst.rows; y++)
+		{
+			for (unsigned int x = 0; x < _dst.width; x++)
+			{
+				unsigned int sums[4] = { 0, 0, 0, 0 };
+				for (unsigned int sy = y * 2; sy < std::min(y * 2 + 2, _src.rows); sy++)
+				{
+					for (unsigned int sx = x * 2; sx < std::min(x * 2 + 2, _src.width); sx++)
+					{
+						const unsigned char* pixel = &_src.buffer[(sx + sy * _src.width) * 4];
+						for (int c = 0; c < 4; c++)
+							sums[c] += pixel[c];
+					}
+				}
+				for (int c = 0; c < 4; c++)
+					_dst.buffer[(x + y * _dst.width) * 4 + c] = static_cast<unsigned char>((sums[c] + 2) / 4);
+			}
+		}
+	}
+
+	void resampleBgra(const GlyphBitmap& _src, unsigned int _width, unsigned int _rows, GlyphBitmap& _dst)
+	{
+		assert(_src.format == PageFormat::Bgra8 && _width > 0 && _rows > 0);
+		_dst.format = PageFormat::Bgra8;
+		_dst.width = _width;
+		_dst.rows = _rows;
+		_dst.buffer.resize(_width * _rows * 4);
+
+		// Source interval covered by each destination column or row, with the weight of every source pixel
+		struct Span
+		{
+			unsigned int		first;
+			std::vector<float>	weights;
+		};
+		auto computeSpans = [](unsigned int _srcSize, unsigned int _dstSize)
+		{
+			std::vector<Span> spans(_dstSize);
+			const float ratio = static_cast<float>(_srcSize) / _dstSize;
+			for (unsigned int i = 0; i < _dstSize; i++)
+			{
+				float begin = i * ratio;
+				float end = std::min((i + 1) * ratio, static_cast<float>(_srcSize));
+				spans[i].first = static_cast<unsigned int>(begin);
+				for (unsigned int s = spans[i].first; s < end; s++)
+				{
+					float covered = std::min(end, s + 1.f) - std::max(begin, static_cast<float>(s));
+					spans[i].weights.push_back(covered / (end - begin));
+				}
+			}
+			return spans;
+		};
+		const std::vector<Span> columns = computeSpans(_src.width, _width);
+		const std::vector<Span> rows = computeSpans(_src.rows, _rows);
+
+		for (unsigned int y = 0; y < _rows; y++)
+		{
+			for (unsigned int x = 0; x < _width; x++)
+			{
+				float sums[4] = { 0.f, 0.f, 0.f, 0.f };
+				for (size_t j = 0; j < rows[y].weights.size(); j++)
+				{
+					for (size_t i = 0; i < columns[x].weights.size(); i++)
+					{
+						float weight = rows[y].weights[j] * columns[x].weights[i];
+						const unsigned char* pixel = &_src.buffer[((columns[x].first + i) + (rows[y].first + j) * _src.width) * 4];
+						for (int c = 0; c < 4; c++)
+							sums[c] += pixel[c] * weight;
+					}
+				}
+				for (int c = 0; c < 4; c++)
+					_dst.buffer[(x + y * _width) * 4 + c] = static_cast<unsigned char>(std::min(255.f, sums[c] + 0.5f));
+			}
+		}
+	}
+
+	GlyphBitmapPtr StrikeCache::find(int _fontIndex, unsigned int _glyphIndex, int _loadFlags, int _strike, int _level)
+	{
+		return m_bitmaps.find(Key(_fontIndex, _glyphIndex, _loadFlags, _strike, _level));
+	}
+
+	void StrikeCache::insert(int _fontIndex, unsigned int _glyphIndex, int _loadFlags, int _strike, int _level, const GlyphBitmapPtr& _bitmap)
+	{
+		m_bitmaps.insert(Key(_fontIndex, _glyphIndex, _loadFlags, _strike, _level), _bitmap, sizeof(GlyphBitmap) + _bitmap->buffer.size());
+	}
+}
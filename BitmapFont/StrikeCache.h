@@ -0,0 +1,50 @@
+#pragma once
+
+#ifndef _STRIKE_CACHE_H_
+#define _STRIKE_CACHE_H_
+
+#include <tuple>
+#include <memory>
+
+#include "LruCache.h"
+
+namespace bmf
+{
+	struct GlyphBitmap;
+	typedef std::shared_ptr<const GlyphBitmap> GlyphBitmapPtr;
+
+	// Premultiplied BGRA downscaling. halveBgra() averages 2x2 blocks, the last row and column
+	// of odd sizes being averaged with transparent pixels. resampleBgra() averages the source
+	// pixels covered by every destination pixel, weighted by the covered area.
+	void halveBgra(const GlyphBitmap& _src, GlyphBitmap& _dst);
+	void resampleBgra(const GlyphBitmap& _src, unsigned int _width, unsigned int _rows, GlyphBitmap& _dst);
+
+	// Color bitmaps of the strikes of bitmap only fonts, keyed by (font, glyph index, load flags,
+	// strike, level), where each level halves the previous one like a mipmap chain. Sizes between
+	// two levels are resampled from the level above them, so the expensive reduction of large
+	// strikes is shared by every requested size, within a memory budget (see LruCache). The load
+	// flags are part of the key as they change the bitmap FreeType loads (FT_LOAD_NO_BITMAP,
+	// FT_LOAD_TARGET_XXX...).
+	class StrikeCache
+	{
+	public:
+		explicit StrikeCache(size_t _budget) : m_bitmaps(_budget) {}
+
+		GlyphBitmapPtr find(int _fontIndex, unsigned int _glyphIndex, int _loadFlags, int _strike, int _level);
+		void insert(int _fontIndex, unsigned int _glyphIndex, int _loadFlags, int _strike, int _level, const GlyphBitmapPtr& _bitmap);
+
+		void setBudget(size_t _budget) { m_bitmaps.setBudget(_budget); }
+		size_t getBudget() const { return m_bitmaps.getBudget(); }
+		size_t getMemoryUsage() const { return m_bitmaps.getMemoryUsage(); }
+		unsigned int getBitmapsCount() const { return m_bitmaps.getCount(); }
+		unsigned int getHitsCount() const { return m_bitmaps.getHitsCount(); }
+		unsigned int getMissesCount() const { return m_bitmaps.getMissesCount(); }
+
+	private:
+		typedef std::tuple<int, unsigned int, int, int, int> Key;
+
+		LruCache<Key, GlyphBitmapPtr>	m_bitmaps;
+	};
+}
+
+#endif
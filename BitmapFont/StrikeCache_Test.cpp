@@ -0,0 +1,84 @@
+#include "stdafx.h"
+#include "StrikeCache.h"
+#include "GlyphRasterizer.h"
+
+#include "catch.hpp"
+
+namespace bmf
+{
+	static GlyphBitmapPtr makeBgra(unsigned int _width, unsigned int _rows, unsigned char _b, unsigned char _g, unsigned char _r, unsigned char _a)
+	{
+		std::shared_ptr<GlyphBitmap> bitmap = std::make_shared<GlyphBitmap>();
+		bitmap->format = PageFormat::Bgra8;
+		bitmap->width = _width;
+		bitmap->rows = _rows;
+		for (unsigned int i = 0; i < _width * _rows; i++)
+			bitmap->buffer.insert(bitmap->buffer.end(), { _b, _g, _r, _a });
+		return bitmap;
+	}
+
+	TEST_CASE("Strike cache works properly", "[StrikeCache]")
+	{
+		SECTION("Halving averages 2x2 blocks")
+		{
+			GlyphBitmapPtr source = makeBgra(5, 3, 40, 80, 120, 200);
+			GlyphBitmap half;
+			halveBgra(*source, half);
+			REQUIRE(half.format == PageFormat::Bgra8);
+			REQUIRE(half.width == 3);
+			REQUIRE(half.rows == 2);
+			REQUIRE(half.buffer[0] == 40);
+			REQUIRE(half.buffer[3] == 200);
+
+			// The last column and row are averaged with transparent pixels
+			const unsigned char* corner = &half.buffer[(2 + 1 * 3) * 4];
+			REQUIRE(corner[0] == 10);
+			REQUIRE(corner[3] == 50);
+		}
+
+		SECTION("Resampling preserves uniform colors")
+		{
+			GlyphBitmapPtr source = makeBgra(27, 27, 10, 20, 30, 255);
+			GlyphBitmap resampled;
+			resampleBgra(*source, 24, 20, resampled);
+			REQUIRE(resampled.width == 24);
+			REQUIRE(resampled.rows == 20);
+			for (size_t i = 0; i < resampled.buffer.size(); i += 4)
+			{
+				REQUIRE(resampled.buffer[i] == 10);
+				REQUIRE(resampled.buffer[i + 2] == 30);
+				REQUIRE(resampled.buffer[i + 3] == 255);
+			}
+
+			// A 2 pixels wide stripe covers 2/3 of the pixel at 3:1
+			std::shared_ptr<GlyphBitmap> stripes = std::make_shared<GlyphBitmap>(*makeBgra(3, 1, 0, 0, 0, 0));
+			for (int i = 0; i < 8; i++)
+				stripes->buffer[i] = 255;
+			resampleBgra(*stripes, 1, 1, resampled);
+			REQUIRE(resampled.buffer[3] == 170);
+		}
+
+		SECTION("Levels are kept within the budget")
+		{
+			GlyphBitmapPtr level0 = makeBgra(64, 64, 1, 2, 3, 4);
+			GlyphBitmapPtr level1 = makeBgra(32, 32, 1, 2, 3, 4);
+			StrikeCache cache(level0->buffer.size() + level1->buffer.size() + 2 * sizeof(GlyphBitmap));
+
+			REQUIRE(cache.find(0, 5, 0, 0, 0) == nullptr);
+			cache.insert(0, 5, 0, 0, 0, level0);
+			cache.insert(0, 5, 0, 0, 1, level1);
+			REQUIRE(cache.find(0, 5, 0, 0, 1) == level1);
+			REQUIRE(cache.find(0, 5, 0, 1, 1) == nullptr);
+			REQUIRE(cache.find(0, 5, 4, 0, 1) == nullptr);	// other load flags
+			REQUIRE(cache.getBitmapsCount() == 2);
+			REQUIRE(cache.getHitsCount() == 1);
+			REQUIRE(cache.getMissesCount() == 3);
+
+			// Level 0 is the least recently used
+			cache.insert(1, 5, 0, 0, 1, makeBgra(32, 32, 0, 0, 0, 0));
+			REQUIRE(cache.find(0, 5, 0, 0, 0) == nullptr);
+			REQUIRE(cache.find(0, 5, 0, 0, 1) == level1);
+			REQUIRE(cache.getMemoryUsage() <= cache.getBudget());
+		}
+	}
+}